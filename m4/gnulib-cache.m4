@@ -27,7 +27,7 @@
 
 
 # Specification in the form of a command-line invocation:
-#   gnulib-tool --import --dir=. --lib=libgnu --source-base=lib --m4-base=m4 --doc-base=doc --tests-base=tests --aux-dir=build-aux --no-conditional-dependencies --libtool --macro-prefix=gl alloca-opt arpa_inet crypto/md5 crypto/sha1 environ filemode fnmatch fnmatch-gnu getopt-gnu gettext gettimeofday glob human iconv_open inet_pton lchown longlong lstat mbswidth memmem mktime modechange parse-datetime passfd poll readlink regex sockets socklen strdup-posix strftime strptime strstr strtok_r unsetenv vsnprintf vsnprintf-posix wcwidth
+#   gnulib-tool --import --dir=. --lib=libgnu --source-base=lib --m4-base=m4 --doc-base=doc --tests-base=tests --aux-dir=build-aux --no-conditional-dependencies --libtool --macro-prefix=gl alloca-opt arpa_inet crypto/md5 crypto/sha1 crypto/sha256 environ filemode fnmatch fnmatch-gnu getopt-gnu gettext gettimeofday glob human iconv_open inet_pton lchown longlong lstat mbswidth memmem mktime modechange parse-datetime passfd poll readlink regex sockets socklen strdup-posix strftime strptime strstr strtok_r unsetenv vsnprintf vsnprintf-posix wcwidth
 
 # Specification in the form of a few gnulib-tool.m4 macro invocations:
 gl_LOCAL_DIR([])
@@ -36,6 +36,7 @@ gl_MODULES([
   arpa_inet
   crypto/md5
   crypto/sha1
+  crypto/sha256
   environ
   filemode
   fnmatch
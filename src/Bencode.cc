@@ -320,16 +320,10 @@ int BeNode::ComputeLength()
    switch(type)
    {
    case BE_STR:
-      i=str.length();
-      len+=1+i; // ':' + string
-      while(i>=10) {
-	 len++;
-	 i/=10;
-      }
-      len++; // last digit
+      len+=BeEncoder::StrLength(str.length());
       break;
    case BE_INT:
-      len+=1+xstring::format("%lld",num).length()+1; // 'i' + number + 'e'
+      len+=BeEncoder::IntLength(num);
       break;
    case BE_LIST:
       len++; // 'l'
@@ -341,14 +335,7 @@ int BeNode::ComputeLength()
       len++; // 'd'
       for(BeNode *e=dict.each_begin(); e; e=dict.each_next())
       {
-	 const xstring &key=dict.each_key();
-	 i=key.length();
-	 len+=1+i; // ':' + string
-	 while(i>=10) {
-	    len++;
-	    i/=10;
-	 }
-	 len++; // last digit
+	 len+=BeEncoder::StrLength(dict.each_key().length());
 	 len+=e->ComputeLength();
       }
       len++; // 'e'
@@ -357,48 +344,315 @@ int BeNode::ComputeLength()
    return len;
 }
 
-void BeNode::Pack(const SMTaskRef<IOBuffer> &buf)
-{
-   xstring &tmp=xstring::get_tmp("");
-   Pack(tmp);
-   buf->Put(tmp);
-}
-void BeNode::Pack(xstring &buf)
+void BeNode::Pack(BeEncoder &enc)
 {
    int i;
    switch(type)
    {
    case BE_STR:
-      i=str.length();
-      buf.appendf("%d:",i);
-      buf.append(str);
+      enc.Str(str);
       break;
    case BE_INT:
-      buf.appendf("i%llde",num);
+      enc.Int(num);
       break;
    case BE_LIST:
-      buf.append('l');
+      enc.List();
       for(i=0; i<list.count(); i++)
-	 list[i]->Pack(buf);
-      buf.append('e');
+	 list[i]->Pack(enc);
+      enc.End();
       break;
    case BE_DICT:
-      buf.append('d');
+      enc.Dict();
       for(BeNode *e=dict.each_begin(); e; e=dict.each_next())
       {
-	 const xstring &key=dict.each_key();
-	 i=key.length();
-	 buf.appendf("%d:",i);
-	 buf.append(key);
-	 e->Pack(buf);
+	 enc.Str(dict.each_key());
+	 e->Pack(enc);
       }
-      buf.append('e');
+      enc.End();
       break;
    }
 }
+void BeNode::Pack(const SMTaskRef<IOBuffer> &buf)
+{
+   BeEncoder enc(buf.get_non_const());
+   Pack(enc);
+}
+void BeNode::Pack(xstring &buf)
+{
+   BeEncoder enc(&buf);
+   Pack(enc);
+}
 const xstring& BeNode::Pack()
 {
    xstring& tmp=xstring::get_tmp("");
    Pack(tmp);
    return tmp;
 }
+
+int BeView::AddNode(BeNode::be_type_t t,const char *d,int l)
+{
+   if(open.count()>0)
+      nodes[open.last()].count++;
+   node n;
+   n.type=t;
+   n.count=0;
+   n.skip=1;
+   n.data=d;
+   n.len=l;
+   n.num=0;
+   nodes.append(n);
+   return nodes.count()-1;
+}
+
+bool BeView::Parse(const char *s,int s_len,int *rest)
+{
+   nodes.truncate();
+   open.truncate();
+   const char *end=s+s_len;
+   do {
+      if(s>=end)
+	 goto incomplete;
+      if(open.count()>0)
+      {
+	 node& c=nodes[open.last()];
+	 if(*s=='e')
+	 {
+	    if(c.type==BeNode::BE_DICT) {
+	       if(c.count&1)
+		  goto error;	// a key without value
+	       c.count/=2;
+	    }
+	    s++;
+	    c.len=s-c.data;
+	    c.skip=nodes.count()-open.last();
+	    open.chop();
+	    continue;
+	 }
+	 if(c.type==BeNode::BE_DICT && !(c.count&1) && !c_isdigit(*s))
+	    goto error;	// keys must be strings
+      }
+      switch(*s)
+      {
+      case 'l':
+      case 'd':
+	 open.append(AddNode(*s=='l'?BeNode::BE_LIST:BeNode::BE_DICT,s,0));
+	 s++;
+	 break;
+      case 'i':
+      {
+	 const char *b=s++;
+	 bool neg=false;
+	 if(s<end && *s=='-') {
+	    neg=true;
+	    s++;
+	 }
+	 if(s>=end)
+	    goto incomplete;
+	 if(!c_isdigit(*s))
+	    goto error;
+	 if(*s=='0' && s+1<end && s[1]!='e')
+	    goto error;
+	 long long n=0;
+	 while(s<end && c_isdigit(*s))
+	    n=n*10+*s++-'0';
+	 if(s>=end)
+	    goto incomplete;
+	 if(*s!='e')
+	    goto error;
+	 s++;
+	 nodes[AddNode(BeNode::BE_INT,b,s-b)].num=(neg?-n:n);
+	 break;
+      }
+      default:
+      {
+	 if(!c_isdigit(*s))
+	    goto error;
+	 int n=0;
+	 while(s<end && c_isdigit(*s)) {
+	    if(n>=end-s)
+	       goto incomplete;
+	    n=n*10+*s++-'0';
+	 }
+	 if(s>=end)
+	    goto incomplete;
+	 if(*s!=':')
+	    goto error;
+	 s++;
+	 if(end-s<n)
+	    goto incomplete;
+	 AddNode(BeNode::BE_STR,s,n);
+	 s+=n;
+	 break;
+      }
+      }
+   } while(open.count()>0);
+   *rest=end-s;
+   return true;
+
+incomplete:
+   *rest=0;
+   return false;
+error:
+   *rest=end-s;
+   return false;
+}
+
+int BeView::Lookup(int dict,const char *key,int key_len) const
+{
+   if(dict<0 || nodes[dict].type!=BeNode::BE_DICT)
+      return -1;
+   int k=First(dict);
+   for(int i=0; i<nodes[dict].count; i++)
+   {
+      int v=Next(k);
+      const node& kn=nodes[k];
+      if(kn.len==key_len && !memcmp(kn.data,key,key_len))
+	 return v;
+      k=Next(v);
+   }
+   return -1;
+}
+const char *BeView::LookupStr(int dict,const char *key,int *len) const
+{
+   int n=Lookup(dict,key,BeNode::BE_STR);
+   if(n<0) {
+      *len=0;
+      return 0;
+   }
+   *len=nodes[n].len;
+   return nodes[n].data;
+}
+void BeView::LookupStr(int dict,const char *key,xstring& out) const
+{
+   int len;
+   const char *s=LookupStr(dict,key,&len);
+   out.nset(s,len);
+}
+long long BeView::LookupInt(int dict,const char *key) const
+{
+   int n=Lookup(dict,key,BeNode::BE_INT);
+   if(n<0)
+      return 0;
+   return nodes[n].num;
+}
+bool BeView::StrEq(int i,const char *s) const
+{
+   if(i<0 || nodes[i].type!=BeNode::BE_STR)
+      return false;
+   int len=strlen(s);
+   return nodes[i].len==len && !memcmp(nodes[i].data,s,len);
+}
+
+void BeView::Format1(xstring &buf,int i) const
+{
+   const node& n=nodes[i];
+   int j,c;
+   switch(n.type)
+   {
+   case BeNode::BE_STR:
+      buf.append('"');
+      xstring::get_tmp(n.data,n.len).dump_to(buf);
+      buf.append('"');
+      break;
+   case BeNode::BE_INT:
+      buf.appendf("%lld",n.num);
+      break;
+   case BeNode::BE_LIST:
+      buf.append('[');
+      for(j=First(i),c=0; c<n.count; j=Next(j),c++) {
+	 if(c>0)
+	    buf.append(", ");
+	 Format1(buf,j);
+      }
+      buf.append(']');
+      break;
+   case BeNode::BE_DICT:
+      buf.append('{');
+      for(j=First(i),c=0; c<n.count; j=Next(j),c++)
+      {
+	 if(c>0)
+	    buf.append(", ");
+	 const node& k=nodes[j];
+	 j=Next(j);
+	 const node& v=nodes[j];
+	 buf.append('"').append(k.data,k.len).append("\":");
+	 if(v.type==BeNode::BE_STR) {
+	    char tmp[40];
+	    bool ip=(k.len==2 && !memcmp(k.data,"ip",2))
+	       || (k.len==6 && !memcmp(k.data,"yourip",6));
+	    if(v.len==4 && (ip || (k.len==4 && !memcmp(k.data,"ipv4",4)))) {
+	       inet_ntop(AF_INET,v.data,tmp,sizeof(tmp));
+	       buf.append(tmp);
+	       continue;
+	    }
+#if INET6
+	    else if(v.len==16 && (ip || (k.len==4 && !memcmp(k.data,"ipv6",4)))) {
+	       inet_ntop(AF_INET6,v.data,tmp,sizeof(tmp));
+	       buf.append(tmp);
+	       continue;
+	    }
+#endif//INET6
+	 }
+	 Format1(buf,j);
+      }
+      buf.append('}');
+      break;
+   }
+}
+const char *BeView::Format1() const
+{
+   static xstring buf;
+   buf.set("");
+   if(nodes.count()>0)
+      Format1(buf,0);
+   return buf;
+}
+
+void BeEncoder::PutNumber(long long n)
+{
+   char tmp[24];
+   char *p=tmp+sizeof(tmp);
+   unsigned long long u=(n<0?-(unsigned long long)n:n);
+   do {
+      *--p='0'+u%10;
+      u/=10;
+   } while(u>0);
+   if(n<0)
+      *--p='-';
+   Put(p,tmp+sizeof(tmp)-p);
+}
+void BeEncoder::Str(const char *s,int len)
+{
+   PutNumber(len);
+   Put(':');
+   Put(s,len);
+}
+void BeEncoder::Int(long long n)
+{
+   Put('i');
+   PutNumber(n);
+   Put('e');
+}
+int BeEncoder::StrLength(int len)
+{
+   int l=1+len; // ':' + string
+   do {
+      l++;
+      len/=10;
+   } while(len>0);
+   return l;
+}
+int BeEncoder::IntLength(long long n)
+{
+   int l=2; // 'i' + 'e'
+   unsigned long long u=n;
+   if(n<0) {
+      l++;
+      u=-(unsigned long long)n;
+   }
+   do {
+      l++;
+      u/=10;
+   } while(u>0);
+   return l;
+}
@@ -75,6 +75,7 @@ public:
    const xstring& Pack();
    void Pack(xstring &buf);
    void Pack(const SMTaskRef<IOBuffer> &buf);
+   void Pack(class BeEncoder &enc);
 
    void Format(xstring &buf,int level);
    const char *Format();
@@ -84,4 +85,93 @@ public:
    static const char *TypeName(be_type_t t);
 };
 
+// Flat bencode decoder. Parse() tokenizes the input into an array of
+// nodes in document order without allocating per element; strings point
+// into the source buffer, which must outlive the view. A container node
+// records the size of its subtree, so that the children can be walked
+// with First/Next and dictionary keys are looked up by a linear scan.
+// Nodes are referred to by index, 0 is the root; -1 means "not found".
+class BeView
+{
+public:
+   struct node
+   {
+      BeNode::be_type_t type;
+      int count;	 // items in a list, key/value pairs in a dict
+      int skip;	 // nodes in the subtree including this one
+      const char *data;  // string contents, or the container encoding
+      int len;	 // string length, or the container encoding length
+      long long num;
+   };
+
+private:
+   xarray<node> nodes;
+   xarray<int> open;  // containers being parsed
+
+   int AddNode(BeNode::be_type_t t,const char *d,int l);
+
+public:
+   bool Parse(const char *s,int len,int *rest);
+
+   int Count() const { return nodes.count(); }
+   const node& operator[](int i) const { return nodes[i]; }
+   BeNode::be_type_t Type(int i) const { return nodes[i].type; }
+   int First(int i) const { return i+1; }
+   int Next(int i) const { return i+nodes[i].skip; }
+
+   int Lookup(int dict,const char *key,int key_len) const;
+   int Lookup(int dict,const char *key) const {
+      return Lookup(dict,key,strlen(key));
+   }
+   int Lookup(int dict,const char *key,BeNode::be_type_t t) const {
+      int n=Lookup(dict,key);
+      if(n>=0 && nodes[n].type!=t)
+	 n=-1;
+      return n;
+   }
+   // returns 0 if there is no such string
+   const char *LookupStr(int dict,const char *key,int *len) const;
+   // copies the string to out, sets it to null if there is no such string
+   void LookupStr(int dict,const char *key,xstring& out) const;
+   long long LookupInt(int dict,const char *key) const;
+   bool StrEq(int i,const char *s) const;
+
+   void Format1(xstring &buf,int i) const;
+   const char *Format1() const;
+};
+
+// Streaming bencode encoder. The caller issues the elements in document
+// order (dictionary keys must be sorted) and they are written straight
+// to the destination, no tree is built.
+class BeEncoder
+{
+   IOBuffer *buf;
+   xstring *str;
+
+   void Put(const char *s,int len) {
+      if(buf)
+	 buf->Put(s,len);
+      else
+	 str->append(s,len);
+   }
+   void Put(char c) { Put(&c,1); }
+   void PutNumber(long long n);
+
+public:
+   BeEncoder(IOBuffer *b) : buf(b), str(0) {}
+   BeEncoder(xstring *s) : buf(0), str(s) {}
+
+   void Str(const char *s,int len);
+   void Str(const char *s) { Str(s,strlen(s)); }
+   void Str(const xstring& s) { Str(s.get(),s.length()); }
+   void Int(long long n);
+   void Key(const char *k) { Str(k); }
+   void List() { Put('l'); }
+   void Dict() { Put('d'); }
+   void End() { Put('e'); }
+
+   static int StrLength(int len);
+   static int IntLength(long long n);
+};
+
 #endif//BENCODE_H
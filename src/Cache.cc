@@ -19,6 +19,22 @@
 
 #include <config.h>
 #include "Cache.h"
+#include "misc.h"
+
+Cache *Cache::cache_chain;
+
+Cache::Cache(const char *n,const ResType *s,const ResType *e)
+   : res_max_size(s), res_enable(e), name(n), hits(0), misses(0)
+{
+   chain=0;
+   curr=0;
+   ListAdd(Cache,cache_chain,this,next_cache);
+}
+Cache::~Cache()
+{
+   Flush();
+   ListDel(Cache,cache_chain,this,next_cache);
+}
 
 void Cache::Trim()
 {
@@ -63,3 +79,18 @@ CacheEntry *Cache::IterateDelete()
    delete replace_value(curr[0],curr[0]->next);
    return *curr;
 }
+
+int Cache::EntryCount() const
+{
+   int count=0;
+   for(const CacheEntry *e=chain; e; e=e->next)
+      count++;
+   return count;
+}
+long Cache::EstimateSize() const
+{
+   long size=0;
+   for(const CacheEntry *e=chain; e; e=e->next)
+      size+=e->EstimateSize();
+   return size;
+}
@@ -35,28 +35,41 @@ class Cache
 {
    const ResType *res_max_size;
    const ResType *res_enable;
+
+   // all caches, for statistics
+   const char *name;
+   Cache *next_cache;
+   static Cache *cache_chain;
+
+   unsigned long long hits;
+   unsigned long long misses;
 protected:
    CacheEntry *chain;
    CacheEntry **curr;
    CacheEntry *IterateFirst();
    CacheEntry *IterateNext();
    CacheEntry *IterateDelete();
+   void CountHit()  { hits++; }
+   void CountMiss() { misses++; }
 public:
    void Trim();
    void Flush();
-   Cache(const ResType *s,const ResType *e) {
-      res_max_size=s;
-      res_enable=e;
-      chain=0;
-      curr=0;
-   }
-   ~Cache() { Flush(); }
+   Cache(const char *n,const ResType *s,const ResType *e);
+   ~Cache();
    bool IsEnabled(const char *closure) { return res_enable->QueryBool(closure); }
    long SizeLimit() { return res_max_size->Query(0); }
    void AddCacheEntry(CacheEntry *e) {
       e->next=chain;
       chain=e;
    }
+
+   const char *GetName() const { return name; }
+   unsigned long long GetHits() const { return hits; }
+   unsigned long long GetMisses() const { return misses; }
+   int EntryCount() const;
+   long EstimateSize() const;
+   static Cache *FirstCache() { return cache_chain; }
+   Cache *NextCache() const { return next_cache; }
 };
 
 #endif//CACHE_H
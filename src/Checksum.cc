@@ -0,0 +1,163 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2013 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <strings.h>
+#if USE_ZLIB
+# include <zlib.h>
+#endif
+#include "Checksum.h"
+
+static const struct
+{
+   Checksum::algo_t algo;
+   const char *name;
+   int size;
+} algo_table[]=
+{
+#if USE_ZLIB
+   {Checksum::CRC32,  "CRC32",  4},
+#endif
+   {Checksum::MD5,    "MD5",    MD5_DIGEST_SIZE},
+   {Checksum::SHA1,   "SHA1",   SHA1_DIGEST_SIZE},
+   {Checksum::SHA256, "SHA256", SHA256_DIGEST_SIZE},
+   {Checksum::NONE,   0, 0}
+};
+
+Checksum::algo_t Checksum::Find(const char *name)
+{
+   if(!name)
+      return NONE;
+   // accept the spellings used by HTTP Digest and FTP HASH too.
+   char n[16];
+   int i=0;
+   for( ; *name && i<(int)sizeof(n)-1; name++)
+      if(*name!='-')
+	 n[i++]=*name;
+   n[i]=0;
+   if(!strcasecmp(n,"SHA"))
+      return SHA1;
+   for(i=0; algo_table[i].name; i++)
+      if(!strcasecmp(n,algo_table[i].name))
+	 return algo_table[i].algo;
+   return NONE;
+}
+const char *Checksum::Name(algo_t a)
+{
+   for(int i=0; algo_table[i].name; i++)
+      if(algo_table[i].algo==a)
+	 return algo_table[i].name;
+   return 0;
+}
+int Checksum::DigestSize(algo_t a)
+{
+   for(int i=0; algo_table[i].name; i++)
+      if(algo_table[i].algo==a)
+	 return algo_table[i].size;
+   return 0;
+}
+
+Checksum::Checksum(algo_t a)
+   : algo(a)
+{
+   switch(algo)
+   {
+   case CRC32:
+#if USE_ZLIB
+      ctx.crc32=crc32(0,Z_NULL,0);
+      break;
+#else
+      algo=NONE;
+      /* fallthrough */
+#endif
+   case NONE:
+      break;
+   case MD5:
+      md5_init_ctx(&ctx.md5);
+      break;
+   case SHA1:
+      sha1_init_ctx(&ctx.sha1);
+      break;
+   case SHA256:
+      sha256_init_ctx(&ctx.sha256);
+      break;
+   }
+}
+
+void Checksum::Update(const char *buf,size_t len)
+{
+   switch(algo)
+   {
+   case NONE:
+      break;
+   case CRC32:
+#if USE_ZLIB
+      // crc32 takes uInt lengths.
+      while(len>0)
+      {
+	 uInt n=(len>0x40000000?0x40000000:len);
+	 ctx.crc32=crc32(ctx.crc32,(const Bytef*)buf,n);
+	 buf+=n;
+	 len-=n;
+      }
+#endif
+      break;
+   case MD5:
+      md5_process_bytes(buf,len,&ctx.md5);
+      break;
+   case SHA1:
+      sha1_process_bytes(buf,len,&ctx.sha1);
+      break;
+   case SHA256:
+      sha256_process_bytes(buf,len,&ctx.sha256);
+      break;
+   }
+}
+
+const xstring& Checksum::Finish()
+{
+   if(digest.length()>0)
+      return digest;
+   digest.get_space(DigestSize(algo));
+   char *d=digest.get_non_const();
+   switch(algo)
+   {
+   case NONE:
+      break;
+   case CRC32:
+      // big endian, as it is printed.
+      d[0]=ctx.crc32>>24;
+      d[1]=ctx.crc32>>16;
+      d[2]=ctx.crc32>>8;
+      d[3]=ctx.crc32;
+      break;
+   case MD5:
+      md5_finish_ctx(&ctx.md5,d);
+      break;
+   case SHA1:
+      sha1_finish_ctx(&ctx.sha1,d);
+      break;
+   case SHA256:
+      sha256_finish_ctx(&ctx.sha256,d);
+      break;
+   }
+   digest.set_length(DigestSize(algo));
+   return digest;
+}
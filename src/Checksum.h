@@ -0,0 +1,66 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2013 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <stdint.h>
+#include "md5.h"
+#include "sha1.h"
+#include "sha256.h"
+#include "xstring.h"
+
+// Streaming message digest, fed with data as it passes by.
+class Checksum
+{
+public:
+   enum algo_t
+   {
+      NONE,
+      CRC32,   // only when built with zlib
+      MD5,
+      SHA1,
+      SHA256,
+   };
+
+private:
+   algo_t algo;
+   union
+   {
+      uint32_t crc32;
+      struct md5_ctx md5;
+      struct sha1_ctx sha1;
+      struct sha256_ctx sha256;
+   } ctx;
+   xstring digest;   // binary, valid after Finish
+
+public:
+   Checksum(algo_t a);
+   void Update(const char *buf,size_t len);
+   const xstring& Finish();
+   const xstring& GetDigest() const { return digest; }
+   algo_t GetAlgo() const { return algo; }
+   const char *GetName() const { return Name(algo); }
+
+   static algo_t Find(const char *name);
+   static const char *Name(algo_t a);
+   static int DigestSize(algo_t a);
+};
+
+#endif//CHECKSUM_H
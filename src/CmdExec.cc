@@ -71,6 +71,7 @@ static ResType lftp_cmd_vars[] = {
    {"cmd:trace",		 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"cmd:parallel",		 "1",	  ResMgr::UNumberValidate,0},
    {"cmd:queue-parallel",	 "1",	  ResMgr::UNumberValidate,0},
+   {"cmd:queue-host-parallel",	 "0",	  ResMgr::UNumberValidate,0},
    {"cmd:cls-exact-time",	 "yes",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {0}
 };
@@ -261,6 +262,8 @@ void CmdExec::AddNewJob(Job *new_job)
    new_job->SetParentFg(this,!background);
    exit_code=0;
    AddWaiting(new_job);
+   if(queue_feeder)
+      queue_feeder->JobStarted(new_job);
    if(background) {
       Roll(new_job);
       if(!new_job->Done())
@@ -558,6 +561,8 @@ int CmdExec::Do()
 	    j->SayFinal(); // final phrase like 'rm succeed'
 	 exit_code=j->ExitCode();
 	 RemoveWaiting(j);
+	 if(queue_feeder)
+	    queue_feeder->JobFinished(j);
 	 Delete(j);
 	 beep_if_long();
       	 return MOVED;
@@ -1312,7 +1317,7 @@ CmdExec  *CmdExec::GetQueue(bool create)
    queue->AllocJobno();
    const char *url=session->GetConnectURL(FA::NO_PATH);
    queue->cmdline.vset("queue (",url,slot?"; ":"",slot?slot.get():"",")",NULL);
-   queue->queue_feeder=new QueueFeeder(session->GetCwd(), cwd->GetName());
+   queue->queue_feeder=new QueueFeeder(session->GetCwd(), cwd->GetName(), this_url);
    queue->SetCmdFeeder(queue->queue_feeder);
    queue->Reconfig(0);
 
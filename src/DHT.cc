@@ -41,7 +41,7 @@ DHT::DHT(int af,const xstring& id)
    : af(af), rate_limit("DHT"),
      sent_req_expire_scan(5), search_cleanup_timer(5),
      refresh_timer(1), nodes_cleanup_timer(30), save_timer(300),
-     node_id(id.copy()), t(random())
+     node_id(id.copy()), max_stored_torrents(0), t(random())
 {
    LogNote(10,"creating DHT with id=%s",node_id.hexdump());
    Reconfig(0);
@@ -133,21 +133,13 @@ int DHT::Do()
 	       routes[i]->RemoveNode(K); // too may candidates, trim one
 	 }
       }
-      // remove bad peers
+      // remove expired peers
       for(KnownTorrent *t=torrents.each_begin(); t; t=torrents.each_next()) {
-	 xarray_p<Peer>& p=t->peers;
-	 int seeds=0;
-	 for(int i=0; i<p.count(); i++) {
-	    if(!p[i]->IsGood())
-	       p.remove(i--);
-	    else
-	       seeds+=p[i]->seed;
-	 }
-	 LogNote(9,"torrent %s has %d known peers (%d seeds)",
-	    torrents.each_key().hexdump(),p.count(),seeds);
-	 if(p.count()==0)
+	 t->RemoveExpiredPeers();
+	 if(t->peers.count()==0)
 	    torrents.remove(torrents.each_key());
       }
+      LogNote(9,"%d torrents with known peers",torrents.count());
       nodes_cleanup_timer.Reset();
       if(save_timer.Stopped()) {
 	 Save();
@@ -198,7 +190,8 @@ int DHT::Do()
       m=MOVED;
    }
 
-   if(send_queue.count()>0 && MaySendMessage()) {
+   // hand over as many messages as allowed, the udp listener sends them in a batch
+   while(send_queue.count()>0 && MaySendMessage()) {
       SendMessage(send_queue.next().borrow());
       m=MOVED;
    }
@@ -217,25 +210,43 @@ BeNode *DHT::NewQuery(const char *q,xmap_p<BeNode>& a)
    m.add("a",new BeNode(&a));
    return new BeNode(&m);
 }
-BeNode *DHT::NewReply(const xstring& t0,xmap_p<BeNode>& r)
+void DHT::BeginReply(BeEncoder& r,const sockaddr_u& a)
 {
-   xmap_p<BeNode> m;
-   m.add("t",new BeNode(t0));
-   m.add("y",new BeNode("r",1));
-   r.add("id",new BeNode(node_id));
-   m.add("r",new BeNode(&r));
-   return new BeNode(&m);
+   r.Dict();
+   r.Key("r");
+   r.Dict();
+   r.Key("id");
+   r.Str(node_id);
+   if(a.family()==AF_INET) {
+      r.Key("ip");
+      r.Str(a.compact_addr());
+   }
 }
-BeNode *DHT::NewError(const xstring& t0,int code,const char *msg)
+void DHT::EndReply(BeEncoder& r,const xstring& t0)
 {
-   xmap_p<BeNode> m;
-   m.add("t",new BeNode(t0));
-   m.add("y",new BeNode("e",1));
-   xarray_p<BeNode> e;
-   e.append(new BeNode(code));
-   e.append(new BeNode(msg));
-   m.add("e",new BeNode(&e));
-   return new BeNode(&m);
+   r.End();
+   r.Key("t");
+   r.Str(t0);
+   r.Key("y");
+   r.Str("r");
+   r.End();
+}
+void DHT::SendError(const xstring& t0,int code,const char *msg,const sockaddr_u& a)
+{
+   xstring pkt;
+   BeEncoder e(&pkt);
+   e.Dict();
+   e.Key("e");
+   e.List();
+   e.Int(code);
+   e.Str(msg);
+   e.End();
+   e.Key("t");
+   e.Str(t0);
+   e.Key("y");
+   e.Str("e");
+   e.End();
+   SendReply(pkt,a);
 }
 const char *DHT::MessageType(BeNode *q)
 {
@@ -258,15 +269,49 @@ void DHT::SendMessage(BeNode *q,const sockaddr_u& a,const xstring& id)
    }
    send_queue.push(new Request(q,a,id));
 }
+void DHT::SendReply(const xstring& pkt,const sockaddr_u& a)
+{
+   if(send_queue.count()==0 && MaySendMessage()) {
+      // replies are not tracked, pass them to the udp queue right away
+      SendPacket(pkt,a);
+      return;
+   }
+   if(send_queue.count()>MAX_SEND_QUEUE) {
+      LogError(9,"tail dropping output message");
+      return;
+   }
+   send_queue.push(new Request(pkt,a));
+}
+int DHT::SendPacket(BeNode *q,const sockaddr_u& a)
+{
+   if(WillLog(4))
+      LogSend(4,xstring::format("sending DHT %s to %s %s",MessageType(q),
+	 a.to_string(),q->Format1()));
+   return Torrent::GetUDPSocket(af)->SendUDP(a,q->Pack());
+}
+int DHT::SendPacket(const xstring& pkt,const sockaddr_u& a)
+{
+   if(WillLog(4)) {
+      BeView v;
+      int rest;
+      if(v.Parse(pkt,pkt.length(),&rest)) {
+	 int y=v.Lookup(0,"y",BeNode::BE_STR);
+	 LogSend(4,xstring::format("sending DHT %s to %s %s",
+	    v.StrEq(y,"e")?"error":"response",a.to_string(),v.Format1()));
+      }
+   }
+   return Torrent::GetUDPSocket(af)->SendUDP(a,pkt);
+}
 void DHT::SendMessage(Request *req)
 {
+   if(!req->data) {
+      SendPacket(req->packet,req->addr);
+      delete req;
+      return;
+   }
    req->expire_timer.Reset();
    BeNode *q=req->data.get_non_const();
-   const sockaddr_u& a=req->addr;
-   LogSend(4,xstring::format("sending DHT %s to %s %s",MessageType(q),
-      a.to_string(),q->Format1()));
-   int res=-1;
-   res=Torrent::GetUDPSocket(af)->SendUDP(a,q->Pack());
+   int res=SendPacket(q,req->addr);
    if(res!=-1 && q->lookup_str("y").eq("q")) {
       sent_req.add(q->lookup_str("t"),req);
       rate_limit.BytesPut(res);
@@ -326,7 +371,7 @@ void DHT::DenouncePeer(const Torrent *t)
       }
    }
 }
-int DHT::AddNodesToReply(xmap_p<BeNode> &r,const xstring& target,int max_count)
+int DHT::AddNodesToReply(BeEncoder &r,const xstring& target,int max_count)
 {
    xarray<Node*> n;
    FindNodes(target,n,max_count,true);
@@ -335,10 +380,11 @@ int DHT::AddNodesToReply(xmap_p<BeNode> &r,const xstring& target,int max_count)
       compact_nodes.append(n[i]->id);
       compact_nodes.append(n[i]->addr.compact());
    }
-   r.add(af==AF_INET?"nodes":"nodes6",new BeNode(compact_nodes));
+   r.Key(af==AF_INET?"nodes":"nodes6");
+   r.Str(compact_nodes);
    return n.count();
 }
-int DHT::AddNodesToReply(xmap_p<BeNode> &r,const xstring& target,bool want_n4,bool want_n6)
+int DHT::AddNodesToReply(BeEncoder &r,const xstring& target,bool want_n4,bool want_n6)
 {
    int nodes_count=0;
    if(want_n4)
@@ -365,51 +411,61 @@ bool DHT::Node::TokenIsValid(const xstring& token) const
       return false;
    return token.eq(my_token) || token.eq(my_last_token);
 }
-void DHT::HandlePacket(BeNode *p,const sockaddr_u& src)
+void DHT::HandlePacket(const BeView& p,const sockaddr_u& src)
 {
-   LogRecv(4,xstring::format("received DHT %s from %s %s",MessageType(p),
-      src.to_string(),p->Format1()));
-   int pkt_len=p->str.length();
+   int y=p.Lookup(0,"y",BeNode::BE_STR);
+   const char *msg_type="message";
+   xstring query;  // not a tmp string, Format1 and to_string use them too
+   if(p.StrEq(y,"q")) {
+      int len;
+      const char *q=p.LookupStr(0,"q",&len);
+      if(q)
+	 msg_type=query.nset(q,len).get();
+   } else if(p.StrEq(y,"r"))
+      msg_type="response";
+   else if(p.StrEq(y,"e"))
+      msg_type="error";
+   if(WillLog(4))
+      LogRecv(4,xstring::format("received DHT %s from %s %s",msg_type,
+	 src.to_string(),p.Format1()));
+   int pkt_len=p[0].len;
    if(rate_limit.BytesAllowedToGet()<pkt_len) {
       LogError(9,"dropping incoming message (rate limit exceeded)");
       return;
    }
    rate_limit.BytesGot(pkt_len);
-   const xstring& t=p->lookup_str("t");
-   if(!t)
-      return;
-   const xstring& y=p->lookup_str("y");
-   if(!y)
+   xstring t;
+   p.LookupStr(0,"t",t);
+   if(!t || y<0)
       return;
-   if(y.eq("q")) {
-      const xstring& q=p->lookup_str("q");
-      if(!q)
+   if(p.StrEq(y,"q")) {
+      int q=p.Lookup(0,"q",BeNode::BE_STR);
+      if(q<0)
 	 return;
-      BeNode *a=p->lookup("a",BeNode::BE_DICT);
-      if(!a)
+      int a=p.Lookup(0,"a",BeNode::BE_DICT);
+      if(a<0)
 	 return;
-      const xstring& id=a->lookup_str("id");
+      xstring id;
+      p.LookupStr(a,"id",id);
       if(id.length()!=20)
 	 return;
       Node *node=FoundNode(id,src,false);
       if(!node)
 	 return;
 
-      xmap_p<BeNode> r;
-      if(src.family()==AF_INET)
-	 r.add("ip",new BeNode(src.compact_addr()));
+      xstring reply;
+      BeEncoder r(&reply);
+      BeginReply(r,src);
 
       bool want_n4=false;
       bool want_n6=false;
-      BeNode *want=a->lookup("want",BeNode::BE_LIST);
-      if(want) {
-	 for(int i=0; i<want->list.count(); i++) {
-	    BeNode *w=want->list[i];
-	    if(w->type!=BeNode::BE_STR)
-	       continue;
-	    if(w->str.eq("n4"))
+      int want=p.Lookup(a,"want",BeNode::BE_LIST);
+      if(want>=0) {
+	 int w=p.First(want);
+	 for(int i=0; i<p[want].count; i++, w=p.Next(w)) {
+	    if(p.StrEq(w,"n4"))
 	       want_n4=true;
-	    if(w->str.eq("n6"))
+	    if(p.StrEq(w,"n6"))
 	       want_n6=true;
 	 }
       }
@@ -418,76 +474,89 @@ void DHT::HandlePacket(BeNode *p,const sockaddr_u& src)
 	 want_n6=(src.family()==AF_INET6);
       }
 
-      if(q.eq("ping")) {
+      if(p.StrEq(q,"ping")) {
 	 LogSend(5,xstring::format("DHT ping reply to %s",src.to_string()));
-	 SendMessage(NewReply(t,r),src);
-      } else if(q.eq("find_node")) {
-	 const xstring& target=a->lookup_str("target");
+	 EndReply(r,t);
+	 SendReply(reply,src);
+      } else if(p.StrEq(q,"find_node")) {
+	 xstring target;
+	 p.LookupStr(a,"target",target);
 	 if(!target)
 	    return;
 	 int nodes_count=AddNodesToReply(r,target,want_n4,want_n6);
 	 LogSend(5,xstring::format("DHT find_node reply with %d nodes to %s",nodes_count,src.to_string()));
-	 SendMessage(NewReply(t,r),src);
-      } else if(q.eq("get_peers")) {
-	 const xstring& info_hash=a->lookup_str("info_hash");
+	 EndReply(r,t);
+	 SendReply(reply,src);
+      } else if(p.StrEq(q,"get_peers")) {
+	 xstring info_hash;
+	 p.LookupStr(a,"info_hash",info_hash);
 	 if(info_hash.length()!=20)
 	    return;
-	 bool noseed=a->lookup_int("noseed");
+	 bool noseed=p.LookupInt(a,"noseed");
 	 KnownTorrent *torrent=torrents.lookup(info_hash);
 	 int nodes_count=0;
-	 int values_count=0;
-	 if(!torrent || torrent->peers.count()==0) {
-	    nodes_count=AddNodesToReply(r,info_hash,want_n4,want_n6);
-	 } else {
-	    xarray_p<Peer>& p=torrent->peers;
-	    xarray_p<BeNode> values;
-	    for(int i=0; i<p.count() && values_count<K; i++) {
-	       Peer *peer=p[i];
+	 xarray<const Peer*> values;
+	 if(torrent) {
+	    const xarray<Peer>& peers=torrent->peers;
+	    // the most recently announced peers are at the end
+	    for(int i=peers.count()-1; i>=0 && values.count()<K; i--) {
+	       const Peer *peer=&peers[i];
 	       if(noseed && peer->seed)
 		  continue;
 	       if(!peer->IsGood())
-		  continue;
-	       if(peer->compact_addr.family()==AF_INET && !want_n4)
+		  break;
+	       if(peer->family()==AF_INET && !want_n4)
 		  continue;
 #if INET6
-	       if(peer->compact_addr.family()==AF_INET6 && !want_n6)
+	       if(peer->family()==AF_INET6 && !want_n6)
 		  continue;
 #endif
-	       values.append(new BeNode(peer->compact_addr));
-	       values_count++;
+	       values.append(peer);
 	    }
-	    if(values_count>0)
-	       r.add("values",new BeNode(&values));
-	    else
-	       nodes_count=AddNodesToReply(r,info_hash,want_n4,want_n6);
 	 }
-	 r.add("token",new BeNode(node->GetToken()));
+	 // the keys are written in sorted order: nodes, token, values.
+	 if(values.count()==0)
+	    nodes_count=AddNodesToReply(r,info_hash,want_n4,want_n6);
+	 r.Key("token");
+	 r.Str(node->GetToken());
+	 if(values.count()>0) {
+	    r.Key("values");
+	    r.List();
+	    for(int i=0; i<values.count(); i++)
+	       r.Str(values[i]->addr,values[i]->addr_len);
+	    r.End();
+	 }
 	 LogSend(5,xstring::format("DHT get_peers reply with %d values and %d nodes to %s",
-	    values_count,nodes_count,src.to_string()));
-	 SendMessage(NewReply(t,r),src);
-      } else if(q.eq("announce_peer")) {
+	    values.count(),nodes_count,src.to_string()));
+	 EndReply(r,t);
+	 SendReply(reply,src);
+      } else if(p.StrEq(q,"announce_peer")) {
 	 // need a valid token
-	 if(!node->TokenIsValid(a->lookup_str("token"))) {
-	    SendMessage(NewError(t,ERR_PROTOCOL,"invalid token"),src);
+	 xstring token;
+	 p.LookupStr(a,"token",token);
+	 if(!node->TokenIsValid(token)) {
+	    SendError(t,ERR_PROTOCOL,"invalid token",src);
 	    return;
 	 }
 	 // ok, token is valid. Now add the peer.
-	 const xstring& info_hash=a->lookup_str("info_hash");
+	 xstring info_hash;
+	 p.LookupStr(a,"info_hash",info_hash);
 	 if(info_hash.length()!=20)
 	    return;
-	 int port=a->lookup_int("port");
+	 int port=p.LookupInt(a,"port");
 	 if(!port)
 	    return;
-	 bool seed=a->lookup_int("seed");
+	 bool seed=p.LookupInt(a,"seed");
 	 sockaddr_u peer_addr(src);
 	 peer_addr.set_port(port);
 	 AddPeer(info_hash,peer_addr.compact(),seed);
-	 SendMessage(NewReply(t,r),src);
-      } else if(q.eq("vote")) {
+	 EndReply(r,t);
+	 SendReply(reply,src);
+      } else if(p.StrEq(q,"vote")) {
 #if 0
 	 // need a valid token
 	 if(!node->TokenIsValid(a->lookup_str("token"))) {
-	    SendMessage(NewError(t,ERR_PROTOCOL,"invalid token"),src);
+	    SendError(t,ERR_PROTOCOL,"invalid token",src);
 	    return;
 	 }
 	 // target is sha1(info_hash+"rating")
@@ -497,10 +566,11 @@ void DHT::HandlePacket(BeNode *p,const sockaddr_u& src)
          unsigned vote=a->lookup_int("vote");
 	 // store the vote
 	 // return what?
-	 SendMessage(NewReply(t,r),src);
+	 EndReply(r,t);
+	 SendReply(reply,src);
 #endif
       } else {
-	 SendMessage(NewError(t,ERR_UNKNOWN_METHOD,"method unknown"),src);
+	 SendError(t,ERR_UNKNOWN_METHOD,"method unknown",src);
       }
       return;
    }
@@ -517,14 +587,17 @@ void DHT::HandlePacket(BeNode *p,const sockaddr_u& src)
    }
    const xstring& q=req->data->lookup_str("q");
 
-   if(y.eq("r")) {
-      BeNode *r=p->lookup("r",BeNode::BE_DICT);
-      if(!r)
+   if(p.StrEq(y,"r")) {
+      int r=p.Lookup(0,"r",BeNode::BE_DICT);
+      if(r<0)
 	 return;
-      const xstring& id=r->lookup_str("id");
+      xstring id;
+      p.LookupStr(r,"id",id);
       if(id.length()!=20)
 	 return;
-      const sockaddr_compact& ip=sockaddr_compact::cast(r->lookup_str("ip"));
+      xstring ip_str;
+      p.LookupStr(r,"ip",ip_str);
+      const sockaddr_compact& ip=sockaddr_compact::cast(ip_str);
       if(ip && !ValidNodeId(node_id,ip)) {
 	 if(!ip_voted.lookup(src.compact_addr())) {
 	    sockaddr_u reported_ip(ip);
@@ -543,14 +616,16 @@ void DHT::HandlePacket(BeNode *p,const sockaddr_u& src)
       if(q.eq("get_peers")) {
 	 const xstring& info_hash=req->data->lookup("a")->lookup_str("info_hash");
 	 Torrent *torrent=Torrent::FindTorrent(info_hash);
-	 BeNode *values=r->lookup("values",BeNode::BE_LIST);
-	 if(values) {
+	 int values=p.Lookup(r,"values",BeNode::BE_LIST);
+	 if(values>=0) {
 	    // some peers found.
-	    for(int i=0; i<values->list.count(); i++) {
-	       if(values->list[i]->type!=BeNode::BE_STR)
+	    int v=p.First(values);
+	    for(int i=0; i<p[values].count; i++, v=p.Next(v)) {
+	       if(p.Type(v)!=BeNode::BE_STR)
+		  continue;
+	       sockaddr_u a;
+	       if(!a.set_compact(p[v].data,p[v].len))
 		  continue;
-	       const sockaddr_compact &c=sockaddr_compact::cast(values->list[i]->str);
-	       sockaddr_u a(c);
 	       if(!a.port())
 		  continue;
 	       LogNote(9,"found peer %s for info_hash=%s",a.to_string(),info_hash.hexdump());
@@ -558,7 +633,8 @@ void DHT::HandlePacket(BeNode *p,const sockaddr_u& src)
 		  torrent->AddPeer(new TorrentPeer(torrent,&a,TorrentPeer::TR_DHT));
 	    }
 	 }
-	 const xstring& token=r->lookup_str("token");
+	 xstring token;
+	 p.LookupStr(r,"token",token);
 	 if(token && torrent) {
 	    if(!ValidNodeId(id,src.compact_addr()))
 	       LogError(2,"warning: node id %s is invalid for %s",id.hexdump(),src.address());
@@ -578,11 +654,10 @@ void DHT::HandlePacket(BeNode *p,const sockaddr_u& src)
 	 }
       }
       if(q.eq("find_node") || q.eq("get_peers")) {
-	 const xstring& nodes=r->lookup_str("nodes");
-	 if(nodes) {
-	    LogNote(9,"adding %d nodes",(int)nodes.length()/26);
-	    const char *data=nodes;
-	    int len=nodes.length();
+	 int len;
+	 const char *data=p.LookupStr(r,"nodes",&len);
+	 if(data) {
+	    LogNote(9,"adding %d nodes",len/26);
 	    while(len>=26) {
 	       xstring id(data,20);
 	       sockaddr_u a;
@@ -593,11 +668,9 @@ void DHT::HandlePacket(BeNode *p,const sockaddr_u& src)
 	    }
 	 }
 #if INET6
-	 const xstring& nodes6=r->lookup_str("nodes6");
-	 if(nodes6) {
-	    LogNote(9,"adding %d nodes6",(int)nodes6.length()/38);
-	    const char *data=nodes6;
-	    int len=nodes6.length();
+	 data=p.LookupStr(r,"nodes6",&len);
+	 if(data) {
+	    LogNote(9,"adding %d nodes6",len/38);
 	    while(len>=38) {
 	       xstring id(data,20);
 	       sockaddr_u a;
@@ -609,15 +682,17 @@ void DHT::HandlePacket(BeNode *p,const sockaddr_u& src)
 	 }
 #endif //INET6
       }
-   } else if(y.eq("e")) {
+   } else if(p.StrEq(y,"e")) {
       int code=0;
       const char *msg="unknown";
-      BeNode *e=p->lookup("e",BeNode::BE_LIST);
-      if(e) {
-	 if(e->list.count()>=1 && e->list[0]->type==BeNode::BE_INT)
-	    code=e->list[0]->num;
-	 if(e->list.count()>=2 && e->list[1]->type==BeNode::BE_STR)
-	    msg=e->list[1]->str;
+      int e=p.Lookup(0,"e",BeNode::BE_LIST);
+      if(e>=0) {
+	 int e0=p.First(e);
+	 int e1=p.Next(e0);
+	 if(p[e].count>=1 && p.Type(e0)==BeNode::BE_INT)
+	    code=p[e0].num;
+	 if(p[e].count>=2 && p.Type(e1)==BeNode::BE_STR)
+	    msg=xstring::get_tmp(p[e1].data,p[e1].len);
       }
       LogError(2,"got DHT error for %s (%d: %s) from %s",q.get(),code,msg,src.to_string());
    }
@@ -750,16 +825,30 @@ void DHT::AddNode(Node *n)
    if(nodes.count()==1 && search.count()==0)
       Bootstrap();
 }
-int DHT::FindRoute(const xstring& id,int i)
+int DHT::FindRoute(const xstring& id)
 {
-   // routes are ordered by prefix length decreasing
-   // the first route bucket always matches our node_id
-   for( ; i<routes.count(); i++) {
-      if(routes[i]->PrefixMatch(id)) {
-	 return i;
+   if(routes.count()==0)
+      return -1;
+   // only the bucket with our node_id gets split, so the bucket index is
+   // determined by the length of the common prefix with node_id.
+   int bits=routes[0]->prefix_bits;
+   int common=0;
+   while(common<bits) {
+      unsigned char x=id[common/8]^node_id[common/8];
+      if(x==0) {
+	 common+=8-common%8;
+	 continue;
       }
+      x<<=common%8;
+      while(!(x&0x80)) {
+	 x<<=1;
+	 common++;
+      }
+      break;
    }
-   return -1;
+   if(common>=bits)
+      return 0;
+   return bits-common;
 }
 void DHT::RemoveRoute(Node *n)
 {
@@ -912,30 +1001,89 @@ const char *DHT::RouteBucket::to_string() const
    return buf;
 }
 
+// keeps max_count nodes closest to the target, the farthest one on the top
+class DHT::NodeHeap
+{
+   const xstring& target;
+   int max_count;
+   xarray<Node*>& heap;
+
+   bool Farther(int i,int j) const { return heap[j]->IsBetterThan(heap[i],target); }
+   void Swap(int i,int j) { Node *t=heap[i]; heap[i]=heap[j]; heap[j]=t; }
+   void SiftUp(int i) {
+      while(i>0 && Farther(i,(i-1)/2)) {
+	 Swap(i,(i-1)/2);
+	 i=(i-1)/2;
+      }
+   }
+   void SiftDown(int i,int count) {
+      for(;;) {
+	 int f=i;
+	 int c=2*i+1;
+	 if(c<count && Farther(c,f))
+	    f=c;
+	 if(c+1<count && Farther(c+1,f))
+	    f=c+1;
+	 if(f==i)
+	    return;
+	 Swap(i,f);
+	 i=f;
+      }
+   }
+
+public:
+   NodeHeap(const xstring& t,int m,xarray<Node*>& a) : target(t), max_count(m), heap(a) {}
+   bool Full() const { return heap.count()>=max_count; }
+   void Add(Node *n) {
+      if(!Full()) {
+	 heap.append(n);
+	 SiftUp(heap.count()-1);
+      } else if(n->IsBetterThan(heap[0],target)) {
+	 heap[0]=n;
+	 SiftDown(0,heap.count());
+      }
+   }
+   void Add(const xarray<Node*>& nodes,bool only_good) {
+      for(int j=0; j<nodes.count(); j++) {
+	 if(!nodes[j]->IsBad() && (!only_good || nodes[j]->IsGood()))
+	    Add(nodes[j]);
+      }
+   }
+   // sorts the nodes by distance, the closest first
+   void Sort() {
+      for(int n=heap.count()-1; n>0; n--) {
+	 Swap(0,n);
+	 SiftDown(0,n);
+      }
+   }
+};
 void DHT::FindNodes(const xstring& target_id,xarray<Node*> &a,int max_count,bool only_good)
 {
    a.truncate();
-   int i=0;
-   while(a.count()<max_count && i<routes.count()) {
-      i=FindRoute(target_id,i);
-      if(i==-1)
-	 return;
-      const xarray<Node*> &nodes=routes[i]->nodes;
-      int limit=max_count-a.count();
-      for(int j=0; j<nodes.count() && limit>0; j++) {
-	 if(!nodes[j]->IsBad() && (!only_good || nodes[j]->IsGood())) {
-	    a.append(nodes[j]);
-	    limit--;
-	 }
-      }
-      i++;
+   int b=FindRoute(target_id);
+   if(b==-1 || max_count<=0)
+      return;
+   NodeHeap heap(target_id,max_count,a);
+   // The buckets are visited in order of increasing distance class: the
+   // target's bucket, then the buckets with longer common prefix with
+   // node_id (they all differ from the target in the same bit), then the
+   // buckets with shorter common prefix, the nearest first.
+   heap.Add(routes[b]->nodes,only_good);
+   if(!heap.Full()) {
+      for(int i=0; i<b; i++)
+	 heap.Add(routes[i]->nodes,only_good);
    }
+   for(int i=b+1; i<routes.count() && !heap.Full(); i++)
+      heap.Add(routes[i]->nodes,only_good);
+   heap.Sort();
 }
 void DHT::AddPeer(const xstring& info_hash,const sockaddr_compact& a,bool seed)
 {
    KnownTorrent *t=torrents.lookup(info_hash);
    if(!t) {
-      if(torrents.count()>=MAX_TORRENTS) {
+      if(max_stored_torrents==0)
+	 return;
+      while(torrents.count()>=(int)max_stored_torrents) {
 	 // remove random torrent
 	 int r=random()/13%torrents.count();
 	 int i=0;
@@ -948,22 +1096,37 @@ void DHT::AddPeer(const xstring& info_hash,const sockaddr_compact& a,bool seed)
       }
       torrents.add(info_hash,t=new KnownTorrent());
    }
-   t->AddPeer(new Peer(a,seed));
+   t->AddPeer(a,seed);
 
    sockaddr_u addr(a);
    LogNote(9,"added peer %s to torrent %s",addr.to_string(),info_hash.hexdump());
 }
-void DHT::KnownTorrent::AddPeer(Peer *peer)
+void DHT::KnownTorrent::AddPeer(const sockaddr_compact& a,bool seed)
 {
+   if(a.length()>sizeof(Peer::addr))
+      return;
    for(int i=0; i<peers.count(); i++) {
-      if(peers[i]->compact_addr.eq(peer->compact_addr)) {
+      if(peers[i].AddrEq(a)) {
 	 peers.remove(i);
 	 break;
       }
    }
    if(peers.count()>=MAX_PEERS)
       peers.remove(0);
-   peers.append(peer);
+   Peer p;
+   p.last_seen=SMTask::now.UnixTime();
+   p.seed=seed;
+   p.addr_len=a.length();
+   memcpy(p.addr,a.get(),a.length());
+   peers.append(p);
+}
+void DHT::KnownTorrent::RemoveExpiredPeers()
+{
+   int i=0;
+   while(i<peers.count() && !peers[i].IsGood())
+      i++;
+   if(i>0)
+      peers.remove(0,i);
 }
 
 void DHT::MakeNodeId(xstring &id,const sockaddr_compact& ip,int r)
@@ -1101,4 +1264,5 @@ void DHT::Load()
 void DHT::Reconfig(const char *name)
 {
    rate_limit.Reconfig(name,"DHT");
+   max_stored_torrents=ResMgr::Query("dht:max-stored-torrents",0);
 }
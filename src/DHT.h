@@ -26,8 +26,8 @@ class DHT : public SMTask, protected ProtoLog, public ResClient
 {
    static const int K = 8;
    static const int MAX_NODES = 160*K;
-   static const int MAX_TORRENTS = 1024;
    static const int MAX_PEERS = 60; // per torrent
+   static const int PEER_EXPIRE = 15*60;
    static const int MAX_SEND_QUEUE = 256;
 
    class Node
@@ -93,6 +93,7 @@ class DHT : public SMTask, protected ProtoLog, public ResClient
    {
    public:
       Ref<BeNode> data;
+      xstring packet;	// an encoded reply, then data is null
       sockaddr_u addr;
       xstring node_id;
       Timer expire_timer;
@@ -101,6 +102,8 @@ class DHT : public SMTask, protected ProtoLog, public ResClient
 
       Request(BeNode *b,const sockaddr_u& a,const xstring& id)
 	 : data(b), addr(a), node_id(id.copy()), expire_timer(180) {}
+      Request(const xstring& p,const sockaddr_u& a)
+	 : packet(p.copy()), addr(a), expire_timer(180) {}
    };
    class Search
    {
@@ -125,21 +128,25 @@ class DHT : public SMTask, protected ProtoLog, public ResClient
    class Peer
    {
    public:
-      sockaddr_compact compact_addr;
-      Timer good_timer;
+      time_t last_seen;
       bool seed;
+      unsigned char addr_len;
+      char addr[18];	// compact address
 
-      Peer(const sockaddr_compact &a,bool s)
-	 : compact_addr(a), good_timer(15*60), seed(s) {}
-      bool IsGood() const { return !good_timer.Stopped(); }
+      bool IsGood() const { return SMTask::now.UnixTime()-last_seen<PEER_EXPIRE; }
+      int family() const { return addr_len==6?AF_INET:AF_INET6; }
+      bool AddrEq(const sockaddr_compact& a) const {
+	 return a.length()==addr_len && !memcmp(addr,a.get(),addr_len);
+      }
    };
    class KnownTorrent
    {
    public:
-      xarray_p<Peer> peers;
-      void AddPeer(Peer *);
+      xarray<Peer> peers; // ordered by last_seen
+      void AddPeer(const sockaddr_compact& a,bool seed);
+      void RemoveExpiredPeers();
    };
-
+   class NodeHeap;
    int af;
 
    RateLimit rate_limit;
@@ -158,9 +165,13 @@ class DHT : public SMTask, protected ProtoLog, public ResClient
    xstring node_id;
    xmap_p<Node> nodes;
    xmap<Node*> node_by_addr;
+   // routes[0] holds our own node_id, then the buckets follow in order of
+   // decreasing prefix length: routes[i] has the ids sharing exactly
+   // routes[0]->prefix_bits-i leading bits with node_id.
    RefArray<RouteBucket> routes;
    RefArray<Search> search;
    xmap_p<KnownTorrent> torrents;
+   unsigned max_stored_torrents;
 
    xqueue_p<xstring> bootstrap_nodes;
    SMTaskRef<Resolver> resolver;
@@ -171,7 +182,7 @@ class DHT : public SMTask, protected ProtoLog, public ResClient
    void AddRoute(Node *);
    void RemoveRoute(Node *n);
    Node *FoundNode(const xstring& id,const sockaddr_u& a,bool responded);
-   int FindRoute(const xstring& i,int start=0);
+   int FindRoute(const xstring& i);
    void FindNodes(const xstring& i,xarray<Node*> &a,int max_count,bool only_good);
    void StartSearch(Search *s);
    void AddPeer(const xstring& ih,const sockaddr_compact& ca,bool seed);
@@ -179,14 +190,21 @@ class DHT : public SMTask, protected ProtoLog, public ResClient
    unsigned t; // transaction id
 
    BeNode *NewQuery(const char *q,xmap_p<BeNode>& a);
-   BeNode *NewReply(const xstring& t0,xmap_p<BeNode>& r);
-   BeNode *NewError(const xstring& t0,int code,const char *msg);
    void SendMessage(BeNode *q,const sockaddr_u& a,const xstring& id=xstring::null);
    void SendMessage(Request *);
+   int SendPacket(BeNode *q,const sockaddr_u& a);
    bool MaySendMessage();
    static const char *MessageType(BeNode *q);
-   static int AddNodesToReply(xmap_p<BeNode> &r,const xstring& target,bool want_n4,bool want_n6);
-   int AddNodesToReply(xmap_p<BeNode> &r,const xstring& target,int max_count);
+
+   // replies are encoded straight into the packet, the caller adds the
+   // keys of "r" dictionary after "ip" in sorted order.
+   void BeginReply(BeEncoder& r,const sockaddr_u& a);
+   void EndReply(BeEncoder& r,const xstring& t0);
+   void SendError(const xstring& t0,int code,const char *msg,const sockaddr_u& a);
+   void SendReply(const xstring& pkt,const sockaddr_u& a);
+   int SendPacket(const xstring& pkt,const sockaddr_u& a);
+   static int AddNodesToReply(BeEncoder &r,const xstring& target,bool want_n4,bool want_n6);
+   int AddNodesToReply(BeEncoder &r,const xstring& target,int max_count);
 
    enum {
       ERR_GENERIC=201,
@@ -215,7 +233,7 @@ public:
    int PingQuestionable(const xarray<Node*>& nodes,int limit);
    void AnnouncePeer(const Torrent *);
    void DenouncePeer(const Torrent *);
-   void HandlePacket(BeNode *b,const sockaddr_u& src);
+   void HandlePacket(const BeView& p,const sockaddr_u& src);
 
    void Save(const SMTaskRef<IOBuffer>& buf);
    void Load(const SMTaskRef<IOBuffer>& buf);
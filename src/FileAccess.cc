@@ -72,6 +72,7 @@ void FileAccess::Init()
 
    entity_size=NO_SIZE;
    entity_date=NO_DATE;
+   entity_digest_algo=Checksum::NONE;
 
    res_prefix=0;
 
@@ -200,6 +201,8 @@ void FileAccess::Close()
    location.set(0);
    entity_content_type.set(0);
    entity_charset.set(0);
+   entity_digest_algo=Checksum::NONE;
+   entity_digest.unset();
    ClearError();
 }
 
@@ -599,6 +602,15 @@ void FileAccess::SetSuggestedFileName(const char *fn)
    suggested_filename.set(fn);
 }
 
+void FileAccess::SetEntityDigest(Checksum::algo_t a,const xstring& d)
+{
+   // keep the strongest one of those offered.
+   if(a<=entity_digest_algo || (int)d.length()!=Checksum::DigestSize(a))
+      return;
+   entity_digest_algo=a;
+   entity_digest.set(d);
+}
+
 void FileAccess::SetFileURL(const char *u)
 {
    file_url.set(u);
@@ -606,7 +618,67 @@ void FileAccess::SetFileURL(const char *u)
       new_cwd->SetURL(u);
 }
 
-FileAccess *SessionPool::pool[pool_size];
+// Drives pre-warmed sessions until they are logged in, then moves
+// them to the session pool.
+class SessionWarmer : public SMTask
+{
+   xarray<FileAccess*> sessions;
+public:
+   ~SessionWarmer() {
+      for(int i=0; i<sessions.count(); i++)
+	 SMTask::Delete(sessions[i]);
+   }
+   void Add(FileAccess *s) { sessions.append(s); }
+   int Do();
+};
+
+int SessionWarmer::Do()
+{
+   int m=STALL;
+   for(int i=0; i<sessions.count(); i++)
+   {
+      FileAccess *s=sessions[i];
+      int res=s->Done();
+      if(res==FA::IN_PROGRESS)
+	 continue;
+      sessions.remove(i--);
+      if(res==FA::OK)
+	 SessionPool::Reuse(s);
+      else
+	 SMTask::Delete(s);
+      m=MOVED;
+   }
+   return m;
+}
+
+xmap_p< xarray<FileAccess*> > SessionPool::by_key;
+xarray<FileAccess*> SessionPool::lru;
+SMTaskRef<SessionWarmer> SessionPool::warmer;
+
+const xstring& SessionPool::MakeKey(const FileAccess *f)
+{
+   const char *user=f->GetUser();
+   const char *port=f->GetPort();
+   return xstring::format("%s://%s@%s:%s",f->GetProto(),
+      user?user:"",f->GetHostName(),port?port:"");
+}
+
+FileAccess *SessionPool::Take(int i)
+{
+   FileAccess *f=lru[i];
+   lru.remove(i);
+   const xstring& key=MakeKey(f);
+   xarray<FileAccess*> *bucket=by_key.lookup(key);
+   if(bucket)
+   {
+      int j=bucket->search(f);
+      if(j>=0)
+	 bucket->remove(j);
+      if(bucket->count()==0)
+	 by_key.remove(key);
+   }
+   return f;
+}
 
 void SessionPool::Reuse(FileAccess *f)
 {
@@ -619,81 +691,86 @@ void SessionPool::Reuse(FileAccess *f)
    }
    f->Close();
    f->SetPriority(0);
-   int i;
-   for(i=0; i<pool_size; i++)
+   assert(lru.search(f)==-1);
+
+   xstring key;
+   key.set(MakeKey(f));
+   xarray<FileAccess*> *bucket=by_key.lookup(key);
+   if(!bucket)
    {
-      assert(pool[i]!=f);
-      if(pool[i]==0)
-      {
-	 pool[i]=f;
-	 return;
-      }
+      bucket=new xarray<FileAccess*>;
+      by_key.add(key,bucket);
    }
-   for(i=0; i<pool_size; i++)
+   bucket->append(f);
+   lru.append(f);
+
+   int host_max=ResMgr::Query("net:session-pool-max-per-host",f->GetHostName());
+   for(int excess=bucket->count()-host_max; excess>0; excess--)
+      Evict(lru.search((*by_key.lookup(key))[0]));
+
+   int max=ResMgr::Query("net:session-pool-max",0);
+   while(lru.count()>max)
+      Evict(0);
+}
+
+void SessionPool::Prewarm(const FileAccess *like,int n)
+{
+   if(!like->GetHostName())
+      return;
+   int host_max=ResMgr::Query("net:session-pool-max-per-host",like->GetHostName());
+   if(n>host_max)
+      n=host_max;
+   if(n<=0)
+      return;
+   if(!warmer)
+      warmer=new SessionWarmer();
+   while(n-->0)
    {
-      if(f->IsBetterThan(pool[i]))
-      {
-	 SMTask::Delete(pool[i]);
-	 pool[i]=f;
-	 return;
-      }
+      FileAccess *s=like->Clone();
+      s->SetPriority(0);
+      s->PathVerify(like->GetCwd());
+      warmer->Add(s);
    }
-   SMTask::Delete(f);
 }
 
 void SessionPool::Print(FILE *f)
 {
-   int arr[pool_size];
-   int n=0;
+   xarray<int> arr;
    int i;
 
-   for(i=0; i<pool_size; i++)
+   for(i=0; i<lru.count(); i++)
    {
-      if(pool[i]==0)
-	 continue;
       int j;
-      for(j=0; j<n; j++)
-	 if(pool[arr[j]]->SameLocationAs(pool[i]))
+      for(j=0; j<arr.count(); j++)
+	 if(lru[arr[j]]->SameLocationAs(lru[i]))
 	    break;
-      if(j==n)
-	 arr[n++]=i;
+      if(j==arr.count())
+	 arr.append(i);
    }
 
-   // sort?
-
-   for(i=0; i<n; i++)
-      fprintf(f,"%d\t%s\n",arr[i],pool[arr[i]]->GetConnectURL());
+   for(i=0; i<arr.count(); i++)
+      fprintf(f,"%d\t%s\n",arr[i],lru[arr[i]]->GetConnectURL());
 }
 
 FileAccess *SessionPool::GetSession(int n)
 {
-   if(n<0 || n>=pool_size)
+   if(n<0 || n>=lru.count())
       return 0;
-   FileAccess *s=pool[n];
-   pool[n]=0;
-   return s;
+   return Take(n);
 }
 
-FileAccess *SessionPool::Walk(int *n,const char *proto)
+const xarray<FileAccess*> *SessionPool::Lookup(const FileAccess *f)
 {
-   for( ; *n<pool_size; (*n)++)
-   {
-      if(pool[*n] && !strcmp(pool[*n]->GetProto(),proto))
-	 return pool[*n];
-   }
-   return 0;
+   if(!f->GetHostName())
+      return 0;
+   return by_key.lookup(MakeKey(f));
 }
 
 void SessionPool::ClearAll()
 {
-   for(int n=0; n<pool_size; n++)
-   {
-      if(pool[n])
-      {
-	 SMTask::Delete(pool[n]);
-	 pool[n]=0;
-      }
-   }
+   warmer=0;
+   while(lru.count()>0)
+      Evict(lru.count()-1);
 }
 
 bool FileAccess::NotSerious(int e)
@@ -776,6 +853,29 @@ FileAccess *FileAccess::NextSameSite(FA *scan) const
    return 0;
 }
 
+FileAccess *FileAccess::NextSameSite(FA *scan,int *n) const
+{
+   const xarray<FA*> *idle=SessionPool::Lookup(this);
+   if(*n>=0)
+   {
+      // most recently pooled sessions first
+      while(idle && *n<idle->count())
+      {
+	 FA *o=(*idle)[idle->count()-1-(*n)++];
+	 if(o!=this && SameSiteAs(o))
+	    return o;
+      }
+      *n=-1;
+      scan=0;
+   }
+   while((scan=NextSameSite(scan))!=0)
+   {
+      if(!idle || idle->search(scan)==-1)
+	 return scan;
+   }
+   return 0;
+}
+
 FileAccess *FileAccess::New(const char *proto,const char *host,const char *port)
 {
    ClassInit();
@@ -901,6 +1001,7 @@ ListInfo::ListInfo(FileAccess *s,const char *p)
    need=0;
 
    follow_symlinks=false;
+   recursive=false;
 
    if(session && p)
    {
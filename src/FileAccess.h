@@ -30,6 +30,8 @@
 #include "FileSet.h"
 #include "ArgV.h"
 #include "ProtoLog.h"
+#include "xmap.h"
+#include "Checksum.h"
 
 #define FILE_END     ((off_t)-1L)
 #define UNKNOWN_POS  ((off_t)-1L)
@@ -169,10 +171,19 @@ protected:
    xstring_c entity_content_type;
    xstring_c entity_charset;
 
+   // digest of the file being retrieved, as announced by the server.
+   Checksum::algo_t entity_digest_algo;
+   xstring entity_digest;
+   void SetEntityDigest(Checksum::algo_t a,const xstring& d);
+
    FileAccess *next;
    static FileAccess *chain;
    FileAccess *FirstSameSite() const { return NextSameSite(0); }
    FileAccess *NextSameSite(FileAccess *) const;
+   // same as above, but idle sessions are found in the session pool
+   // first; start with *n==0.
+   FileAccess *FirstSameSite(int *n) const { *n=0; return NextSameSite(0,n); }
+   FileAccess *NextSameSite(FileAccess *,int *n) const;
 
    StringSet *MkdirMakeSet() const; // splits the path for mkdir -p
 
@@ -303,6 +314,8 @@ public:
    const char *GetSuggestedFileName() { return suggested_filename; }
    const char *GetEntityContentType() { return entity_content_type; }
    const char *GetEntityCharset() { return entity_charset; }
+   Checksum::algo_t GetEntityDigestAlgo() { return entity_digest_algo; }
+   const xstring& GetEntityDigest() { return entity_digest; }
 
    void Reconfig(const char *);
 
@@ -358,19 +371,29 @@ public:
 // shortcut
 #define FA FileAccess
 
-// cache of used sessions
+class SessionWarmer;
+
+// cache of idle sessions, keyed by protocol, host, port and user.
+// Least recently used sessions are dropped first when the per-host
+// or the global limit is exceeded.
 class SessionPool
 {
-   enum { pool_size=64 };
-   static FileAccess *pool[pool_size];
+   static xmap_p< xarray<FileAccess*> > by_key; // oldest first
+   static xarray<FileAccess*> lru;		 // least recently used first
+   static SMTaskRef<SessionWarmer> warmer;
+
+   static const xstring& MakeKey(const FileAccess *);
+   static FileAccess *Take(int i);
+   static void Evict(int i) { SMTask::Delete(Take(i)); }
 
 public:
    static void Reuse(FileAccess *);
+   // open up to n logged in sessions like the given one ahead of time
+   static void Prewarm(const FileAccess *,int n);
    static void Print(FILE *f);
    static FileAccess *GetSession(int n);
-
-   // start with n==0, then increase n; returns 0 when no more
-   static FileAccess *Walk(int *n,const char *proto);
+   // idle sessions to the same site as the given one, oldest first
+   static const xarray<FileAccess*> *Lookup(const FileAccess *);
 
    static void ClearAll();
 };
@@ -462,6 +485,7 @@ protected:
 
    unsigned need;
    bool follow_symlinks;
+   bool recursive;   // subdirectories will be listed too
 
    void PrepareToDie();
 
@@ -477,6 +501,7 @@ public:
    void Need(unsigned mask) { need|=mask; }
    void NoNeed(unsigned mask) { need&=~mask; }
    void FollowSymlinks() { follow_symlinks=true; }
+   void Recursive() { recursive=true; }
 };
 
 #include "buffer.h"
@@ -53,6 +53,13 @@ ResDecl rate_period  ("xfer:rate-period","15", ResMgr::UNumberValidate,ResMgr::N
 ResDecl eta_period   ("xfer:eta-period", "120",ResMgr::UNumberValidate,ResMgr::NoClosure);
 ResDecl max_redir    ("xfer:max-redirections", "5",ResMgr::UNumberValidate,ResMgr::NoClosure);
 ResDecl buffer_size  ("xfer:buffer-size","0x10000",ResMgr::UNumberValidate,ResMgr::NoClosure);
+ResDecl write_block_size("xfer:write-block-size","0",ResMgr::UNumberValidate,ResMgr::NoClosure);
+ResDecl preallocate  ("xfer:preallocate","yes",ResMgr::BoolValidate,ResMgr::NoClosure);
+ResDecl sync_size    ("xfer:sync-size","0",ResMgr::UNumberValidate,ResMgr::NoClosure);
+ResDecl direct_io_min("xfer:direct-io-min-size","0",ResMgr::UNumberValidate,ResMgr::NoClosure);
+
+// O_DIRECT wants buffers, offsets and lengths aligned to the device block.
+#define DIRECT_ALIGN 4096
 
 // FileCopy
 #define super SMTask
@@ -241,6 +248,7 @@ int FileCopy::Do()
 		  skip=s;
 	       if(skip==0)
 		  return m;
+	       ChecksumData(b,skip);
 	       get->Skip(skip);
 	       bytes_count+=skip;
 	       return MOVED;
@@ -251,7 +259,7 @@ int FileCopy::Do()
 	    return MOVED;
 	 }
       }
-      if(put->Size()>max_buf)
+      if(put->Size()>max_buf && put->Size()>=put->GetWriteBlock())
 	 get->Suspend(); // stall the get.
       get->Get(&b,&s);
       if(b==0) // eof
@@ -292,6 +300,7 @@ int FileCopy::Do()
 	    line_buffer->Skip(ls);
 	 }
 	 line_buffer->Put(b,s);
+	 ChecksumData(b,s);
 	 get->Skip(s);
 	 bytes_count+=s;
 
@@ -311,6 +320,7 @@ int FileCopy::Do()
       else
       {
 	 put->Put(b,s);
+	 ChecksumData(b,s);
 	 get->Skip(s);
 	 bytes_count+=s;
       }
@@ -318,6 +328,8 @@ int FileCopy::Do()
       put_buf=put->Buffered();
       rate_add-=put_buf-s;
       RateAdd(rate_add);
+      get->Charge();
+      put->Charge();
 
       if(get->range_limit!=FILE_END && get->range_limit<=get->GetRealPos())
       {
@@ -335,6 +347,8 @@ int FileCopy::Do()
 	 line_buffer->Skip(s);
       }
    pre_CONFIRM_WAIT:
+      if(!ChecksumEof())
+	 return MOVED;
       put->SetSuggestedFileName(get->GetSuggestedFileName());
       put->SetDate(get->GetDate());
       if(get->GetSize()!=NO_SIZE && get->GetSize()!=NO_SIZE_YET)
@@ -388,6 +402,7 @@ int FileCopy::Do()
       set_state(ALL_DONE);
       get->Suspend();
       LogTransfer();
+      LogChecksum();
       return MOVED;
 
    pre_GET_INFO_WAIT:
@@ -423,6 +438,7 @@ FileCopy::FileCopy(FileCopyPeer *s,FileCopyPeer *d,bool c)
    remove_source_later=false;
    remove_target_first=false;
    line_buffer_max=0;
+   checksum_pos=0;
 }
 FileCopy::~FileCopy()
 {
@@ -649,6 +665,104 @@ void FileCopy::LogTransfer()
       Speedometer::GetStr(GetBytesCount()/GetTimeSpent()).get());
 }
 
+// The data is hashed in order as it passes from get to put; a gap (as
+// after a seek forward) makes the checksum unusable.
+void FileCopy::ChecksumData(const char *b,int s)
+{
+   if(checksum_pos<0 || s<=0)
+      return;
+   off_t p=get->GetRealPos();
+   if(!checksum)
+   {
+      Checksum::algo_t a=Checksum::NONE;
+      if(ResMgr::QueryBool("xfer:verify-checksum",0))
+	 a=get->GetDigestAlgo();
+      const char *manifest=ResMgr::Query("xfer:checksum-manifest",0);
+      if(a==Checksum::NONE && manifest && *manifest)
+	 a=Checksum::Find(ResMgr::Query("xfer:checksum-type",0));
+      if(p>0 || a==Checksum::NONE)
+      {
+	 checksum_pos=-1;
+	 return;
+      }
+      checksum=new Checksum(a);
+   }
+   if(p>checksum_pos)
+   {
+      debug((10,"copy: checksum dropped at %lld\n",(long long)checksum_pos));
+      checksum=0;
+      checksum_pos=-1;
+      return;
+   }
+   off_t skip=checksum_pos-p;
+   if(skip<s)
+   {
+      checksum->Update(b+skip,s-skip);
+      checksum_pos+=s-skip;
+   }
+}
+
+// Returns false if the data does not match the source's digest.
+bool FileCopy::ChecksumEof()
+{
+   if(!checksum)
+      return true;
+   off_t size=get->GetSize();
+   if(checksum_pos!=get->GetRealPos() || (size>=0 && checksum_pos!=size))
+   {
+      checksum=0;
+      return true;
+   }
+   const xstring& d=checksum->Finish();
+   if(get->GetDigestAlgo()!=checksum->GetAlgo())
+      return true;
+   if(!d.eq(get->GetDigest()))
+   {
+      const char *src=get->GetURL();
+      if(src)
+	 SetError(xstring::format(_("%s: %s checksum mismatch"),
+	    url::remove_password(src),checksum->GetName()));
+      else
+	 SetError(xstring::format(_("%s checksum mismatch"),checksum->GetName()));
+      return false;
+   }
+   debug((9,"copy: %s checksum matches\n",checksum->GetName()));
+   put->DontVerify();	// no need to run xfer:verify-command.
+   return true;
+}
+
+SMTaskRef<Log> FileCopy::checksum_log;
+
+// Appends "ALGO (file) = hex" line to xfer:checksum-manifest; the format
+// is understood by `sha256sum -c' and the like.
+void FileCopy::LogChecksum()
+{
+   if(!checksum || checksum->GetDigest().length()==0)
+      return;
+   const char *fname=ResMgr::Query("xfer:checksum-manifest",0);
+   if(!fname || !*fname)
+      return;
+   const char *dst=put->GetURL();
+   if(!dst)
+      return;
+   if(!checksum_log)
+   {
+      int fd=open(fname,O_WRONLY|O_APPEND|O_CREAT,0644);
+      if(fd==-1)
+	 return;
+      checksum_log=new Log;
+      checksum_log->SetOutput(fd,true);
+      checksum_log->ShowNothing();
+      checksum_log->Enable();
+   }
+   const xstring& d=checksum->GetDigest();
+   xstring& hex=xstring::get_tmp("");
+   for(size_t i=0; i<d.length(); i++)
+      hex.appendf("%02x",(unsigned char)d[i]);
+   checksum_log->Format(0,"%s (%s) = %s\n",checksum->GetName(),
+      url::remove_password(dst),hex.get());
+}
+
 void FileCopy::SetRange(off_t s,off_t lim)
 {
    get->SetRange(s,lim);
@@ -742,6 +856,7 @@ FileCopyPeer::FileCopyPeer(dir_t m) : IOBuffer(m)
    write_allowed=true;
    done=false;
    auto_rename=false;
+   digest_algo=Checksum::NONE;
    Suspend();  // don't do anything too early
 }
 
@@ -886,11 +1001,15 @@ int FileCopyPeerFA::Do()
 	 return m;
       if(fxp)
 	 return m;
-      res=Get_LL(GET_BUFSIZE);
+      res=ReadAllowance(GET_BUFSIZE);
+      if(res==0)
+	 return m;
+      res=Get_LL(res);
       if(res>0)
       {
 	 EmbraceNewData(res);
 	 SaveMaxCheck(0);
+	 Charge();
 	 return MOVED;
       }
       if(res<0)
@@ -1134,6 +1253,7 @@ int FileCopyPeerFA::Get_LL(int len)
       SetError(session->StrError(res));
       return -1;
    }
+   SetDigest(session->GetEntityDigestAlgo(),session->GetEntityDigest());
    if(res==0)
    {
       eof=true;
@@ -1305,6 +1425,13 @@ void FileCopyPeerFDStream::Init()
    seek_base=0;
    create_fg_data=true;
    need_seek=false;
+   local_checked=false;
+   local_file=false;
+   write_block=0;
+   sync_bytes=0;
+   unsynced=0;
+   direct=false;
+   direct_on=false;
    can_seek = can_seek0 = stream->can_seek();
    if(can_seek && stream->fd!=-1)
    {
@@ -1434,6 +1561,11 @@ int FileCopyPeerFDStream::Do()
 	 if(eof)
 	 {
 	    getfd(); // give it a chance to create empty file. (FIXME - handle tmp errors)
+	    if(local_file && sync_bytes>0 && stream->fd!=-1)
+	    {
+	       SyncData(stream->fd,true);
+	       sync_bytes=0;
+	    }
 	    if(!date_set && date!=NO_DATE && do_set_date)
 	    {
 	       if(date==NO_DATE_YET)
@@ -1480,11 +1612,15 @@ int FileCopyPeerFDStream::Do()
 	 return m;
       while(Size()<GET_BUFSIZE)
       {
-	 int res=Get_LL(GET_BUFSIZE);
+	 int res=ReadAllowance(GET_BUFSIZE);
+	 if(res==0)
+	    break;
+	 res=Get_LL(res);
 	 if(res>0)
 	 {
 	    EmbraceNewData(res);
 	    SaveMaxCheck(0);
+	    Charge();
 	    m=MOVED;
 	 }
 	 if(res<0)
@@ -1626,6 +1762,19 @@ int FileCopyPeerFDStream::Put_LL(const char *buf,int len)
    if(fd==-1)
       return 0;
 
+   if(!local_checked)
+      SetupLocalFile(fd);
+   if(write_block>0 && !eof && put_ll_timer && !put_ll_timer->Stopped())
+   {
+      // write up to the next block boundary, so that the following
+      // writes are whole aligned blocks; keep smaller pieces buffered.
+      off_t at=seek_base+pos-Size();
+      int to_boundary=write_block-at%write_block;
+      if(len<to_boundary)
+	 return 0;
+      len=to_boundary;
+   }
+
    int skip_cr=0;
 
 #ifndef NATIVE_CRLF
@@ -1659,10 +1808,7 @@ int FileCopyPeerFDStream::Put_LL(const char *buf,int len)
    if(len==0)
       return skip_cr;
 
-   if(need_seek)  // this does not combine with ascii.
-      lseek(fd,seek_base+pos-Size(),SEEK_SET);
-
-   int res=write(fd,buf,len);
+   int res=WriteData(fd,buf,len);
    if(res<0)
    {
       if(E_RETRY(errno))
@@ -1705,6 +1851,12 @@ int FileCopyPeerFDStream::Put_LL(const char *buf,int len)
       return -1;
    }
    stream->clear_status();
+   if(sync_bytes>0)
+   {
+      unsynced+=res;
+      if(unsynced>=sync_bytes)
+	 SyncData(fd,false);
+   }
    if(res==len && skip_cr)
    {
       res+=skip_cr;
@@ -1717,6 +1869,102 @@ int FileCopyPeerFDStream::Put_LL(const char *buf,int len)
       put_ll_timer->Reset();
    return res;
 }
+/* Regular files being written get their space reserved beforehand and may
+ * be written in large aligned blocks, which keeps them from fragmenting when
+ * many transfers write at once. */
+void FileCopyPeerFDStream::SetupLocalFile(int fd)
+{
+   local_checked=true;
+   struct stat st;
+   if(ascii || fstat(fd,&st)==-1 || !S_ISREG(st.st_mode))
+      return;
+   local_file=true;
+   write_block=write_block_size.Query(0).to_unumber(0x40000000);
+#ifdef HAVE_SYNC_FILE_RANGE
+   sync_bytes=sync_size.Query(0);
+#else
+   // periodic fdatasync would block; without sync_file_range do nothing.
+   sync_bytes=0;
+#endif
+   if(need_seek)
+      return;  // the fd is shared; whoever opened it has done the rest.
+
+   if(e_size>seek_base && e_size>st.st_size && preallocate.QueryBool(0))
+   {
+#if defined(HAVE_FALLOCATE) && defined(FALLOC_FL_KEEP_SIZE)
+      // keep the size, so that an interrupted file can be continued.
+      if(fallocate(fd,FALLOC_FL_KEEP_SIZE,seek_base,e_size-seek_base)==-1)
+	 debug((10,"copy: fallocate(%s): %s\n",stream->name.get(),strerror(errno)));
+#endif
+   }
+
+#ifdef O_DIRECT
+   off_t direct_min=direct_io_min.Query(0);
+   if(direct_min>0 && e_size>=direct_min && my_stream
+   && write_block>0 && write_block%DIRECT_ALIGN==0)
+      direct=true;
+#endif
+}
+
+/* write at our position, with O_DIRECT when the block allows it */
+int FileCopyPeerFDStream::WriteData(int fd,const char *buf,int len)
+{
+   off_t at=seek_base+pos-Size();
+#ifdef O_DIRECT
+   bool use_direct=(direct && at%DIRECT_ALIGN==0 && len%DIRECT_ALIGN==0);
+   if(use_direct!=direct_on)
+   {
+      int fl=fcntl(fd,F_GETFL);
+      if(fl==-1 || fcntl(fd,F_SETFL,use_direct?fl|O_DIRECT:fl&~O_DIRECT)==-1)
+      {
+	 debug((10,"copy: cannot %s O_DIRECT on %s: %s\n",use_direct?"set":"clear",
+	    stream->name.get(),strerror(errno)));
+	 direct=use_direct=false;
+      }
+      else
+	 direct_on=use_direct;
+   }
+   if(use_direct)
+   {
+      if(len>write_block)
+	 len=write_block;
+      if(!direct_buf)
+	 direct_buf.get_space(write_block+DIRECT_ALIGN);
+      char *abuf=direct_buf.get_non_const();
+      abuf+=(DIRECT_ALIGN-(uintptr_t)abuf%DIRECT_ALIGN)%DIRECT_ALIGN;
+      memcpy(abuf,buf,len);
+      int res=write(fd,abuf,len);
+      if(res!=-1 || errno!=EINVAL)
+	 return res;
+      // the file system would not do it after all.
+      debug((10,"copy: O_DIRECT write to %s: %s\n",stream->name.get(),strerror(errno)));
+      int fl=fcntl(fd,F_GETFL);
+      if(fl!=-1)
+	 fcntl(fd,F_SETFL,fl&~O_DIRECT);
+      direct=direct_on=false;
+   }
+#endif
+   if(need_seek)  // this does not combine with ascii.
+      return pwrite(fd,buf,len,at);
+   return write(fd,buf,len);
+}
+
+/* start write-back of the data written so far, or wait for all of it */
+void FileCopyPeerFDStream::SyncData(int fd,bool all)
+{
+   unsynced=0;
+#ifdef HAVE_SYNC_FILE_RANGE
+   if(!all)
+   {
+      sync_file_range(fd,0,0,SYNC_FILE_RANGE_WRITE);
+      return;
+   }
+#endif
+   // sync_bytes is 0 without sync_file_range, so we get here only at the end.
+   if(fdatasync(fd)==-1)
+      debug((10,"copy: fdatasync(%s): %s\n",stream->name.get(),strerror(errno)));
+}
+
 FgData *FileCopyPeerFDStream::GetFgData(bool fg)
 {
    if(!my_stream || !create_fg_data)
@@ -65,6 +65,10 @@ protected:
    xstring_c suggested_filename;
    bool auto_rename;
 
+   // digest of the whole file announced by the source.
+   Checksum::algo_t digest_algo;
+   xstring digest;
+
 public:
    off_t range_start; // NOTE: ranges are implemented only partially. (FIXME)
    off_t range_limit;
@@ -77,6 +81,8 @@ public:
    virtual off_t GetRealPos() { return pos; }
    virtual int Buffered() { return Size(); }
    virtual bool IOReady() { return true; }
+   // how much data the peer gathers before writing it out.
+   virtual int GetWriteBlock() { return 0; }
 
    virtual void WantDate() { want_date=true; date=NO_DATE_YET; }
    virtual void WantSize() { want_size=true; size=NO_SIZE_YET; }
@@ -119,6 +125,7 @@ public:
 
    // for fxp:
    virtual const FileAccessRef& GetSession() { return FileAccessRef::null; }
+   virtual const char *GetFile() { return 0; }
    virtual void OpenSession() {}
    virtual void SetFXP(bool) {}
 
@@ -146,6 +153,17 @@ public:
 	    suggested_filename.set(f);
       }
    void AutoRename(bool yes=true) { auto_rename=yes; }
+
+   Checksum::algo_t GetDigestAlgo() { return digest_algo; }
+   const xstring& GetDigest() { return digest; }
+   void SetDigest(Checksum::algo_t a,const xstring& d)
+      {
+	 if(a>digest_algo)
+	 {
+	    digest_algo=a;
+	    digest.set(d);
+	 }
+      }
 };
 
 class FileCopy : public SMTask
@@ -188,6 +206,14 @@ private:
    Ref<Buffer> line_buffer;
    int  line_buffer_max;
 
+   // digest computed over the data as it is copied.
+   Ref<Checksum> checksum;
+   off_t checksum_pos;	// how much is hashed, -1 if not computed.
+   void ChecksumData(const char *b,int s);
+   bool ChecksumEof();
+   void LogChecksum();
+   static SMTaskRef<Log> checksum_log;
+
 protected:
    void RateAdd(int a);
    void RateReset();
@@ -225,9 +251,10 @@ public:
 
    void DontCopyDate() { put->DontCopyDate(); }
    void DontVerify() { put->DontVerify(); }
-   void Ascii() { get->Ascii(); put->Ascii(); }
+   void Ascii() { get->Ascii(); put->Ascii(); checksum_pos=-1; }
    void DontFailIfBroken() { fail_if_broken=false; }
    void FailIfCannotSeek() { fail_if_cannot_seek=true; }
+   bool FailsIfCannotSeek() const { return fail_if_cannot_seek; }
    void SetRange(off_t s,off_t lim);
    void SetRangeLimit(off_t lim) { get->range_limit=lim; }
    off_t GetRangeStart() { return get->range_start; }
@@ -237,6 +264,12 @@ public:
    void LineBuffered(int size=0x1000);
    bool IsLineBuffered() const { return line_buffer; }
 
+   // FXP copies can be split into ranges too (see FileCopyFtp);
+   // SegmentFXP marks the copy as one of the ranges.
+   virtual bool CanSegmentFXP() { return false; }
+   virtual void SegmentFXP() {}
+   virtual bool FXPStoreStarted() { return false; }
+
    FileCopy(FileCopyPeer *src,FileCopyPeer *dst,bool cont);
    ~FileCopy();
 
@@ -332,6 +365,7 @@ public:
 
    void OpenSession();
    const FileAccessRef& GetSession() { return session; }
+   const char *GetFile() { return file; }
    void Fg() { session->SetPriority(1); }
    void Bg() { session->SetPriority(0); }
    void SetFXP(bool on) { fxp=on; }
@@ -362,6 +396,19 @@ class FileCopyPeerFDStream : public FileCopyPeer
 
    Ref<FileVerificator> verify;
 
+   // tuning for regular local files being written
+   bool local_checked;
+   bool local_file;
+   int write_block;	// write whole aligned blocks of this size
+   off_t sync_bytes;	// start write-back after this much data
+   off_t unsynced;
+   bool direct;		// O_DIRECT allowed for aligned blocks
+   bool direct_on;	// O_DIRECT is currently set on the fd
+   xstring direct_buf;
+   void SetupLocalFile(int fd);
+   int WriteData(int fd,const char *buf,int len);
+   void SyncData(int fd,bool all);
+
 public:
    void Init();
    FileCopyPeerFDStream(const Ref<FDStream>& o,dir_t m);
@@ -373,6 +420,8 @@ public:
    pid_t GetProcGroup() { return stream->GetProcGroup(); }
    void Kill(int sig);
 
+   int GetWriteBlock() { return write_block; }
+
    void DontCreateFgData() { create_fg_data=false; }
    void NeedSeek() { need_seek=true; }
    void WantSize();
@@ -86,6 +86,12 @@ int FileCopyFtp::Do()
    {
       if(ftp_src->RestartFailed() || ftp_dst->RestartFailed())
       {
+	 if(segmented || FailsIfCannotSeek())
+	 {
+	    // cannot copy a range, let the caller fall back.
+	    SetError(_("seek failed"));
+	    return MOVED;
+	 }
 	 get->CannotSeek(put->GetSize());
 	 put->CannotSeek(put->GetSize());
       }
@@ -128,7 +134,14 @@ int FileCopyFtp::Do()
 
 	 off_t pos=put->GetRealPos();
 	 if(!get->CanSeek(pos) || !put->CanSeek(pos))
+	 {
+	    if(FailsIfCannotSeek())
+	    {
+	       SetError(_("seek failed"));
+	       return MOVED;
+	    }
 	    pos=0;
+	 }
 	 get->Seek(pos);
 	 put->Seek(pos);
 	 RateReset();
@@ -141,6 +154,8 @@ int FileCopyFtp::Do()
       src_try_time=ftp_src->GetTryTime();
       dst_try_time=ftp_dst->GetTryTime();
       Close();
+      if(segmented || FailsIfCannotSeek())
+	 return MOVED;  // the file is shared, resume at our own position.
       if(put->CanSeek())
       {
 	 put->Seek(FILE_END);
@@ -171,6 +186,12 @@ int FileCopyFtp::Do()
       SetError(ftp_dst->StrError(dst_res));
       return MOVED;
    }
+   if(segmented && ftp_dst->CopyStatFailed())
+   {
+      // without the position the range end would be missed.
+      SetError(_("the target server does not report transfer position"));
+      return MOVED;
+   }
 
    // exchange copy address
    if(ftp_dst->SetCopyAddress(ftp_src) || ftp_src->SetCopyAddress(ftp_dst))
@@ -201,9 +222,31 @@ int FileCopyFtp::Do()
    get->SetPos(pos);
    put->SetPos(pos);
 
+   if(get->range_limit!=FILE_END && pos>=get->range_limit)
+   {
+      // the range is copied, the rest is done by another copy (pget).
+      Close();
+      get->PutEOF();
+      return MOVED;
+   }
+
    return m;
 }
 
+bool FileCopyFtp::CanSegmentFXP()
+{
+   // the position of destination is only known from STAT replies,
+   // and they are not requested over TLS or through an HTTP proxy.
+   if(disable_fxp || protect)
+      return false;
+   return ftp_src->CopyCanStat() && ftp_dst->CopyCanStat();
+}
+
+bool FileCopyFtp::FXPStoreStarted()
+{
+   return !disable_fxp && state==DO_COPY && ftp_dst->CopyStoreStarted();
+}
+
 void FileCopyFtp::Init()
 {
    no_rest=false;
@@ -211,6 +254,7 @@ void FileCopyFtp::Init()
    src_retries=dst_retries=0;
    src_try_time=dst_try_time=0;
    disable_fxp=false;
+   segmented=false;
 #if USE_SSL
    protect=false;
    orig_passive_ssl_connect=passive_ssl_connect=true;
@@ -29,6 +29,7 @@ class FileCopyFtp : public FileCopy
    bool passive_source;
    bool orig_passive_source;
    bool disable_fxp;
+   bool segmented;
 #if USE_SSL
    bool protect;
    bool passive_ssl_connect;
@@ -47,6 +48,10 @@ public:
 
    int Do();
 
+   bool CanSegmentFXP();
+   void SegmentFXP() { segmented=true; }
+   bool FXPStoreStarted();
+
    static FileCopy *New(FileCopyPeer *src,FileCopyPeer *dst,bool cont);
 };
 
@@ -66,6 +66,8 @@ void  FileInfo::Merge(const FileInfo& f)
       SetGroup(f.group);
    if(dif&NLINKS)
       SetNlink(f.nlinks);
+   if(dif&CHECKSUM)
+      SetChecksum(f.checksum_algo,f.checksum);
 }
 
 void FileInfo::SetUser(const char *u)
@@ -371,6 +373,10 @@ bool  FileInfo::SameAs(const FileInfo *fi,int ignore) const
    if(defined&SYMLINK_DEF && fi->defined&SYMLINK_DEF)
       return (strcmp(symlink,fi->symlink)==0);
 
+   // when both checksums are known, the contents decide.
+   if(defined&CHECKSUM && fi->defined&CHECKSUM && checksum_algo==fi->checksum_algo)
+      return checksum.eq(fi->checksum);
+
    if(defined&DATE && fi->defined&DATE && !(ignore&DATE))
    {
       time_t p=date.ts_prec;
@@ -631,6 +637,7 @@ void FileInfo::Init()
    date=NO_DATE;
    size=NO_SIZE;
    nlinks=0;
+   checksum_algo=Checksum::NONE;
    defined=0;
    need=0;
    user=0; group=0;
@@ -650,6 +657,8 @@ FileInfo::FileInfo(const FileInfo &fi)
    date=fi.date;
    size=fi.size;
    nlinks=fi.nlinks;
+   checksum_algo=fi.checksum_algo;
+   checksum.set(fi.checksum);
    longname.set(fi.longname);
 }
 FileInfo::FileInfo(const char *n)
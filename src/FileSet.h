@@ -22,6 +22,7 @@
 
 #include <sys/types.h>
 #include "xarray.h"
+#include "Checksum.h"
 
 #undef TYPE
 
@@ -57,6 +58,8 @@ public:
    xstring  data;
    const char *user, *group;
    int      nlinks;
+   Checksum::algo_t checksum_algo; // when CHECKSUM is needed, the preferred one
+   xstring  checksum;	 // binary digest of the whole file
 
    enum	 type
    {
@@ -75,6 +78,8 @@ public:
       IGNORE_SIZE_IF_OLDER=02000, // for ignore mask
       IGNORE_DATE_IF_OLDER=04000, // for ignore mask
 
+      CHECKSUM=010000,	 // got on demand only, not part of ALL_INFO
+
       ALL_INFO=NAME|MODE|DATE|TYPE|SYMLINK_DEF|SIZE|USER|GROUP|NLINKS
    };
    unsigned defined;
@@ -100,6 +105,12 @@ public:
    void SetSymlink(const char *s) { symlink.set(s); filetype=SYMLINK; def(TYPE|SYMLINK_DEF); }
    void	SetSize(off_t s) { size=s; def(SIZE); }
    void	SetNlink(int n) { nlinks=n; def(NLINKS); }
+   void	SetChecksum(Checksum::algo_t a,const xstring& d)
+      {
+	 checksum_algo=a;
+	 checksum.set(d);
+	 def(CHECKSUM);
+      }
 
    void	 Merge(const FileInfo&);
 
@@ -40,6 +40,9 @@ int FinderJob::Do()
    prf_res pres;
    Job *j;
 
+   if(parallel>1)
+      m|=HandlePrefetch();
+
    switch(state)
    {
    case START_INFO:
@@ -68,6 +71,34 @@ int FinderJob::Do()
 	 return MOVED;
       }
 
+      if(stack_ptr != -1 && (prefetch_store.count()>0 || prefetch_wait.Count()>0))
+      {
+	 const char *path=alloca_strdup(dir_file(top.path,dir));
+	 prefetch *p=prefetch_store.lookup(path);
+	 if(p && p->li)
+	    return m;	// it will be ready soon
+	 if(p && !p->error)
+	 {
+	    Enter(dir);
+	    Push(p->fset.borrow());
+	    top.fset->rewind();
+	    prefetch_store.remove(path);
+	    state=LOOP;
+	    return MOVED;
+	 }
+	 // not started or failed; list it here, reporting the error if any.
+	 if(p)
+	    prefetch_store.remove(path);
+	 for(int i=0; i<prefetch_wait.Count(); i++)
+	 {
+	    if(!strcmp(prefetch_wait[i],path))
+	    {
+	       prefetch_wait.Remove(i);
+	       break;
+	    }
+	 }
+      }
+
       /* The first time we get here (stack_ptr == -1), dir is an actual
        * argument, so it might be a file.  (Every other time, it's guaranteed
        * to be a directory.)  Set show_dirs to true, so it'll end up actually
@@ -87,6 +118,9 @@ int FinderJob::Do()
       li->Need(need);
       if(use_cache)
 	 li->UseCache();
+      /* Unlimited depth: all the subdirectories will be listed too. */
+      if(stack_ptr != -1 && maxdepth == -1)
+	 li->Recursive();
       state=INFO;
       m=MOVED;
    }
@@ -199,6 +233,7 @@ void FinderJob::Up()
    if(stack_ptr==-1)
    {
    done:
+      DropPrefetch();
       state=DONE;
       Finish();
       return;
@@ -236,6 +271,68 @@ void FinderJob::Push(FileSet *fset)
    /* give a chance to operate on the list as a whole, and
     * possibly sort it */
    ProcessList(fset);
+
+   /* stack[0] is the argument itself, its contents are listed right away */
+   if(parallel>1 && stack_ptr>0 && (maxdepth == -1 || stack_ptr+1 < maxdepth))
+      Prefetch(new_path,fset);
+}
+
+/* queue subdirectories of path for listing ahead of the traversal */
+void FinderJob::Prefetch(const char *path,const FileSet *fset)
+{
+   int pos=0;
+   for(int i=0; i<fset->count(); i++)
+   {
+      const FileInfo *f=(*fset)[i];
+      if((f->defined&f->TYPE) && f->filetype==f->DIRECTORY)
+	 prefetch_wait.InsertBefore(pos++,dir_file(path,f->name));
+   }
+}
+
+int FinderJob::HandlePrefetch()
+{
+   int m=STALL;
+   for(prefetch *p=prefetch_store.each_begin(); p; p=prefetch_store.each_next())
+   {
+      if(!p->li || !p->li->Done())
+	 continue;
+      if(p->li->Error())
+	 p->error=true;
+      else
+	 p->fset=p->li->GetResult();
+      p->li=0;
+      p->session=0;
+      prefetch_active--;
+      m=MOVED;
+   }
+   /* don't go too far ahead, the ready listings are kept in memory */
+   while(prefetch_wait.Count()>0 && prefetch_active<parallel
+   && prefetch_store.count()<parallel*8)
+   {
+      xstring_c path(prefetch_wait.Pop(0));
+      prefetch *p=new prefetch;
+      p->error=false;
+      p->session=session->Clone();
+      p->session->SetCwd(init_dir);
+      p->li=new GetFileInfo(p->session,path,false);
+      p->li->DontPrependPath();
+      p->li->Need(file_info_need|FileInfo::NAME|FileInfo::TYPE);
+      if(use_cache)
+	 p->li->UseCache();
+      if(maxdepth == -1)
+	 p->li->Recursive();
+      prefetch_store.add(path,p);
+      prefetch_active++;
+      m=MOVED;
+   }
+   return m;
+}
+
+void FinderJob::DropPrefetch()
+{
+   prefetch_wait.Empty();
+   prefetch_store.empty();
+   prefetch_active=0;
 }
 
 void FinderJob::Down(const char *p)
@@ -271,6 +368,9 @@ void FinderJob::Init()
    maxdepth=-1;
    exclude=0;
 
+   parallel=1;
+   prefetch_active=0;
+
    state=START_INFO;
 }
 
@@ -329,6 +429,11 @@ xstring& FinderJob::FormatStatus(xstring& s,int v,const char *prefix)
    default:
       break;
    }
+   for(prefetch *p=prefetch_store.each_begin(); p; p=prefetch_store.each_next())
+   {
+      if(p->li)
+	 s.appendf("\t%s: %s\n",prefetch_store.each_key().get(),p->li->Status());
+   }
    return s;
 }
 
@@ -25,6 +25,8 @@
 #include "ArgV.h"
 #include "GetFileInfo.h"
 #include "PatternSet.h"
+#include "StringSet.h"
+#include "xmap.h"
 
 class FinderJob : public SessionJob
 {
@@ -66,6 +68,24 @@ class FinderJob : public SessionJob
 
    Ref<PatternSet> exclude;
 
+   /* Subdirectories are listed ahead of the traversal on up to `parallel'
+    * cloned sessions. The traversal itself is unchanged and takes the
+    * ready listings in its usual order, so the output order is the same. */
+   struct prefetch
+   {
+      FileAccessRef session;
+      SMTaskRef<GetFileInfo> li;
+      Ref<FileSet> fset;
+      bool error;
+   };
+   int parallel;
+   StringSet prefetch_wait;	   // paths to list, in traversal order
+   xmap_p<prefetch> prefetch_store; // started and ready listings
+   int prefetch_active;
+   void Prefetch(const char *path,const FileSet *fset);
+   int HandlePrefetch();
+   void DropPrefetch();
+
 protected:
    enum state_t { START_INFO, INFO, LOOP, PROCESSING, WAIT, DONE };
    state_t state;
@@ -108,6 +128,7 @@ public:
    void BeQuiet() { quiet=true; }
    void SetExclude(PatternSet *p) { exclude = p; }
    void set_maxdepth(int _maxdepth) { maxdepth = _maxdepth; }
+   void SetParallel(int p) { parallel = p; }
 
    void Fg();
    void Bg();
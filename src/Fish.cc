@@ -38,7 +38,8 @@
 
 void Fish::GetBetterConnection(int level)
 {
-   for(FA *fo=FirstSameSite(); fo!=0; fo=NextSameSite(fo))
+   int n;
+   for(FA *fo=FirstSameSite(&n); fo!=0; fo=NextSameSite(fo,&n))
    {
       Fish *o=(Fish*)fo; // we are sure it is Fish.
 
@@ -308,6 +308,7 @@ int GetFileInfo::Do()
       /* Get a listing: */
       li=session->MakeListInfo();
       if(follow_symlinks) li->FollowSymlinks();
+      if(recursive && was_directory) li->Recursive();
       li->UseCache(use_cache);
       li->NoNeed(FileInfo::ALL_INFO); /* clear need */
       li->Need(need);
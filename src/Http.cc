@@ -23,6 +23,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <fcntl.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <time.h>
@@ -38,6 +39,9 @@
 #include "buffer_ssl.h"
 
 #include "ascii_ctype.h"
+#include "StringSet.h"
+#include "LsCache.h"
+#include "md5.h"
 
 #if !HAVE_DECL_STRPTIME
 CDECL char *strptime(const char *buf, const char *format, struct tm *tm);
@@ -106,6 +110,8 @@ void Http::Init()
    chunk_pos=0;
    chunked_trailer=false;
 
+   accept_encoding=false;
+
    no_ranges=false;
    seen_ranges_bytes=false;
 
@@ -113,6 +119,11 @@ void Http::Init()
    no_cache=false;
 
    use_propfind_now=true;
+   propfind_tree=false;
+
+   revalidating=false;
+   not_modified=false;
+   keep_listing=false;
 
    retry_after=0;
 
@@ -191,6 +202,16 @@ void Http::ResetRequestData()
    chunk_pos=0;
    chunked_trailer=false;
    seen_ranges_bytes=false;
+#if USE_ZLIB
+   content_decoder=0;
+   decoded_body.Empty();
+#endif
+   etag.unset();
+   last_modified.unset();
+   revalidating=false;
+   not_modified=false;
+   keep_listing=false;
+   listing_body.unset();
 }
 
 void Http::Close()
@@ -230,6 +251,7 @@ void Http::Close()
    no_cache_this=false;
    no_ranges=false;
    use_propfind_now=QueryBool("use-propfind",hostname);
+   propfind_tree=false;
    special=HTTP_NONE;
    special_data.set(0);
    super::Close();
@@ -242,6 +264,10 @@ void Http::Send(const char *format,...)
    xstring& str=xstring::vformat(format,va);
    va_end(va);
    LogSend(5,str);
+   if(!strncasecmp(str,"Authorization:",14) || !strncasecmp(str,"Proxy-Authorization:",20))
+      Trace(TraceRing::SEND,str,strchr(str,':')-str.get()+1);
+   else
+      Trace(TraceRing::SEND,str,str.length());
    conn->send_buf->Put(str);
 }
 
@@ -583,16 +609,7 @@ void Http::SendRequest(const char *connection,const char *f)
 		     (long long)entity_size);
       }
       if(entity_date!=NO_DATE)
-      {
-	 static const char weekday_names[][4]={
-	    "Sun","Mon","Tue","Wed","Thu","Fri","Sat"
-	 };
-	 const struct tm *t=gmtime(&entity_date);
-	 const char *d=xstring::format("%s, %2d %s %04d %02d:%02d:%02d GMT",
-	    weekday_names[t->tm_wday],t->tm_mday,month_names[t->tm_mon],
-	    t->tm_year+1900,t->tm_hour,t->tm_min,t->tm_sec);
-	 Send("Last-Modified: %s\r\n",d);
-      }
+	 Send("Last-Modified: %s\r\n",FormatTime(entity_date));
       break;
 
    case CHANGE_DIR:
@@ -630,7 +647,8 @@ void Http::SendRequest(const char *connection,const char *f)
       else if(mode==MP_LIST)
       {
 	 SendMethod("PROPFIND",efile);
-	 Send("Depth: 1\r\n"); // directory listing required
+	 // directory listing required, possibly with all subdirectories
+	 Send("Depth: %s\r\n",propfind_tree?"infinity":"1");
 	 Send("Content-Type: text/xml\r\n");
 	 if(allprop_len>0)
 	    Send("Content-Length: %d\r\n",allprop_len);
@@ -655,6 +673,31 @@ void Http::SendRequest(const char *connection,const char *f)
 	 Send("Destination: %s\r\n",GetFileURL(file1));
       }
    }
+   accept_encoding=false;
+#if USE_ZLIB
+   // compressed body cannot be resumed, the offsets are of decoded data.
+   if(!hftp && pos==0 && (mode==LONG_LIST || mode==MP_LIST
+	 || (mode==RETRIEVE && !special && QueryBool("decompress-files",hostname)))
+   && QueryBool("use-compression",hostname))
+   {
+      Send("Accept-Encoding: gzip, deflate\r\n");
+      accept_encoding=true;
+   }
+#endif
+   revalidating=false;
+   if(!hftp && pos==0 && (mode==LONG_LIST || mode==MP_LIST)
+   && QueryBool("use-validators",hostname))
+   {
+      const StoredListing *l=FindListing(ListingKey(mode));
+      if(l)
+      {
+	 if(l->etag)
+	    Send("If-None-Match: %s\r\n",l->etag.get());
+	 if(l->last_modified)
+	    Send("If-Modified-Since: %s\r\n",l->last_modified.get());
+	 revalidating=true;
+      }
+   }
    SendAuth();
    if(no_cache || no_cache_this)
       Send("Pragma: no-cache\r\n"); // for HTTP/1.0 compatibility
@@ -781,8 +824,14 @@ void Http::HandleHeaderLine(const char *name,const char *value)
 	 *opt_size=fsize;
       return;
    }
+   if(!strcasecmp(name,"ETag"))
+   {
+      etag.set(value);
+      return;
+   }
    if(!strcasecmp(name,"Last-Modified"))
    {
+      last_modified.set(value);
       time_t t=Http::atotm(value);
       if(opt_date && H_20X(status_code))
 	 *opt_date=t;
@@ -840,6 +889,45 @@ void Http::HandleHeaderLine(const char *name,const char *value)
       // handle gzip?
       return;
    }
+   if(!strcasecmp(name,"Content-Encoding"))
+   {
+#if USE_ZLIB
+      if(accept_encoding && (!strcasecmp(value,"gzip") || !strcasecmp(value,"x-gzip")
+			    || !strcasecmp(value,"deflate")))
+	 content_decoder=new DataInflator();
+      if(content_decoder)
+      {
+	 // the digests are of the encoded data.
+	 entity_digest_algo=Checksum::NONE;
+	 entity_digest.unset();
+      }
+#endif
+      return;
+   }
+   if(!strcasecmp(name,"Digest") && mode==RETRIEVE && !content_decoder)
+   {
+      // RFC 3230 instance digests, like "SHA-256=base64,MD5=base64".
+      char *v=alloca_strdup(value);
+      for(char *d=strtok(v,", "); d; d=strtok(0,", "))
+      {
+	 char *eq=strchr(d,'=');
+	 if(!eq)
+	    continue;
+	 *eq++=0;
+	 xstring digest;
+	 if(base64_decode(eq,digest))
+	    SetEntityDigest(Checksum::Find(d),digest);
+      }
+      return;
+   }
+   if(!strcasecmp(name,"Content-MD5") && mode==RETRIEVE && !content_decoder)
+   {
+      // it is of the response body, so the whole file only with 200.
+      xstring digest;
+      if(status_code==200 && base64_decode(value,digest))
+	 SetEntityDigest(Checksum::MD5,digest);
+      return;
+   }
    if(!strcasecmp(name,"Accept-Ranges"))
    {
       if(!strcasecmp(value,"none"))
@@ -897,7 +985,8 @@ void Http::GetBetterConnection(int level)
 {
    if(level==0)
       return;
-   for(FA *fo=FirstSameSite(); fo!=0; fo=NextSameSite(fo))
+   int n;
+   for(FA *fo=FirstSameSite(&n); fo!=0; fo=NextSameSite(fo,&n))
    {
       Http *o=(Http*)fo; // we are sure it is Http.
 
@@ -945,6 +1034,22 @@ int Http::Do()
    if(Error())
       return m;
 
+   if(mode==CHANGE_DIR && new_cwd && (state==DISCONNECTED || state==CONNECTED)
+   && tree_dirs.count()>0 && FindTreeListing(new_cwd->path))
+   {
+      // the directory is known from a recursive listing.
+      cwd.Set(new_cwd);
+      cache->SetDirectory(this, "", true);
+      if(state==CONNECTED)
+      {
+	 // let Close keep the idle connection.
+	 keep_alive=true;
+	 body_size=bytes_received=0;
+      }
+      state=DONE;
+      return MOVED;
+   }
+
    switch(state)
    {
    case DISCONNECTED:
@@ -1105,6 +1210,7 @@ int Http::Do()
 	 return m;
       }
 
+      ConnectTimingConnected();
       m=MOVED;
       state=CONNECTED;
 #if USE_SSL
@@ -1292,6 +1398,7 @@ int Http::Do()
 	    conn->recv_buf->Skip(len+eol_size);
 
 	    LogRecv(4,line);
+	    Trace(TraceRing::RECV,line,line.length());
 	    m=MOVED;
 
 	    if(status==0)
@@ -1317,6 +1424,7 @@ int Http::Do()
 		  goto pre_RECEIVING_BODY;
 	       }
 	       proto_version=(ver_major<<4)+ver_minor;
+	       ConnectTimingReady();
 
 	       // HTTP/1.1 does keep-alive by default
 	       if(proto_version>=0x11)
@@ -1406,11 +1514,48 @@ int Http::Do()
 	 return MOVED;
       }
 
+      if(status_code==304 && revalidating)
+      {
+	 const StoredListing *l=FindListing(ListingKey(mode));
+	 if(!l)
+	 {
+	    // dropped meanwhile, get it again.
+	    try_time=0;
+	    Disconnect();
+	    return MOVED;
+	 }
+	 LogNote(9,"listing is not modified, using the stored copy");
+	 not_modified=true;
+	 listing_body.set(l->data);
+	 body_size=0;
+	 entity_size=listing_body.length();
+#if USE_ZLIB
+	 content_decoder=0;
+#endif
+	 rate_limit=new RateLimit(hostname);
+	 real_pos=0;
+	 state=RECEIVING_BODY;
+	 return MOVED;
+      }
+
       if(!H_20X(status_code))
       {
 	 xstring err;
 	 int code=NO_FILE;
 
+	 if(mode==MP_LIST && propfind_tree
+	 && (status_code==400 || status_code==403 || status_code==501
+	     || status_code==507))
+	 {
+	    // Depth: infinity is refused, use Depth: 1.
+	    LogNote(9,"recursive PROPFIND refused, falling back to Depth: 1");
+	    ResMgr::Set("http:use-propfind-infinity",hostname,"no");
+	    propfind_tree=false;
+	    try_time=0;
+	    Disconnect();
+	    return MOVED;
+	 }
+
 	 if(H_REDIRECTED(status_code))
 	 {
 	    if(location && !url::is_url(location)
@@ -1496,6 +1641,12 @@ int Http::Do()
 
       LogNote(9,_("Receiving body..."));
       rate_limit=new RateLimit(hostname);
+      if(!hftp && pos==0 && (mode==LONG_LIST || mode==MP_LIST)
+      && (etag || last_modified) && QueryBool("use-validators",hostname))
+      {
+	 keep_listing=true;
+	 listing_body.truncate(0);
+      }
       if(real_pos<0) // assume Range: did not work
       {
 	 if(mode!=STORE && mode!=MAKE_DIR && body_size>=0)
@@ -1506,6 +1657,16 @@ int Http::Do()
 	 }
 	 real_pos=0;
       }
+#if USE_ZLIB
+      if(content_decoder)
+      {
+	 // the sizes are of the encoded body
+	 LogNote(9,"decoding compressed body");
+	 entity_size=NO_SIZE;
+	 if(opt_size)
+	    *opt_size=NO_SIZE;
+      }
+#endif
       state=RECEIVING_BODY;
       m=MOVED;
    case RECEIVING_BODY:
@@ -1606,7 +1767,19 @@ int Http::Read(void *buf,int size)
 	 if(rate_limit)
 	    rate_limit->BytesGot(res);
 	 TrySuccess();
+	 if(keep_listing)
+	 {
+	    if(listing_body.length()+res>(size_t)cache->SizeLimit())
+	    {
+	       keep_listing=false;
+	       listing_body.unset();
+	    }
+	    else
+	       listing_body.append((const char*)buf,res);
+	 }
       }
+      else if(res==0 && keep_listing)
+	 StoreListing();
    }
    return res;
 }
@@ -1615,6 +1788,30 @@ int Http::_Read(void *buf,int size)
    const char *buf1;
    int size1;
 get_again:
+   if(not_modified)
+   {
+      // the stored copy of the listing
+      int left=listing_body.length()-real_pos;
+      if(left<=0)
+	 return 0;
+      if(size>left)
+	 size=left;
+      memcpy(buf,listing_body+real_pos,size);
+      real_pos+=size;
+      return size;
+   }
+#if USE_ZLIB
+   if(decoded_body.Size()>0)
+   {
+      decoded_body.Get(&buf1,&size1);
+      if(size>size1)
+	 size=size1;
+      memcpy(buf,buf1,size);
+      decoded_body.Skip(size);
+      real_pos+=size;
+      return size;
+   }
+#endif
    if(conn->recv_buf->Size()==0 && conn->recv_buf->Error())
    {
       LogError(0,"recv: %s",conn->recv_buf->ErrorText());
@@ -1627,8 +1824,9 @@ get_again:
    if(buf1==0) // eof
    {
       LogNote(9,_("Hit EOF"));
-      if(bytes_received<body_size || chunked)
+      if(bytes_received<body_size || chunked || !ContentDecoded())
       {
+      truncated:
 	 LogError(0,_("Received not enough data, retrying"));
 	 Disconnect();
 	 return DO_AGAIN;
@@ -1639,6 +1837,8 @@ get_again:
    {
       if(body_size>=0 && bytes_received>=body_size)
       {
+	 if(!ContentDecoded())
+	    goto truncated;
 	 LogNote(9,_("Received all"));
 	 return 0; // all received
       }
@@ -1677,6 +1877,8 @@ get_again:
       }
       if(chunk_size==0) // eof
       {
+	 if(!ContentDecoded())
+	    goto truncated;
 	 LogNote(9,_("Received last chunk"));
 	 // headers may follow
 	 chunked_trailer=true;
@@ -1729,6 +1931,25 @@ get_again:
 	 chunk_pos+=to_skip;
       goto get_again;
    }
+#if USE_ZLIB
+   if(content_decoder)
+   {
+      // limit the input, the decoded data can be much larger.
+      if(size1>0x4000)
+	 size1=0x4000;
+      content_decoder->PutTranslated(&decoded_body,buf1,size1);
+      conn->recv_buf->Skip(size1);
+      if(chunked)
+	 chunk_pos+=size1;
+      bytes_received+=size1;
+      if(content_decoder->Error())
+      {
+	 Fatal(content_decoder->ErrorText());
+	 return FATAL;
+      }
+      goto get_again;
+   }
+#endif
    if(size>size1)
       size=size1;
    memcpy(buf,buf1,size);
@@ -1949,6 +2170,218 @@ ListInfo *Http::MakeListInfo(const char *path)
    return new HttpListInfo(this,path);
 }
 
+xmap<time_t> Http::tree_dirs;
+
+const xstring& Http::TreeKey(const char *path) const
+{
+   int len=strlen(path);
+   if(len>1 && path[len-1]=='/')
+      len--;
+   return xstring::cat(user?user.get():"","@",hostname.get(),":",
+			 portname?portname.get():"",
+			 xstring::get_tmp(path,len).get(),NULL);
+}
+void Http::ExpireTreeListings(const char *host)
+{
+   TimeIntervalR expire(ResMgr::Query("cache:expire",host));
+   if(expire.IsInfty())
+      return;
+   StringSet old;
+   for(time_t t=tree_dirs.each_begin(); t; t=tree_dirs.each_next())
+   {
+      if(t+expire.Seconds()<=SMTask::now.UnixTime())
+	 old.Append(tree_dirs.each_key());
+   }
+   for(int i=0; i<old.Count(); i++)
+      tree_dirs.remove(xstring::get_tmp(old[i]));
+}
+// the listings are already added to LsCache, only remember the directories.
+void Http::StoreTreeListings(xmap_p<FileSet>& listings)
+{
+   ExpireTreeListings(hostname);
+   if(!cache->IsEnabled(hostname))
+      return;
+   xstring key;
+   for(FileSet *set=listings.each_begin(); set; set=listings.each_next())
+   {
+      key.set(TreeKey(listings.each_key()));
+      tree_dirs.add(key,SMTask::now.UnixTime());
+   }
+}
+const FileSet *Http::FindTreeListing(const char *path)
+{
+   const xstring& key=TreeKey(path);
+   if(!tree_dirs.lookup(key))
+      return 0;
+   FileAccess::Path p(cwd);
+   p.Change(path);
+   SMTaskRef<FileAccess> loc(Clone());
+   loc->SetCwd(p);
+   const FileSet *set=cache->FindFileSet(loc,"",MP_LIST);
+   if(!set)
+      tree_dirs.remove(key);   // flushed or expired from the cache
+   return set;
+}
+xmap_p<Http::StoredListing> Http::listing_store;
+long long Http::listing_store_size;
+
+const xstring& Http::ListingKey(int m) const
+{
+   int len=cwd.path.length();
+   if(len>1 && cwd.path[len-1]=='/')
+      len--;
+   return xstring::cat(m==MP_LIST?"PROPFIND ":"GET ",GetProto(),"://",
+			 user?user.get():"","@",hostname.get(),":",
+			 portname?portname.get():"",
+			 xstring::get_tmp(cwd.path,len).get(),NULL);
+}
+const char *Http::ListingFile(const char *key)
+{
+   char digest[16];
+   md5_buffer(key,strlen(key),digest);
+   return xstring::format("%s/http/%s",get_lftp_cache_dir(),
+			  xstring::get_tmp(digest,sizeof(digest)).hexdump());
+}
+Http::StoredListing *Http::FindListing(const char *key)
+{
+   StoredListing *l=listing_store.lookup(key);
+   if(l || !QueryBool("save-validators",hostname))
+      return l;
+   l=LoadListing(key);
+   if(l)
+   {
+      listing_store_size+=l->data.length();
+      listing_store.add(l->key,l);
+   }
+   return l;
+}
+void Http::StoreListing()
+{
+   keep_listing=false;
+   StoredListing *l=new StoredListing;
+   l->key.set(ListingKey(mode));
+   l->etag.set(etag);
+   l->last_modified.set(last_modified);
+   l->data.move_here(listing_body);
+
+   StoredListing *old=listing_store.lookup(l->key);
+   if(old)
+      listing_store_size-=old->data.length();
+   listing_store_size+=l->data.length();
+   listing_store.add(l->key,l);
+
+   // keep the memory use within the cache size.
+   long limit=cache->SizeLimit();
+   if(listing_store_size>limit)
+   {
+      StringSet drop;
+      long long size=listing_store_size;
+      for(StoredListing *s=listing_store.each_begin(); s && size>limit/2;
+	    s=listing_store.each_next())
+      {
+	 if(s==l)
+	    continue;
+	 drop.Append(s->key);
+	 size-=s->data.length();
+      }
+      for(int i=0; i<drop.Count(); i++)
+      {
+	 const xstring& k=xstring::get_tmp(drop[i]);
+	 listing_store_size-=listing_store.lookup(k)->data.length();
+	 listing_store.remove(k);
+      }
+   }
+   if(QueryBool("save-validators",hostname))
+      SaveListing(l);
+}
+/* The file format is the key line, header lines with the validators,
+ * an empty line and the listing itself. */
+void Http::SaveListing(const StoredListing *l)
+{
+   xstring buf;
+   buf.set(l->key);
+   buf.append('\n');
+   if(l->etag)
+      buf.appendf("ETag: %s\n",l->etag.get());
+   if(l->last_modified)
+      buf.appendf("Last-Modified: %s\n",l->last_modified.get());
+   buf.append('\n');
+   buf.append(l->data);
+
+   mkdir(xstring::format("%s/http",get_lftp_cache_dir()),0700);
+   const char *file=ListingFile(l->key);
+   const xstring& tmp=xstring::cat(file,".tmp",NULL);
+   int fd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC,0600);
+   if(fd==-1)
+   {
+      LogError(1,"open(%s): %s",tmp.get(),strerror(errno));
+      return;
+   }
+   int res=write(fd,buf.get(),buf.length());
+   close(fd);
+   if(res!=(int)buf.length())
+   {
+      LogError(1,"write(%s): %s",tmp.get(),res==-1?strerror(errno):"short write");
+      unlink(tmp);
+      return;
+   }
+   if(rename(tmp,file)==-1)
+   {
+      LogError(1,"rename(%s): %s",tmp.get(),strerror(errno));
+      unlink(tmp);
+   }
+}
+Http::StoredListing *Http::LoadListing(const char *key)
+{
+   int fd=open(ListingFile(key),O_RDONLY);
+   if(fd==-1)
+      return 0;
+   xstring buf;
+   int res;
+   while((res=read(fd,buf.add_space(0x4000),0x4000))>0)
+      buf.add_commit(res);
+   close(fd);
+
+   const char *end=buf.get()+buf.length();
+   const char *line=buf.get();
+   const char *nl=(const char*)memchr(line,'\n',end-line);
+   if(!nl || strncmp(line,key,nl-line) || key[nl-line])
+      return 0;
+   StoredListing *l=new StoredListing;
+   l->key.set(key);
+   for(;;)
+   {
+      line=nl+1;
+      nl=(const char*)memchr(line,'\n',end-line);
+      if(!nl)
+      {
+	 delete l;
+	 return 0;
+      }
+      if(nl==line)
+	 break;
+      const xstring& h=xstring::get_tmp(line,nl-line);
+      if(h.begins_with("ETag: "))
+	 l->etag.set(h+6);
+      else if(h.begins_with("Last-Modified: "))
+	 l->last_modified.set(h+15);
+   }
+   l->data.nset(nl+1,end-nl-1);
+   return l;
+}
+
+FileSet *Http::TakeTreeListing()
+{
+   if(tree_dirs.count()==0)
+      return 0;
+   const FileSet *set=FindTreeListing(cwd.path);
+   if(!set)
+      return 0;
+   LogNote(9,"using listing of `%s' from a recursive PROPFIND",cwd.path.get());
+   tree_dirs.remove(TreeKey(cwd.path));
+   return new FileSet(set);
+}
+
 bool Http::CookieClosureMatch(const char *closure_c,
 			      const char *hostname,const char *efile)
 {
@@ -2320,6 +2753,18 @@ Http::atotm (const char *time_string)
    return ut;
 }
 
+/* RFC1123 date, independent of the locale */
+const char *Http::FormatTime(time_t ut)
+{
+   static const char weekday_names[][4]={
+      "Sun","Mon","Tue","Wed","Thu","Fri","Sat"
+   };
+   const struct tm *t=gmtime(&ut);
+   return xstring::format("%s, %2d %s %04d %02d:%02d:%02d GMT",
+      weekday_names[t->tm_wday],t->tm_mday,month_names[t->tm_mon],
+      t->tm_year+1900,t->tm_hour,t->tm_min,t->tm_sec);
+}
+
 
 #include "modconfig.h"
 #ifdef MODULE_PROTO_HTTP
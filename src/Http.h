@@ -23,6 +23,7 @@
 #include "NetAccess.h"
 #include "buffer.h"
 #include "lftp_ssl.h"
+#include "xmap.h"
 
 class Http : public NetAccess
 {
@@ -105,6 +106,14 @@ class Http : public NetAccess
    void Disconnect();
    void ResetRequestData();
    void MoveConnectionHere(Http *o);
+   bool ContentDecoded() const
+      {
+#if USE_ZLIB
+	 return !content_decoder || content_decoder->StreamEnd();
+#else
+	 return true;
+#endif
+      }
    int IsConnected() const
       {
 	 if(!conn)
@@ -135,6 +144,12 @@ class Http : public NetAccess
    off_t chunk_pos;
    bool chunked_trailer;
 
+   bool accept_encoding;   // Accept-Encoding was sent
+#if USE_ZLIB
+   Ref<DataInflator> content_decoder;
+   Buffer decoded_body;
+#endif
+
    bool no_ranges;
    bool seen_ranges_bytes;
 
@@ -142,6 +157,43 @@ class Http : public NetAccess
    bool no_cache_this;
 
    bool use_propfind_now;
+   bool propfind_tree;	// MP_LIST with Depth: infinity
+
+   // Subdirectories listed by a Depth: infinity PROPFIND reply, until
+   // a recursive HttpListInfo takes their listings. The listings are kept
+   // in LsCache only, so that cache:enable and cache flushes apply.
+   // A directory found here needs no CHANGE_DIR verification.
+   static xmap<time_t> tree_dirs;
+   const xstring& TreeKey(const char *path) const;
+   static void ExpireTreeListings(const char *host);
+   const FileSet *FindTreeListing(const char *path);
+
+   // Directory listings with their validators (ETag, Last-Modified), kept
+   // after LsCache entries expire to revalidate them with a conditional
+   // request. On 304 Not Modified the stored body is returned as if it was
+   // received; only the attributes carried in the body are reused.
+   struct StoredListing
+   {
+      xstring key;
+      xstring etag;
+      xstring last_modified;
+      xstring data;
+   };
+   static xmap_p<StoredListing> listing_store;
+   static long long listing_store_size;
+   const xstring& ListingKey(int m) const;
+   StoredListing *FindListing(const char *key);
+   void StoreListing();
+   void SaveListing(const StoredListing *l);
+   static const char *ListingFile(const char *key);
+   static StoredListing *LoadListing(const char *key);
+
+   xstring etag;		  // validators of the response
+   xstring last_modified;
+   bool revalidating;	  // a conditional request was sent
+   bool not_modified;	  // the stored listing is still valid
+   bool keep_listing;	  // the body is to be stored with its validators
+   xstring listing_body;
 
    long retry_after;
 
@@ -199,7 +251,12 @@ public:
    void Cleanup();
    void CleanupThis();
 
+   void ListTree() { propfind_tree=!hftp && QueryBool("use-propfind-infinity",hostname); }
+   void StoreTreeListings(xmap_p<FileSet>& listings);
+   FileSet *TakeTreeListing();
+
    static time_t atotm (const char *time_string);
+   static const char *FormatTime(time_t t);
 };
 
 class HFtp : public Http
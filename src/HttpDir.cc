@@ -1379,14 +1379,57 @@ FileSet *HttpListInfo::Parse(const char *b,int len)
 {
    if(mode==FA::MP_LIST)
    {
-      FileSet *fs=ParseProps(b,len,session->GetCwd());
+      xmap_p<FileSet> subdirs;
+      FileSet *fs=ParseProps(b,len,session->GetCwd(),recursive?&subdirs:0);
       if(!fs)
 	 mode=FA::LONG_LIST;
+      else if(subdirs.count()>0)
+	 StoreSubdirs(subdirs);
       return fs;
    }
    return session->ParseLongList(b,len);
 }
 
+void HttpListInfo::OpenSession()
+{
+   GenericParseListInfo::OpenSession();
+   // get the whole tree at once if the subdirectories will be listed too.
+   const char *cwd=session->GetCwd();
+   if(recursive && mode==FA::MP_LIST && cwd && cwd[0]=='/')
+      session.Cast<Http>()->ListTree();
+}
+
+FileSet *HttpListInfo::TakePrefetched()
+{
+   if(!recursive || mode!=FA::MP_LIST)
+      return 0;
+   return session.Cast<Http>()->TakeTreeListing();
+}
+
+// Only the subdirectories having entries are stored, a Depth: 1 reply
+// (some servers silently reduce the depth) cannot be told apart from
+// a tree of empty subdirectories.
+void HttpListInfo::StoreSubdirs(xmap_p<FileSet>& subdirs)
+{
+   const FileAccess::Path& cwd=session->GetCwd();
+   int base_len=strlen(cwd.path);
+   xstring data;
+   for(FileSet *set=subdirs.each_begin(); set; set=subdirs.each_next())
+   {
+      const xstring& dir=subdirs.each_key();
+      // make the listing available to ls and to cached listings.
+      FileAccess::Path p(cwd);
+      p.Change(dir+base_len+(dir[base_len]=='/'));
+      SMTaskRef<FileAccess> loc(session->Clone());
+      loc->SetCwd(p);
+      data.truncate(0);
+      FormatProps(data,dir,set);
+      FileAccess::cache->Add(loc,"",FA::MP_LIST,FA::OK,data,data.length(),set);
+   }
+   Log::global->Format(9,"got listings of %d subdirectories\n",subdirs.count());
+   session.Cast<Http>()->StoreTreeListings(subdirs);
+}
+
 FileSet *Http::ParseLongList(const char *b,int len,int *err) const
 {
    if(err)
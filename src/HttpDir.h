@@ -28,13 +28,21 @@
 class HttpListInfo : public GenericParseListInfo
 {
    FileSet *Parse(const char *buf,int len);
+   void OpenSession();
+   FileSet *TakePrefetched();
+   void StoreSubdirs(xmap_p<FileSet>& subdirs);
 public:
    HttpListInfo(Http *session,const char *path)
       : GenericParseListInfo(session,path)
       {
 	 get_time_for_dirs=false;
       }
-   static FileSet *ParseProps(const char *buf,int len,const char *base_dir);
+   // subdirs, if given, receives listings of subdirectories found in
+   // a Depth: infinity reply, keyed by their paths.
+   static FileSet *ParseProps(const char *buf,int len,const char *base_dir,
+			      xmap_p<FileSet> *subdirs=0);
+   // a multistatus reply equivalent to a Depth: 1 PROPFIND of dir.
+   static void FormatProps(xstring& buf,const char *dir,const FileSet *set);
 };
 
 class ParsedURL;
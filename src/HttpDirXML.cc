@@ -32,9 +32,15 @@ struct xml_context
    Ref<FileSet> fs;
    Ref<FileInfo> fi;
    xstring base_dir;
+   xstring fi_path;  // full path of fi
+   xstring fi_dir;   // directory of fi when it is deeper than base_dir
+   xmap_p<FileSet> *subdirs;
+   xmap_p<FileInfo> subdir_info;
 
+   xml_context() : subdirs(0) {}
    void push(const char *);
    void pop();
+   void add(FileInfo *);
    void set_base_dir(const char *d) {
       base_dir.set(d);
       if(base_dir.length()>1)
@@ -51,6 +57,36 @@ void xml_context::pop()
 {
    stack.chop();
 }
+void xml_context::add(FileInfo *info)
+{
+   if(subdirs && info->filetype==info->DIRECTORY && strcmp(info->name,"."))
+   {
+      // becomes `.' in the subdirectory listing
+      FileInfo *dot=new FileInfo(*info);
+      dot->SetName(".");
+      subdir_info.add(fi_path,dot);
+   }
+   if(!fi_dir)
+   {
+      if(!fs)
+	 fs=new FileSet;
+      fs->Add(info);
+      return;
+   }
+   // not a part of base_dir listing
+   if(!subdirs)
+   {
+      delete info;
+      return;
+   }
+   FileSet *set=subdirs->lookup(fi_dir);
+   if(!set)
+   {
+      set=new FileSet;
+      subdirs->add(fi_dir,set);
+   }
+   set->Add(info);
+}
 
 static void start_handle(void *data, const char *el, const char **attr)
 {
@@ -73,11 +109,7 @@ static void end_handle(void *data, const char *el)
    if(!strcmp(ctx->top(), "DAV:response"))
    {
       if(ctx->fi && ctx->fi->name)
-      {
-	 if(!ctx->fs)
-	    ctx->fs=new FileSet;
-	 ctx->fs->Add(ctx->fi.borrow());
-      }
+	 ctx->add(ctx->fi.borrow());
    }
    ctx->pop();
 }
@@ -111,6 +143,18 @@ static void chardata_handle(void *data, const char *chardata, int len)
       if(s[0]=='/' && s[1]=='~')
 	 s++;
       ctx->fi->SetName(ctx->base_dir.eq(s) ? "." : basename_ptr(s));
+      ctx->fi_path.set(s);
+      ctx->fi_dir.unset();
+      int bl=ctx->base_dir.length();
+      if(bl>0 && !strncmp(s,ctx->base_dir,bl)
+      && (s[bl]=='/' || ctx->base_dir.last_char()=='/'))
+      {
+	 // more than one level below base_dir? (Depth: infinity)
+	 const char *rest=s+bl+(s[bl]=='/');
+	 const char *bn=basename_ptr(s);
+	 if(bn>rest)
+	    ctx->fi_dir.nset(s,bn-1-s);
+      }
    }
    else if(!strcmp(tag,"DAV:getcontentlength"))
    {
@@ -135,13 +179,15 @@ static void chardata_handle(void *data, const char *chardata, int len)
    }
 }
 
-FileSet *HttpListInfo::ParseProps(const char *b,int len,const char *base_dir)
+FileSet *HttpListInfo::ParseProps(const char *b,int len,const char *base_dir,
+				  xmap_p<FileSet> *subdirs)
 {
    XML_Parser p = XML_ParserCreateNS(0,0);
    if(!p)
       return 0;
    xml_context ctx;
    ctx.set_base_dir(base_dir);
+   ctx.subdirs=subdirs;
    XML_SetUserData(p,&ctx);
    XML_SetElementHandler(p, start_handle, end_handle);
    XML_SetCharacterDataHandler(p, chardata_handle);
@@ -155,6 +201,15 @@ FileSet *HttpListInfo::ParseProps(const char *b,int len,const char *base_dir)
       return 0;
    }
    XML_ParserFree(p);
+   if(subdirs)
+   {
+      for(FileSet *set=subdirs->each_begin(); set; set=subdirs->each_next())
+      {
+	 FileInfo *dot=ctx.subdir_info.borrow(subdirs->each_key());
+	 if(dot)
+	    set->Add(dot);
+      }
+   }
    return ctx.fs.borrow();
 }
 
@@ -210,6 +265,65 @@ end:
    }
 }
 #else // !USE_EXPAT
-FileSet *HttpListInfo::ParseProps(const char *b,int len,const char *base_dir) { return 0; }
+FileSet *HttpListInfo::ParseProps(const char *b,int len,const char *base_dir,
+				  xmap_p<FileSet> *subdirs) { return 0; }
 void HttpDirList::ParsePropsFormat(const char *b,int len,bool eof) {}
 #endif // !USE_EXPAT
+
+static void append_xml_escaped(xstring& buf,const char *s)
+{
+   for( ; *s; s++)
+   {
+      switch(*s)
+      {
+      case '&': buf.append("&amp;"); break;
+      case '<': buf.append("&lt;");  break;
+      case '>': buf.append("&gt;");  break;
+      default:  buf.append(*s);      break;
+      }
+   }
+}
+
+void HttpListInfo::FormatProps(xstring& buf,const char *dir,const FileSet *set)
+{
+   buf.append("<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+	      "<D:multistatus xmlns:D=\"DAV:\">\n");
+   xstring path;
+   for(int i=0; i<set->get_fnum(); i++)
+   {
+      const FileInfo *fi=(*set)[i];
+      bool is_dir=(fi->Has(fi->TYPE) && fi->filetype==fi->DIRECTORY);
+      path.set(dir);
+      if(strcmp(fi->name,"."))
+      {
+	 if(path.last_char()!='/')
+	    path.append('/');
+	 path.append(fi->name);
+      }
+      if(is_dir && path.last_char()!='/')
+	 path.append('/');
+      buf.append("<D:response><D:href>");
+      buf.append(url::encode(path,URL_PATH_UNSAFE));
+      buf.append("</D:href><D:propstat><D:prop>");
+      if(is_dir)
+	 buf.append("<D:resourcetype><D:collection/></D:resourcetype>");
+      if(fi->Has(fi->SIZE))
+	 buf.appendf("<D:getcontentlength>%lld</D:getcontentlength>",
+		     (long long)fi->size);
+      if(fi->Has(fi->DATE))
+	 buf.appendf("<D:getlastmodified>%s</D:getlastmodified>",
+		     Http::FormatTime(fi->date));
+      if(fi->Has(fi->USER) && fi->user)
+      {
+	 buf.append("<D:creator-displayname>");
+	 append_xml_escaped(buf,fi->user);
+	 buf.append("</D:creator-displayname>");
+      }
+      if(!is_dir && fi->Has(fi->MODE))
+	 buf.appendf("<E:executable xmlns:E=\"http://apache.org/dav/props/\">"
+		     "%c</E:executable>",(fi->mode&0111)?'T':'F');
+      buf.append("</D:prop><D:status>HTTP/1.1 200 OK</D:status>"
+		 "</D:propstat></D:response>\n");
+   }
+   buf.append("</D:multistatus>\n");
+}
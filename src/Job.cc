@@ -23,6 +23,7 @@
 #include <assert.h>
 #include "Job.h"
 #include "misc.h"
+#include "Metrics.h"
 
 Job *Job::chain;
 #define waiting_num waiting.count()
@@ -528,3 +529,33 @@ void Job::WaitDone()
    }
    ref_count--;
 }
+
+class JobMetrics : public MetricsSource
+{
+public:
+   void FormatMetrics(xstring& buf);
+};
+void JobMetrics::FormatMetrics(xstring& buf)
+{
+   Declare(buf,"lftp_jobs","gauge","Number of running jobs.");
+   Value(buf,"lftp_jobs",(long long)Job::NumberOfJobs());
+
+   xstring labels;
+   Declare(buf,"lftp_job_bytes","gauge","Bytes transferred by a numbered job.");
+   ListScan(Job,Job::chain,next) {
+      if(scan->jobno<0 || scan->Done())
+	 continue;
+      labels.setf("job=\"%d\",",scan->jobno);
+      labels.append(Label("cmd",scan->cmdline));
+      Value(buf,"lftp_job_bytes",labels,(long long)scan->GetBytesCount());
+   }
+   Declare(buf,"lftp_job_seconds","gauge","Time spent transferring by a numbered job.");
+   ListScan(Job,Job::chain,next) {
+      if(scan->jobno<0 || scan->Done())
+	 continue;
+      labels.setf("job=\"%d\",",scan->jobno);
+      labels.append(Label("cmd",scan->cmdline));
+      Value(buf,"lftp_job_seconds",labels,scan->GetTimeSpent());
+   }
+}
+static JobMetrics job_metrics;
@@ -33,6 +33,7 @@
 
 class Job : public SMTask
 {
+   friend class JobMetrics;
    static void SortJobs();
 
    Job  *next;
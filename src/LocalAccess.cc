@@ -31,6 +31,7 @@
 #include "misc.h"
 #include "log.h"
 #include "LocalDir.h"
+#include "url.h"
 
 CDECL_BEGIN
 #include <glob.h>
@@ -51,6 +52,7 @@ void LocalAccess::Init()
 {
    done=false;
    error_code=OK;
+   info_checksum_fd=-1;
    home.Set(getenv("HOME"));
    hostname.set("localhost");
 }
@@ -284,8 +286,8 @@ int LocalAccess::Do()
       return MOVED;
 
    case(ARRAY_INFO):
-      fill_array_info();
-      done=true;
+      if(fill_array_info())
+	 done=true;
       return MOVED;
    case MP_LIST:
       SetError(NOT_SUPP);
@@ -294,10 +296,204 @@ int LocalAccess::Do()
    return m;
 }
 
-void LocalAccess::fill_array_info()
+// returns false when called in the middle of a checksum, to be called again.
+bool LocalAccess::fill_array_info()
 {
    for(FileInfo *fi=fileset_for_info->curr(); fi; fi=fileset_for_info->next())
-      fi->LocalFile(fi->name,(fi->filetype!=fi->SYMLINK));
+   {
+      if(!info_checksum)
+	 fi->LocalFile(dir_file(cwd,fi->name),(fi->filetype!=fi->SYMLINK));
+      if(fi->need&fi->CHECKSUM)
+      {
+	 if(!ComputeChecksum(fi))
+	    return false;
+	 fi->NoNeed(fi->CHECKSUM);
+      }
+   }
+   return true;
+}
+
+/* Checksums of local files are remembered in ~/.cache/lftp/checksums,
+ * one line per file: "ALGO size mtime hex path". New lines are appended,
+ * a later line for the same file wins; the file is rewritten on load when
+ * most of its lines are stale. */
+struct CachedChecksum
+{
+   long long size;
+   long long mtime;
+   xstring digest;
+};
+static xmap_p<CachedChecksum> checksum_cache;
+static bool checksum_cache_loaded;
+
+static const char *ChecksumCacheFile()
+{
+   return xstring::format("%s/checksums",get_lftp_cache_dir());
+}
+static const xstring& ChecksumCacheKey(Checksum::algo_t a,const char *path)
+{
+   return xstring::cat(Checksum::Name(a)," ",path,NULL);
+}
+static void FormatCachedChecksum(xstring& buf,const xstring& key,const CachedChecksum *c)
+{
+   const char *path=strchr(key,' ')+1;
+   buf.appendf("%.*s %lld %lld %s %s\n",int(path-key-1),key.get(),c->size,c->mtime,
+      c->digest.hexdump(),url::encode(path," %").get());
+}
+static void LoadChecksumCache()
+{
+   checksum_cache_loaded=true;
+   if(!get_lftp_cache_dir())
+      return;
+   int fd=open(ChecksumCacheFile(),O_RDONLY);
+   if(fd==-1)
+      return;
+   xstring buf;
+   int res;
+   while((res=read(fd,buf.add_space(0x10000),0x10000))>0)
+      buf.add_commit(res);
+   close(fd);
+
+   int lines=0;
+   const char *end=buf.get()+buf.length();
+   for(const char *line=buf.get(); line<end; )
+   {
+      const char *nl=(const char*)memchr(line,'\n',end-line);
+      if(!nl)
+	 break;
+      lines++;
+      char *l=alloca_strdup(xstring::get_tmp(line,nl-line));
+      line=nl+1;
+      char algo[16];
+      long long size,mtime;
+      int n=0;
+      if(sscanf(l,"%15s %lld %lld %n",algo,&size,&mtime,&n)!=3 || n==0)
+	 continue;
+      char *hex=l+n;
+      char *sp=strchr(hex,' ');
+      if(!sp)
+	 continue;
+      *sp++=0;
+      Checksum::algo_t a=Checksum::Find(algo);
+      CachedChecksum *c=new CachedChecksum;
+      c->size=size;
+      c->mtime=mtime;
+      c->digest.set(hex);
+      c->digest.hex_decode();
+      if(a==Checksum::NONE || (int)c->digest.length()!=Checksum::DigestSize(a))
+      {
+	 delete c;
+	 continue;
+      }
+      checksum_cache.add(ChecksumCacheKey(a,url::decode(sp)),c);
+   }
+
+   if(lines<1024 || lines<checksum_cache.count()*2)
+      return;
+   // compact the file.
+   buf.truncate();
+   for(CachedChecksum *c=checksum_cache.each_begin(); c; c=checksum_cache.each_next())
+      FormatCachedChecksum(buf,checksum_cache.each_key(),c);
+   const xstring& tmp=xstring::cat(ChecksumCacheFile(),".tmp",NULL);
+   fd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC,0600);
+   if(fd==-1)
+      return;
+   res=write(fd,buf.get(),buf.length());
+   close(fd);
+   if(res!=(int)buf.length() || rename(tmp,ChecksumCacheFile())==-1)
+      unlink(tmp);
+}
+static const CachedChecksum *FindCachedChecksum(Checksum::algo_t a,const char *path)
+{
+   if(!checksum_cache_loaded)
+      LoadChecksumCache();
+   return checksum_cache.lookup(ChecksumCacheKey(a,path));
+}
+static void AddCachedChecksum(Checksum::algo_t a,const char *path,
+   long long size,long long mtime,const xstring& digest)
+{
+   CachedChecksum *c=new CachedChecksum;
+   c->size=size;
+   c->mtime=mtime;
+   c->digest.set(digest);
+   const xstring& key=ChecksumCacheKey(a,path);
+   xstring line;
+   FormatCachedChecksum(line,key,c);
+   checksum_cache.add(key,c);
+
+   if(!get_lftp_cache_dir())
+      return;
+   int fd=open(ChecksumCacheFile(),O_WRONLY|O_CREAT|O_APPEND,0600);
+   if(fd==-1)
+      return;
+   write(fd,line.get(),line.length());
+   close(fd);
+}
+
+// returns false when the checksum is not complete yet.
+bool LocalAccess::ComputeChecksum(FileInfo *fi)
+{
+   // the cache code uses temporary strings too, so make a copy.
+   const char *path=alloca_strdup(dir_file(cwd,fi->name));
+   if(!info_checksum)
+   {
+      if(!fi->HasAll(fi->TYPE|fi->SIZE|fi->DATE) || fi->filetype!=fi->NORMAL)
+	 return true;
+      // the algorithm may be preset to match the other side.
+      Checksum::algo_t a=fi->checksum_algo;
+      if(a==Checksum::NONE)
+	 a=Checksum::Find(ResMgr::Query("xfer:checksum-type",0));
+      if(a==Checksum::NONE)
+	 return true;
+      bool use_cache=ResMgr::QueryBool("xfer:checksum-cache",0);
+      if(use_cache)
+      {
+	 const CachedChecksum *c=FindCachedChecksum(a,path);
+	 if(c && c->size==fi->size && c->mtime==fi->date)
+	 {
+	    fi->SetChecksum(a,c->digest);
+	    return true;
+	 }
+      }
+      info_checksum_fd=open(path,O_RDONLY);
+      if(info_checksum_fd==-1)
+	 return true;
+      info_checksum=new Checksum(a);
+   }
+   // do not block for long, give other tasks a chance between chunks.
+   const int chunk=0x10000;
+   char *buf=(char*)alloca(chunk);
+   for(int i=0; i<16; i++)
+   {
+      int res=read(info_checksum_fd,buf,chunk);
+      if(res==-1 && (errno==EINTR || errno==EAGAIN))
+	 return false;
+      if(res==-1)
+      {
+	 LogError(0,"read(%s): %s",path,strerror(errno));
+	 CloseChecksum();
+	 return true;
+      }
+      if(res==0)
+      {
+	 const xstring& digest=info_checksum->Finish();
+	 fi->SetChecksum(info_checksum->GetAlgo(),digest);
+	 LogNote(10,"%s checksum of `%s' is %s",info_checksum->GetName(),path,digest.hexdump());
+	 if(ResMgr::QueryBool("xfer:checksum-cache",0))
+	    AddCachedChecksum(info_checksum->GetAlgo(),path,fi->size,fi->date,digest);
+	 CloseChecksum();
+	 return true;
+      }
+      info_checksum->Update(buf,res);
+   }
+   return false;
+}
+void LocalAccess::CloseChecksum()
+{
+   if(info_checksum_fd!=-1)
+      close(info_checksum_fd);
+   info_checksum_fd=-1;
+   info_checksum=0;
 }
 
 int LocalAccess::Read(void *buf,int size)
@@ -500,6 +696,7 @@ void LocalAccess::Close()
    done=false;
    error_code=OK;
    stream=0;
+   CloseChecksum();
    FileAccess::Close();
 }
 
@@ -28,12 +28,19 @@ class LocalAccess : public FileAccess
    Ref<FDStream> stream;
    bool done;
    void errno_handle();
-   void fill_array_info();
+   bool fill_array_info();
+
+   // checksum of the current array info file, computed a chunk at a time.
+   Ref<Checksum> info_checksum;
+   int info_checksum_fd;
+   bool ComputeChecksum(FileInfo *fi);
+   void CloseChecksum();
 
 public:
    void Init();
    LocalAccess();
    LocalAccess(const LocalAccess *);
+   ~LocalAccess() { CloseChecksum(); }
 
    void Connect(const char *host,const char *port) {}
    void AnonymousLogin() {}
@@ -80,7 +80,7 @@ ResDecl res_cache_expire("cache:expire","60m",ResMgr::TimeIntervalValidate,0);
 ResDecl res_cache_expire_neg("cache:expire-negative","1m",ResMgr::TimeIntervalValidate,0);
 ResDecl res_cache_size  ("cache:size","16M",ResMgr::UNumberValidate,ResMgr::NoClosure);
 
-LsCache::LsCache() : Cache(&res_cache_size,&res_cache_enable) {}
+LsCache::LsCache() : Cache("ls",&res_cache_size,&res_cache_enable) {}
 
 void LsCache::Add(const FileAccess *p_loc,const char *a,int m,int e,const char *d,int l,const FileSet *fs)
 {
@@ -146,8 +146,11 @@ LsCacheEntry *LsCache::Find(const FileAccess *p_loc,const char *a,int m)
 bool LsCache::Find(const FileAccess *p_loc,const char *a,int m,int *e,const char **d,int *l,const FileSet **fs)
 {
    LsCacheEntry *c=Find(p_loc,a,m);
-   if(!c)
+   if(!c) {
+      CountMiss();
       return false;
+   }
+   CountHit();
    c->GetData(e,d,l,fs);
    return true;
 }
@@ -155,8 +158,11 @@ bool LsCache::Find(const FileAccess *p_loc,const char *a,int m,int *e,const char
 const FileSet *LsCache::FindFileSet(const FileAccess *p_loc,const char *a,int m)
 {
    LsCacheEntry *c=Find(p_loc,a,m);
-   if(!c)
+   if(!c) {
+      CountMiss();
       return 0;
+   }
+   CountHit();
    return c->GetFileSet(c->loc);
 }
 const FileSet *LsCacheEntryData::GetFileSet(const FileAccess *parser)
@@ -0,0 +1,110 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2013 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include "Metrics.h"
+#include "SMTask.h"
+#include "Cache.h"
+#include "misc.h"
+
+MetricsSource *MetricsSource::chain;
+
+MetricsSource::MetricsSource()
+{
+   ListAdd(MetricsSource,chain,this,next);
+}
+MetricsSource::~MetricsSource()
+{
+   ListDel(MetricsSource,chain,this,next);
+}
+
+void MetricsSource::Declare(xstring& buf,const char *name,const char *type,const char *help)
+{
+   buf.appendf("# HELP %s %s\n# TYPE %s %s\n",name,help,name,type);
+}
+void MetricsSource::Value(xstring& buf,const char *name,const char *labels,long long v)
+{
+   if(labels && *labels)
+      buf.appendf("%s{%s} %lld\n",name,labels,v);
+   else
+      buf.appendf("%s %lld\n",name,v);
+}
+void MetricsSource::Value(xstring& buf,const char *name,const char *labels,double v)
+{
+   if(labels && *labels)
+      buf.appendf("%s{%s} %.6f\n",name,labels,v);
+   else
+      buf.appendf("%s %.6f\n",name,v);
+}
+const xstring& MetricsSource::Label(const char *name,const char *value)
+{
+   xstring& buf=xstring::get_tmp(name);
+   buf.append("=\"");
+   for(const char *s=value; s && *s; s++) {
+      switch(*s) {
+      case '\\': buf.append("\\\\"); break;
+      case '"':  buf.append("\\\""); break;
+      case '\n': buf.append("\\n");  break;
+      default:   buf.append(*s);
+      }
+   }
+   buf.append('"');
+   return buf;
+}
+
+xstring& MetricsSource::FormatAll(xstring& buf)
+{
+   ListScan(MetricsSource,chain,next)
+      scan->FormatMetrics(buf);
+   return buf;
+}
+
+// the scheduler and the caches live in this library, report them here.
+class TaskMetrics : public MetricsSource
+{
+public:
+   void FormatMetrics(xstring& buf);
+};
+void TaskMetrics::FormatMetrics(xstring& buf)
+{
+   Declare(buf,"lftp_tasks","gauge","Number of tasks.");
+   Value(buf,"lftp_tasks",(long long)SMTask::TaskCount());
+   Declare(buf,"lftp_tasks_ready","gauge","Number of tasks in the ready list.");
+   Value(buf,"lftp_tasks_ready",(long long)SMTask::ReadyTaskCount());
+   Declare(buf,"lftp_schedule_iterations_total","counter","Number of scheduler loop passes.");
+   Value(buf,"lftp_schedule_iterations_total",(long long)SMTask::ScheduleCount());
+   Declare(buf,"lftp_schedule_seconds_total","counter","Time spent running tasks in the scheduler loop.");
+   Value(buf,"lftp_schedule_seconds_total",SMTask::ScheduleTimeTotal());
+   Declare(buf,"lftp_schedule_last_seconds","gauge","Duration of the last scheduler loop pass.");
+   Value(buf,"lftp_schedule_last_seconds",SMTask::ScheduleTimeLast());
+
+   Declare(buf,"lftp_cache_hits_total","counter","Cache lookups that found an entry.");
+   for(Cache *c=Cache::FirstCache(); c; c=c->NextCache())
+      Value(buf,"lftp_cache_hits_total",Label("cache",c->GetName()),(long long)c->GetHits());
+   Declare(buf,"lftp_cache_misses_total","counter","Cache lookups that found no entry.");
+   for(Cache *c=Cache::FirstCache(); c; c=c->NextCache())
+      Value(buf,"lftp_cache_misses_total",Label("cache",c->GetName()),(long long)c->GetMisses());
+   Declare(buf,"lftp_cache_entries","gauge","Number of entries in the cache.");
+   for(Cache *c=Cache::FirstCache(); c; c=c->NextCache())
+      Value(buf,"lftp_cache_entries",Label("cache",c->GetName()),(long long)c->EntryCount());
+   Declare(buf,"lftp_cache_bytes","gauge","Estimated memory used by the cache.");
+   for(Cache *c=Cache::FirstCache(); c; c=c->NextCache())
+      Value(buf,"lftp_cache_bytes",Label("cache",c->GetName()),(long long)c->EstimateSize());
+}
+static TaskMetrics task_metrics;
@@ -0,0 +1,50 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2013 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "xstring.h"
+
+// A provider of live counters and gauges. All instances are chained and
+// scanned by FormatAll, which produces Prometheus text exposition format.
+class MetricsSource
+{
+   MetricsSource *next;
+   static MetricsSource *chain;
+
+protected:
+   static void Declare(xstring& buf,const char *name,const char *type,const char *help);
+   static void Value(xstring& buf,const char *name,const char *labels,long long v);
+   static void Value(xstring& buf,const char *name,const char *labels,double v);
+   static void Value(xstring& buf,const char *name,long long v) { Value(buf,name,0,v); }
+   static void Value(xstring& buf,const char *name,double v) { Value(buf,name,0,v); }
+   // returns a tmp string with a properly escaped label pair
+   static const xstring& Label(const char *name,const char *value);
+
+public:
+   virtual void FormatMetrics(xstring& buf)=0;
+
+   MetricsSource();
+   virtual ~MetricsSource();
+
+   static xstring& FormatAll(xstring& buf);
+};
+
+#endif//METRICS_H
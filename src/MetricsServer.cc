@@ -0,0 +1,289 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2013 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/un.h>
+#if HAVE_SYS_SOCKET_H
+# include <sys/socket.h>
+#endif
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "MetricsServer.h"
+#include "Metrics.h"
+#include "log.h"
+#include "misc.h"
+
+#ifndef SUN_LEN
+#define SUN_LEN(su) (sizeof(*(su)) - sizeof((su)->sun_path) + strlen((su)->sun_path))
+#endif
+
+MetricsServer::Client::~Client()
+{
+   if(fd!=-1)
+      close(fd);
+}
+
+MetricsServer::MetricsServer()
+   : sock(-1), unix_socket(false), retry_timer(1)
+{
+   Reconfig(0);
+}
+MetricsServer::~MetricsServer()
+{
+   Close();
+}
+
+void MetricsServer::Reconfig(const char *name)
+{
+   if(name && strcmp(name,"metrics:listen"))
+      return;
+   const char *addr=ResMgr::Query("metrics:listen",0);
+   if(!xstrcmp(addr,listening) || (!*addr && !listening))
+      return;
+   Close();
+   if(*addr)
+      Listen(addr);
+}
+
+void MetricsServer::Close()
+{
+   clients.unset();
+   if(sock!=-1)
+   {
+      close(sock);
+      sock=-1;
+      if(unix_socket)
+	 unlink(listening);
+   }
+   listening.set(0);
+}
+
+void MetricsServer::Listen(const char *addr)
+{
+   listening.set(addr);
+   unix_socket=(addr[0]=='/');
+
+   union {
+      struct sockaddr sa;
+      struct sockaddr_un un;
+      struct sockaddr_in in;
+#if INET6
+      struct sockaddr_in6 in6;
+#endif
+   } u;
+   memset(&u,0,sizeof(u));
+   socklen_t len=0;
+
+   if(unix_socket)
+   {
+      if(strlen(addr)>=sizeof(u.un.sun_path))
+      {
+	 Log::global->Format(0,"metrics: socket path is too long: %s\n",addr);
+	 return;
+      }
+      u.un.sun_family=AF_UNIX;
+      strcpy(u.un.sun_path,addr);
+      len=SUN_LEN(&u.un);
+   }
+   else
+   {
+      // [host:]port, the host defaults to the loopback address.
+      const char *host="127.0.0.1";
+      const char *port=addr;
+      const char *colon=strrchr(addr,':');
+      if(colon)
+      {
+	 char *h=alloca_strdup(addr);
+	 h[colon-addr]=0;
+	 if(h[0]=='[' && last_char(h)==']')
+	 {
+	    h[strlen(h)-1]=0;
+	    h++;
+	 }
+	 host=h;
+	 port=colon+1;
+      }
+      int port_num=atoi(port);
+      if(port_num<=0 || port_num>65535)
+      {
+	 Log::global->Format(0,"metrics: invalid port in %s\n",addr);
+	 return;
+      }
+      if(inet_pton(AF_INET,host,&u.in.sin_addr)==1)
+      {
+	 u.in.sin_family=AF_INET;
+	 u.in.sin_port=htons(port_num);
+	 len=sizeof(u.in);
+      }
+#if INET6
+      else if(inet_pton(AF_INET6,host,&u.in6.sin6_addr)==1)
+      {
+	 u.in6.sin6_family=AF_INET6;
+	 u.in6.sin6_port=htons(port_num);
+	 len=sizeof(u.in6);
+      }
+#endif
+      else
+      {
+	 Log::global->Format(0,"metrics: invalid address %s\n",host);
+	 return;
+      }
+   }
+
+   sock=socket(u.sa.sa_family,SOCK_STREAM,0);
+   if(sock==-1)
+   {
+      Log::global->Format(0,"metrics: socket: %s\n",strerror(errno));
+      return;
+   }
+   int fl=fcntl(sock,F_GETFL);
+   fcntl(sock,F_SETFL,fl|O_NONBLOCK);
+   fcntl(sock,F_SETFD,FD_CLOEXEC);
+   if(unix_socket)
+      unlink(addr);
+   else
+   {
+      int on=1;
+      setsockopt(sock,SOL_SOCKET,SO_REUSEADDR,(char*)&on,sizeof(on));
+   }
+   if(bind(sock,&u.sa,len)==-1 || listen(sock,5)==-1)
+   {
+      Log::global->Format(0,"metrics: bind(%s): %s\n",addr,strerror(errno));
+      close(sock);
+      sock=-1;
+      return;
+   }
+   Log::global->Format(4,"metrics: listening on %s\n",addr);
+}
+
+void MetricsServer::MakeReply(Client *c)
+{
+   const char *status="200 OK";
+   xstring body;
+   char method[16],path[256];
+   method[0]=0;
+   if(sscanf(c->request,"%15s %255s",method,path)!=2
+   || (strcmp(method,"GET") && strcmp(method,"HEAD")))
+   {
+      status="400 Bad Request";
+      body.set("bad request\n");
+   }
+   else if(strcmp(path,"/") && strcmp(path,"/metrics"))
+   {
+      status="404 Not Found";
+      body.set("not found\n");
+   }
+   else
+      MetricsSource::FormatAll(body);
+
+   c->reply.setf("HTTP/1.0 %s\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: %u\r\n"
+      "Connection: close\r\n\r\n",status,(unsigned)body.length());
+   if(strcmp(method,"HEAD"))
+      c->reply.append(body);
+   c->replying=true;
+}
+
+// returns true when the client is done and can be removed.
+int MetricsServer::HandleClient(Client *c)
+{
+   if(!c->replying)
+   {
+      char buf[1024];
+      int res=read(c->fd,buf,sizeof(buf));
+      if(res==-1 && E_RETRY(errno))
+      {
+	 Block(c->fd,POLLIN);
+	 return c->timeout.Stopped();
+      }
+      if(res<=0)
+	 return true;
+      c->request.append(buf,res);
+      if(!strstr(c->request,"\r\n\r\n") && !strstr(c->request,"\n\n"))
+      {
+	 if(c->request.length()>16*1024)
+	    return true;
+	 Block(c->fd,POLLIN);
+	 return c->timeout.Stopped();
+      }
+      MakeReply(c);
+   }
+   while(c->reply.length()>0)
+   {
+      int res=write(c->fd,c->reply,c->reply.length());
+      if(res==-1 && E_RETRY(errno))
+      {
+	 Block(c->fd,POLLOUT);
+	 return c->timeout.Stopped();
+      }
+      if(res<=0)
+	 return true;
+      c->reply.set_substr(0,res,"",0);
+   }
+   return true;
+}
+
+int MetricsServer::Do()
+{
+   int m=STALL;
+   if(sock==-1)
+   {
+      // retry failed binds from time to time
+      if(listening && retry_timer.Stopped())
+      {
+	 xstring_c addr(listening.get());
+	 Listen(addr);
+	 retry_timer.Reset();
+      }
+      if(sock==-1)
+	 return m;
+   }
+   for(;;)
+   {
+      int fd=accept(sock,0,0);
+      if(fd==-1)
+      {
+	 if(!E_RETRY(errno))
+	    Log::global->Format(4,"metrics: accept: %s\n",strerror(errno));
+	 break;
+      }
+      int fl=fcntl(fd,F_GETFL);
+      fcntl(fd,F_SETFL,fl|O_NONBLOCK);
+      fcntl(fd,F_SETFD,FD_CLOEXEC);
+      clients.append(new Client(fd));
+      m=MOVED;
+   }
+   Block(sock,POLLIN);
+   for(int i=0; i<clients.count(); i++)
+   {
+      if(HandleClient(clients[i]))
+      {
+	 clients.remove(i--);
+	 m=MOVED;
+      }
+   }
+   return m;
+}
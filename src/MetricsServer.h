@@ -0,0 +1,63 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2013 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include "SMTask.h"
+#include "ResMgr.h"
+#include "Timer.h"
+#include "xarray.h"
+
+// Serves MetricsSource::FormatAll output over HTTP on a unix socket
+// or a local TCP port, as configured by metrics:listen.
+class MetricsServer : public SMTask, public ResClient
+{
+   class Client
+   {
+   public:
+      int fd;
+      xstring request;
+      xstring reply;
+      bool replying;
+      Timer timeout;
+      Client(int f) : fd(f), replying(false), timeout(30) {}
+      ~Client();
+   };
+
+   int sock;
+   xstring_c listening;	// the address we are listening on
+   bool unix_socket;
+   Timer retry_timer;
+   xarray_p<Client> clients;
+
+   void Listen(const char *addr);
+   void Close();
+   int HandleClient(Client *c);
+   void MakeReply(Client *c);
+
+public:
+   MetricsServer();
+   ~MetricsServer();
+   int Do();
+   void Reconfig(const char *name);
+   const char *GetLogContext() { return "metrics"; }
+};
+
+#endif//METRICSSERVER_H
@@ -72,6 +72,15 @@ xstring& MirrorJob::FormatStatus(xstring& s,int v,const char *tab)
 	 s.appendf("\tcd `%s' [%s]\n",source_dir.get(),source_session->CurrentStatus());
       break;
 
+   case(GETTING_CHECKSUMS):
+      for(int i=0; i<checksum_requests.count(); i++)
+      {
+	 const FileAccessRef& session=checksum_requests[i]->session;
+	 s.appendf("\t%s: %s [%s]\n",_("Getting checksums"),session->GetHostName(),
+	    session->CurrentStatus());
+      }
+      break;
+
    case(GETTING_LIST_INFO):
       if(target_list_info)
       {
@@ -149,6 +158,15 @@ void  MirrorJob::ShowRunStatus(const SMTaskRef<StatusLine>& s)
 	 s->Show("cd `%s' [%s]",source_dir.get(),source_session->CurrentStatus());
       break;
 
+   case(GETTING_CHECKSUMS):
+      if(checksum_requests.count()>0)
+      {
+	 const FileAccessRef& session=checksum_requests[0]->session;
+	 s->Show("%s: %s [%s]",_("Getting checksums"),session->GetHostName(),
+	    session->CurrentStatus());
+      }
+      break;
+
    case(GETTING_LIST_INFO):
       if(target_list_info && (!source_list_info || now%4>=2))
       {
@@ -178,6 +196,27 @@ void  MirrorJob::ShowRunStatus(const SMTaskRef<StatusLine>& s)
    }
 }
 
+// pget can also split FXP copies between two FTP sites, when the target
+// reports transfer position (see FileCopyFtp::CanSegmentFXP). STAT is not
+// used over TLS, so ftps sites are excluded.
+static bool CanSegmentFXP(const FileAccess *s)
+{
+   const char *h=s->GetHostName();
+   if(strcmp(s->GetProto(),"ftp")
+   || !ResMgr::QueryBool("ftp:use-fxp",h) || !ResMgr::QueryBool("ftp:use-stat",h))
+      return false;
+#if USE_SSL
+   if(ResMgr::QueryBool("ftp:ssl-protect-fxp",h))
+      return false;
+#endif
+   return true;
+}
+bool MirrorJob::CanSegmentFXP()
+{
+   return !source_is_local && !target_is_local
+      && ::CanSegmentFXP(source_session) && ::CanSegmentFXP(target_session);
+}
+
 void  MirrorJob::HandleFile(FileInfo *file)
 {
    int	 res;
@@ -206,7 +245,7 @@ void  MirrorJob::HandleFile(FileInfo *file)
       {
 	 bool remove_target=false;
 	 bool cont_this=false;
-	 bool use_pget=(pget_n>1) && target_is_local;
+	 bool use_pget=(pget_n>1) && (target_is_local || CanSegmentFXP());
 	 if((file->defined&file->SIZE) && file->size<pget_minchunk*2)
 	    use_pget=false;
 	 if(target_is_local)
@@ -264,6 +303,11 @@ void  MirrorJob::HandleFile(FileInfo *file)
 	 else
 	    stats.new_files++;
 
+	 // a continued FXP copy cannot be split, the chunks would not know
+	 // which part of the target is already there.
+	 if(cont_this && !target_is_local)
+	    use_pget=false;
+
 	 Report(_("Transferring file `%s'"),
 		  dir_file(source_relative_dir,file->name));
 
@@ -631,6 +675,8 @@ void MirrorJob::HandleListInfoCreation(const FileAccessRef& session,Ref<ListInfo
    list_info->Need(need);
    if(flags&RETR_SYMLINKS)
       list_info->FollowSymlinks();
+   if(!(flags&NO_RECURSION))
+      list_info->Recursive();
 
    list_info->SetExclude(relative_dir,exclude);
    list_info->Roll();
@@ -657,6 +703,103 @@ void MirrorJob::HandleListInfo(Ref<ListInfo>& list_info, Ref<FileSet>& set)
    set->ExcludeDots(); // don't need .. and .
 }
 
+void MirrorJob::StartChecksums(bool local)
+{
+   checksum_local_pass=local;
+   if(source_is_local==local)
+      AddChecksumRequests(source_session,source_set.get_non_const(),target_set,local);
+   if(target_is_local==local)
+      AddChecksumRequests(target_session,target_set.get_non_const(),source_set,local);
+}
+
+void MirrorJob::AddChecksumRequests(const FileAccessRef& session,FileSet *set,
+   const FileSet *other,bool local)
+{
+   bool other_is_local=(other==target_set?target_is_local:source_is_local);
+   RefArray<FileInfo> want;
+   for(int i=0; i<set->count(); i++)
+   {
+      const FileInfo *fi=(*set)[i];
+      const FileInfo *ofi=other->FindByName(fi->name);
+      if(!ofi || fi->Has(fi->CHECKSUM))
+	 continue;
+      if(!(fi->Has(fi->TYPE) && fi->filetype==fi->NORMAL
+	   && ofi->Has(ofi->TYPE) && ofi->filetype==ofi->NORMAL))
+	 continue;
+      if(fi->Has(fi->SIZE) && ofi->Has(ofi->SIZE) && fi->size!=ofi->size
+      && !(flags&IGNORE_SIZE))
+	 continue;   // they differ anyway
+      FileInfo *w=new FileInfo(fi->name);
+      if(local)
+      {
+	 // compute the same kind of checksum as the other side has.
+	 if(ofi->Has(ofi->CHECKSUM))
+	    w->checksum_algo=ofi->checksum_algo;
+	 else if(!other_is_local)
+	 {
+	    delete w;
+	    continue;
+	 }
+      }
+      w->Need(w->CHECKSUM);
+      want.append(w);
+   }
+   if(want.count()==0)
+      return;
+
+   // local checksums are computed synchronously, a session per side is enough.
+   int n=(local?1:parallel);
+   if(n<1)
+      n=1;
+   if(n>want.count())
+      n=want.count();
+   int per_session=(want.count()+n-1)/n;
+   for(int i=0; i<want.count(); i+=per_session)
+   {
+      ChecksumRequest *r=new ChecksumRequest;
+      r->set=new FileSet;
+      for(int j=i; j<i+per_session && j<want.count(); j++)
+	 r->set->Add(want[j].borrow());
+      r->result=set;
+      r->session=session->Clone();
+      r->session->GetInfoArray(r->set.get_non_const());
+      checksum_requests.append(r);
+   }
+}
+
+int MirrorJob::HandleChecksums()
+{
+   int m=STALL;
+   for(int i=0; i<checksum_requests.count(); i++)
+   {
+      ChecksumRequest *r=checksum_requests[i].get_non_const();
+      int res=r->session->Done();
+      if(res==FA::IN_PROGRESS)
+	 continue;
+      if(res<0)
+      {
+	 // fall back to comparing size and time.
+	 Log::global->Format(3,"mirror: cannot get checksums: %s\n",r->session->StrError(res));
+      }
+      else
+      {
+	 for(int j=0; j<r->set->count(); j++)
+	 {
+	    const FileInfo *fi=(*r->set)[j];
+	    if(!fi->Has(fi->CHECKSUM))
+	       continue;
+	    FileInfo *t=r->result->FindByName(fi->name);
+	    if(t)
+	       t->SetChecksum(fi->checksum_algo,fi->checksum);
+	 }
+      }
+      r->session->Close();
+      checksum_requests.remove(i--);
+      m=MOVED;
+   }
+   return m;
+}
+
 int   MirrorJob::Do()
 {
    int	 res;
@@ -786,6 +929,14 @@ int   MirrorJob::Do()
       if(source_list_info || target_list_info)
 	 return m;
 
+      if(FlagSet(COMPARE_CHECKSUM) && source_set && target_set)
+      {
+	 set_state(GETTING_CHECKSUMS);
+	 StartChecksums(false);
+	 return MOVED;
+      }
+
+   got_file_sets:
       transfer_count-=root_transfer_count; // leave room for transfers.
 
       if(FlagSet(DEPTH_FIRST) && source_set && !target_set)
@@ -807,6 +958,17 @@ int   MirrorJob::Do()
       set_state(TARGET_REMOVE_OLD_FIRST);
       goto TARGET_REMOVE_OLD_FIRST_label;
 
+   case(GETTING_CHECKSUMS):
+      m=HandleChecksums();
+      if(checksum_requests.count()>0)
+	 return m;
+      if(!checksum_local_pass)
+      {
+	 StartChecksums(true);
+	 return MOVED;
+      }
+      goto got_file_sets;
+
    pre_WAITING_FOR_TRANSFER:
       to_transfer->rewind();
       set_state(WAITING_FOR_TRANSFER);
@@ -1133,6 +1295,7 @@ MirrorJob::MirrorJob(MirrorJob *parent,
    skip_noaccess=false;
 
    parallel=1;
+   checksum_local_pass=false;
    pget_n=1;
    pget_minchunk=0x10000;
 
@@ -1342,6 +1505,7 @@ CMD(mirror)
       OPT_NO_EMPTY_DIRS,
       OPT_DEPTH_FIRST,
       OPT_ASCII,
+      OPT_COMPARE,
    };
    static const struct option mirror_opts[]=
    {
@@ -1386,6 +1550,7 @@ CMD(mirror)
       {"no-empty-dirs",no_argument,0,OPT_NO_EMPTY_DIRS},
       {"depth-first",no_argument,0,OPT_DEPTH_FIRST},
       {"ascii",no_argument,0,OPT_ASCII},
+      {"compare",required_argument,0,OPT_COMPARE},
       {0}
    };
 
@@ -1597,6 +1762,18 @@ CMD(mirror)
       case(OPT_ASCII):
 	 flags|=MirrorJob::ASCII|MirrorJob::IGNORE_SIZE;
 	 break;
+      case(OPT_COMPARE):
+	 if(!strcasecmp(optarg,"checksum"))
+	    flags|=MirrorJob::COMPARE_CHECKSUM;
+	 else if(!strcasecmp(optarg,"size-time"))
+	    flags&=~MirrorJob::COMPARE_CHECKSUM;
+	 else
+	 {
+	    eprintf(_("%s: --compare: `%s' is not one of size-time, checksum\n"),
+	       args->a0(),optarg);
+	    goto no_job;
+	 }
+	 break;
       case('?'):
 	 eprintf(_("Try `help %s' for more information.\n"),args->a0());
       no_job:
@@ -34,6 +34,7 @@ class MirrorJob : public Job
       CHANGING_DIR_SOURCE,
       CHANGING_DIR_TARGET,
       GETTING_LIST_INFO,
+      GETTING_CHECKSUMS,
       WAITING_FOR_TRANSFER,
       TARGET_REMOVE_OLD,
       TARGET_REMOVE_OLD_FIRST,
@@ -60,6 +61,7 @@ class MirrorJob : public Job
    void	 InitSets(const FileSet *src,const FileSet *dst);
 
    void	 HandleFile(FileInfo *);
+   bool	 CanSegmentFXP();
 
    bool create_target_dir;
    bool	no_target_dir;	   // target directory does not exist (for script_only)
@@ -132,6 +134,21 @@ class MirrorJob : public Job
 	    const char *relative_dir);
    void HandleListInfo(Ref<ListInfo>& list_info,Ref<FileSet>& set);
 
+   // --compare=checksum: checksums of files that may be equal are requested
+   // from remote sides first, split among parallel sessions, then computed
+   // for local sides with the same algorithms.
+   struct ChecksumRequest
+   {
+      FileAccessRef session;
+      Ref<FileSet> set;
+      FileSet *result;
+   };
+   RefArray<ChecksumRequest> checksum_requests;
+   bool checksum_local_pass;
+   void StartChecksums(bool local);
+   void AddChecksumRequests(const FileAccessRef& session,FileSet *set,const FileSet *other,bool local);
+   int HandleChecksums();
+
 public:
    enum
    {
@@ -154,6 +171,7 @@ public:
       NO_EMPTY_DIRS=1<<16,
       DEPTH_FIRST=1<<17,
       ASCII=1<<18,
+      COMPARE_CHECKSUM=1<<19,
    };
 
    void SetFlags(int f,bool v)
@@ -30,6 +30,8 @@
 #include "LsCache.h"
 #include "misc.h"
 #include "Speedometer.h"
+#include "Metrics.h"
+#include "xmap.h"
 
 #define super FileAccess
 
@@ -55,6 +57,8 @@ void NetAccess::Init()
    connection_limit=0;	// no limit.
    connection_takeover=false;
 
+   connect_timing=false;
+
    Reconfig(0);
    reconnect_interval_current=reconnect_interval;
 }
@@ -160,6 +164,82 @@ void NetAccess::SayConnectingTo()
    const char *h=(proxy?proxy:hostname);
    LogNote(1,_("Connecting to %s%s (%s) port %u"),proxy?"proxy ":"",
       h,SocketNumericAddress(&peer[peer_curr]),SocketPort(&peer[peer_curr]));
+   if(TraceRing::enabled)
+      Trace(TraceRing::CONNECT,xstring::format("%s (%s) port %u",h,
+	 SocketNumericAddress(&peer[peer_curr]),SocketPort(&peer[peer_curr])));
+   ConnectTimingStart();
+}
+
+class ConnectMetrics : public MetricsSource
+{
+public:
+   struct stats
+   {
+      unsigned connect_count;
+      double connect_sum;
+      unsigned ready_count;
+      double ready_sum;
+      double ready_last;
+   };
+private:
+   xmap<stats> site_stats;
+public:
+   stats& Get(const xstring& site) {
+      if(!site_stats.exists(site)) {
+	 stats zero={0,0,0,0,0};
+	 site_stats.add(site,zero);
+      }
+      return site_stats.lookup_Lv(site);
+   }
+   void FormatMetrics(xstring& buf);
+};
+void ConnectMetrics::FormatMetrics(xstring& buf)
+{
+   Declare(buf,"lftp_session_connect_seconds","summary",
+      "Time from connection start to established transport connection.");
+   for(const stats *s=&site_stats.each_begin(); !site_stats.each_finished(); s=&site_stats.each_next()) {
+      const xstring& labels=Label("site",site_stats.each_key());
+      Value(buf,"lftp_session_connect_seconds_sum",labels,s->connect_sum);
+      Value(buf,"lftp_session_connect_seconds_count",labels,(long long)s->connect_count);
+   }
+   Declare(buf,"lftp_session_handshake_seconds","summary",
+      "Time from connection start to completed handshake or login.");
+   for(const stats *s=&site_stats.each_begin(); !site_stats.each_finished(); s=&site_stats.each_next()) {
+      const xstring& labels=Label("site",site_stats.each_key());
+      Value(buf,"lftp_session_handshake_seconds_sum",labels,s->ready_sum);
+      Value(buf,"lftp_session_handshake_seconds_count",labels,(long long)s->ready_count);
+   }
+   Declare(buf,"lftp_session_handshake_last_seconds","gauge",
+      "Handshake time of the last connection to the site.");
+   for(const stats *s=&site_stats.each_begin(); !site_stats.each_finished(); s=&site_stats.each_next())
+      Value(buf,"lftp_session_handshake_last_seconds",Label("site",site_stats.each_key()),s->ready_last);
+}
+static ConnectMetrics connect_metrics;
+
+void NetAccess::ConnectTimingStart()
+{
+   connect_start=SMTask::now;
+   connect_timing=true;
+}
+void NetAccess::ConnectTimingConnected()
+{
+   if(!connect_timing)
+      return;
+   double t=TimeDiff(SMTask::now,connect_start);
+   ConnectMetrics::stats& s=connect_metrics.Get(xstring::cat(GetProto(),"://",hostname.get(),NULL));
+   s.connect_count++;
+   s.connect_sum+=t;
+}
+void NetAccess::ConnectTimingReady()
+{
+   if(!connect_timing)
+      return;
+   connect_timing=false;
+   double t=TimeDiff(SMTask::now,connect_start);
+   ConnectMetrics::stats& s=connect_metrics.Get(xstring::cat(GetProto(),"://",hostname.get(),NULL));
+   s.ready_count++;
+   s.ready_sum+=t;
+   s.ready_last=t;
 }
 
 void NetAccess::SetProxy(const char *px)
@@ -446,7 +526,13 @@ do_again:
       }
       else
       {
-	 session->Open("",mode);
+	 set=TakePrefetched();
+	 if(set)
+	 {
+	    old_mode=mode;
+	    goto got_fileset;
+	 }
+	 OpenSession();
 	 session->UseCache(use_cache);
 	 ubuf=new IOBufferFileAccess(session);
 	 ubuf->SetSpeedometer(new Speedometer());
@@ -76,6 +76,13 @@ protected:
 
    void SayConnectingTo();
 
+   // connection latency accounting, exported through Metrics.
+   Time connect_start;
+   bool connect_timing;
+   void ConnectTimingStart();
+   void ConnectTimingConnected();  // transport connection is established
+   void ConnectTimingReady();	   // handshake or login is complete
+
    void SetProxy(const char *);
    static bool NoProxy(const char *);
 
@@ -119,6 +126,11 @@ protected:
 
    virtual FileSet *Parse(const char *buf,int len)
       { return session->ParseLongList(buf,len); }
+   // starts the listing request; subclasses may tune the session.
+   virtual void OpenSession() { session->Open("",mode); }
+   // a listing already obtained by other means, e.g. as a part of
+   // a recursive listing of a parent directory.
+   virtual FileSet *TakePrefetched() { return 0; }
 
 public:
    GenericParseListInfo(FileAccess *session,const char *path);
@@ -21,6 +21,12 @@
 #include "log.h"
 #include "ProtoLog.h"
 
+unsigned ProtoLog::trace_session_count;
+
+bool ProtoLog::WillLog(int level)
+{
+   return Log::global->MayOutput(level);
+}
 void  ProtoLog::Log2(int level,xstring& str)
 {
    str.chomp('\n');
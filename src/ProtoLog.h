@@ -20,9 +20,31 @@
 #ifndef PROTOLOG_H
 #define PROTOLOG_H
 
+#include "TraceRing.h"
+
 class ProtoLog
 {
+   unsigned trace_session;
+   static unsigned trace_session_count;
+
+protected:
+   ProtoLog() : trace_session(++trace_session_count) {}
+   unsigned GetTraceSession() const { return trace_session; }
+
+   void Trace(TraceRing::event_t e,const char *s,int len=-1) const
+      {
+	 if(TraceRing::enabled)
+	    TraceRing::AddText(trace_session,e,s,len);
+      }
+   void TracePacket(TraceRing::event_t e,const char *name,int nargs,
+		    unsigned a0=0,unsigned a1=0,unsigned a2=0) const
+      {
+	 if(TraceRing::enabled)
+	    TraceRing::AddPacket(trace_session,e,name,nargs,a0,a1,a2);
+      }
+
 public:
+   static bool WillLog(int level);
    static void Log2(int level,xstring& str);
    static void Log3(int level,const char *prefix,const char *str);
    static void LogError(int level,const char *fmt,...) PRINTF_LIKE(2,3);
@@ -28,13 +28,22 @@
 #include "QueueFeeder.h"
 #include "plural.h"
 #include "misc.h"
+#include "url.h"
+#include "ResMgr.h"
+#include "Speedometer.h"
 
 const char *QueueFeeder::NextCmd(CmdExec *exec, const char *)
 {
+   CheckRunning();
+
    if(jobs == NULL) return NULL;
 
-   /* denext the first job */
-   QueueJob *job = grab_job(0);
+   /* denext the best job we are allowed to start */
+   QueueJob *job = pick_job();
+   if(!job)
+      return "";  // all hosts are busy, wait for a running job to finish
+   unlink_job(job);
+   last_host.set(job->host);
 
    buffer.truncate(0);
 
@@ -53,21 +62,138 @@ const char *QueueFeeder::NextCmd(CmdExec *exec, const char *)
    return buffer;
 }
 
-void QueueFeeder::QueueCmd(const char *cmd, const char *pwd, const char *lpwd, int pos, int v)
+void QueueFeeder::QueueCmd(const char *cmd, const char *pwd, const char *lpwd, int pos, int v,
+			   int priority, time_t deadline)
 {
    QueueJob *job = new QueueJob;
    job->cmd.set(cmd);
    job->pwd.set(pwd);
    job->lpwd.set(lpwd);
+   job->priority = priority;
+   job->deadline = deadline;
 
    /* we never want a newline at the end: */
    if(last_char(job->cmd) == '\n')
       job->cmd.truncate(strlen(job->cmd)-1);
 
+   const char *host = CmdHost(job->cmd);
+   job->host.set(host ? host : site.get());
+
    insert_jobs(job, jobs, lastjob, pos != -1? get_job(pos): NULL);
    PrintJobs(job, v, _("Added job$|s$"));
 }
 
+/* proto://host[:port] of the url, or NULL if it has no host */
+const char *QueueFeeder::HostKey(const char *url)
+{
+   if(!url)
+      return 0;
+   ParsedURL u(url,true);
+   if(!u.proto || !u.host)
+      return 0;
+   xstring& key = xstring::get_tmp(u.proto).append("://").append(u.host);
+   if(u.port)
+      key.append(':').append(u.port);
+   return key;
+}
+
+/* the first URL in the command tells which host it is for */
+const char *QueueFeeder::CmdHost(const char *cmd) const
+{
+   const char *sep = " \t\"'";
+   for(const char *w = cmd; *w; )
+   {
+      w += strspn(w, sep);
+      int len = strcspn(w, sep);
+      if(len == 0)
+	 break;
+      if(memchr(w, ':', len)) {
+	 const char *key = HostKey(xstring::get_tmp(w, len));
+	 if(key)
+	    return key;
+      }
+      w += len;
+   }
+   return 0;
+}
+
+bool QueueFeeder::HostBlocked(const char *host) const
+{
+   if(!host)
+      return false;
+   const HostStats *h = hosts.lookup(host);
+   if(!h || h->running == 0)
+      return false;
+   ParsedURL u(host,true);
+   int limit = ResMgr::Query("cmd:queue-host-parallel", u.host);
+   return limit > 0 && h->running >= limit;
+}
+
+/* Of the jobs whose host has a free slot, take the one with the highest
+ * priority, then the earliest deadline, then the first in the queue. */
+QueueFeeder::QueueJob *QueueFeeder::pick_job()
+{
+   QueueJob *best = 0;
+   for(QueueJob *j = jobs; j; j = j->next)
+   {
+      if(HostBlocked(j->host))
+	 continue;
+      if(!best || j->priority > best->priority
+      || (j->priority == best->priority && j->deadline
+	  && (!best->deadline || j->deadline < best->deadline)))
+	 best = j;
+   }
+   return best;
+}
+
+void QueueFeeder::JobStarted(Job *j)
+{
+   if(!last_host)
+      return;
+   HostStats *h = hosts.lookup(last_host);
+   if(!h) {
+      h = new HostStats;
+      hosts.add(last_host, h);
+      host_list.Append(last_host);
+   }
+   if(h->running++ == 0)
+      h->busy_since = SMTask::now;
+   RunningJob *r = new RunningJob;
+   r->jobno = j->jobno;
+   r->host.set(last_host);
+   running.append(r);
+}
+
+void QueueFeeder::JobFinished(Job *j)
+{
+   for(int i = 0; i < running.count(); i++) {
+      if(running[i]->jobno == j->jobno) {
+	 JobStopped(i, j);
+	 return;
+      }
+   }
+}
+
+void QueueFeeder::JobStopped(int i, Job *j)
+{
+   HostStats *h = hosts.lookup(running[i]->host);
+   h->done++;
+   if(j)
+      h->bytes += j->GetBytesCount();
+   if(--h->running == 0)
+      h->busy += TimeDiff(SMTask::now, h->busy_since);
+   running.remove(i);
+}
+
+/* jobs can be killed without the queue noticing */
+void QueueFeeder::CheckRunning()
+{
+   for(int i = running.count()-1; i >= 0; i--) {
+      if(!Job::FindJob(running[i]->jobno))
+	 JobStopped(i, 0);
+   }
+}
+
 int QueueFeeder::JobCount(const QueueJob *j)
 {
    int job_count=0;
@@ -104,7 +230,13 @@ xstring& QueueFeeder::FormatJobs(xstring& s,const QueueJob *job, int v, const ch
 	    lpwd = job->lpwd;
 	 }
 
-	 s.append("queue ").append_quoted(job->cmd).append('\n');
+	 s.append("queue ");
+	 if(j->priority)
+	    s.appendf("-p %d ", j->priority);
+	 if(j->deadline)
+	    s.appendf("--deadline=%lds ", (long)(j->deadline > SMTask::now.UnixTime()
+			? j->deadline - SMTask::now.UnixTime() : 0));
+	 s.append_quoted(j->cmd).append('\n');
       }
       return s;
    }
@@ -346,7 +478,7 @@ QueueFeeder::~QueueFeeder()
 xstring& QueueFeeder::FormatStatus(xstring& s,int v,const char *prefix) const
 {
    if(jobs == NULL)
-      return s;
+      return v >= 2 ? FormatHosts(s, prefix) : s;
 
    if(v == PrintRequeue)
       return FormatJobs(s, jobs, v, "");
@@ -370,7 +502,45 @@ xstring& QueueFeeder::FormatStatus(xstring& s,int v,const char *prefix) const
       pwd = job->pwd;
       lpwd = job->lpwd;
 
-      s.appendf("%s%2d. %s\n",prefix,n++,job->cmd.get());
+      s.appendf("%s%2d. %s",prefix,n++,job->cmd.get());
+      if(job->priority)
+	 s.appendf(" [%s %d]",_("priority"),job->priority);
+      if(job->deadline) {
+	 TimeInterval left(job->deadline > SMTask::now.UnixTime()
+			   ? job->deadline - SMTask::now.UnixTime() : 0, 0);
+	 s.appendf(" [%s %s]",_("deadline in"),left.toString(TimeInterval::TO_STR_TERSE));
+      }
+      s.append('\n');
+   }
+   if(v >= 2)
+      FormatHosts(s, prefix);
+   return s;
+}
+
+/* jobs started from the queue and transfer rate, per host */
+xstring& QueueFeeder::FormatHosts(xstring& s,const char *prefix) const
+{
+   if(host_list.Count() == 0)
+      return s;
+   s.append(prefix).append(_("Hosts:")).append('\n');
+   for(int i = 0; i < host_list.Count(); i++) {
+      const char *host = host_list[i];
+      const HostStats *h = hosts.lookup(host);
+      off_t bytes = h->bytes;
+      double busy = h->busy;
+      if(h->running > 0) {
+	 busy += TimeDiff(SMTask::now, h->busy_since);
+	 for(int r = 0; r < running.count(); r++) {
+	    Job *j = Job::FindJob(running[r]->jobno);
+	    if(j && !strcmp(running[r]->host, host))
+	       bytes += j->GetBytesCount();
+	 }
+      }
+      s.appendf("%s\t%s: %d %s, %d %s, %lld %s",prefix,host,
+	 h->running,_("running"),h->done,_("done"),(long long)bytes,_("bytes"));
+      if(busy >= 1 && bytes > 0)
+	 s.append(", ").append(Speedometer::GetStr(bytes/busy));
+      s.append('\n');
    }
    return s;
 }
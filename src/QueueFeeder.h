@@ -21,6 +21,9 @@
 #define QUEUEFEEDER_H
 
 #include "CmdExec.h"
+#include "xmap.h"
+#include "StringSet.h"
+#include "TimeDate.h"
 
 class QueueFeeder : public CmdFeeder
 {
@@ -28,15 +31,47 @@ class QueueFeeder : public CmdFeeder
       xstring_c cmd;
       xstring_c pwd;
       xstring_c lpwd;
+      xstring_c host;	// proto://host[:port] the command talks to
+      int priority;
+      time_t deadline;	// 0 if none
 
       QueueJob *next, *prev;
-      QueueJob(): next(0), prev(0) {}
+      QueueJob(): priority(0), deadline(0), next(0), prev(0) {}
    } *jobs, *lastjob;
    xstring_c cur_pwd;
    xstring_c cur_lpwd;
+   xstring_c site;	// host of the queue's own session
 
    xstring buffer;
 
+   /* jobs started from the queue, accounted per host */
+   struct HostStats {
+      int running;
+      int done;
+      off_t bytes;	// of finished jobs
+      double busy;	// seconds with at least one job running
+      Time busy_since;
+      HostStats(): running(0), done(0), bytes(0), busy(0) {}
+   };
+   xmap_p<HostStats> hosts;
+   StringSet host_list;	// the hosts in order of appearance
+   struct RunningJob {
+      int jobno;
+      xstring_c host;
+   };
+   xarray_p<RunningJob> running;
+   xstring_c last_host;	// host of the command returned last by NextCmd
+
+   static const char *HostKey(const char *url);
+   const char *CmdHost(const char *cmd) const;
+   bool HostBlocked(const char *host) const;
+   void JobStopped(int i,Job *j);
+   void CheckRunning();
+   xstring& FormatHosts(xstring& s,const char *prefix) const;
+
+   /* pick the job to run next, or NULL if all are blocked */
+   QueueJob *pick_job();
+
    /* remove the given job from the list */
    void unlink_job(QueueJob *job);
 
@@ -65,7 +100,12 @@ public:
    const char *NextCmd(CmdExec *exec,const char *prompt);
 
    /* Add a command to the queue at a given position; a 0 position inserts at the end. */
-   void QueueCmd(const char *cmd, const char *pwd, const char *lpwd, int pos = 0, int verbose = 0);
+   void QueueCmd(const char *cmd, const char *pwd, const char *lpwd, int pos = 0, int verbose = 0,
+		 int priority = 0, time_t deadline = 0);
+
+   /* the queue CmdExec reports jobs it starts and reaps */
+   void JobStarted(Job *j);
+   void JobFinished(Job *j);
 
    /* delete jobs (by index or wildcard expr) */
    bool DelJob(int from, int v = 0);
@@ -81,8 +121,8 @@ public:
    enum { PrintRequeue = 9999 };
    xstring& FormatStatus(xstring&,int v,const char *prefix="\t") const;
 
-   QueueFeeder(const char *pwd, const char *lpwd):
-      jobs(0), lastjob(0), cur_pwd(pwd), cur_lpwd(lpwd) {}
+   QueueFeeder(const char *pwd, const char *lpwd, const char *url):
+      jobs(0), lastjob(0), cur_pwd(pwd), cur_lpwd(lpwd), site(HostKey(url)) {}
    virtual ~QueueFeeder();
 };
 
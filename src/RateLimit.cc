@@ -21,11 +21,14 @@
 #include "RateLimit.h"
 #include "ResMgr.h"
 #include "SMTask.h"
+#include "Metrics.h"
 
 // RateLimit class implementation.
 int RateLimit::total_xfer_number;
 RateLimit::BytesPool RateLimit::total[2];
 bool RateLimit::total_reconfig_needed=true;
+double RateLimit::total_throttled_time[2];
+int RateLimit::total_throttled_count[2];
 
 RateLimit::RateLimit(const char *c)
 {
@@ -35,13 +38,34 @@ RateLimit::RateLimit(const char *c)
       total[PUT].Reset();
    }
    total_xfer_number++;
+   throttled[GET]=throttled[PUT]=false;
    Reconfig(0,c);
 }
 RateLimit::~RateLimit()
 {
+   AccountThrottle(GET,1);
+   AccountThrottle(PUT,1);
    total_xfer_number--;
 }
 
+// keeps track of time spent waiting for the rate limit to allow more bytes.
+int RateLimit::AccountThrottle(int dir,int allowed)
+{
+   if(allowed<=0 && !throttled[dir])
+   {
+      throttled[dir]=true;
+      throttle_start[dir]=SMTask::now;
+      total_throttled_count[dir]++;
+   }
+   else if(allowed>0 && throttled[dir])
+   {
+      throttled[dir]=false;
+      total_throttled_time[dir]+=TimeDiff(SMTask::now,throttle_start[dir]);
+      total_throttled_count[dir]--;
+   }
+   return allowed;
+}
+
 #define LARGE 0x10000000
 #define DEFAULT_MAX_COEFF 2
 void RateLimit::BytesPool::AdjustTime()
@@ -69,7 +93,7 @@ int RateLimit::BytesAllowed(dir_t dir)
       ReconfigTotal();
 
    if(one[dir].rate==0 && total[dir].rate==0) // unlimited
-      return LARGE;
+      return AccountThrottle(dir,LARGE);
 
    one  [dir].AdjustTime();
    total[dir].AdjustTime();
@@ -79,7 +103,7 @@ int RateLimit::BytesAllowed(dir_t dir)
       ret=total[dir].pool/total_xfer_number;
    if(one[dir].rate>0 && ret>one[dir].pool)
       ret=one[dir].pool;
-   return ret;
+   return AccountThrottle(dir,ret);
 }
 
 bool RateLimit::Relaxed(dir_t dir)
@@ -146,3 +170,24 @@ void RateLimit::ReconfigTotal()
    total[PUT].Reset();
    total_reconfig_needed = false;
 }
+
+class RateLimitMetrics : public MetricsSource
+{
+public:
+   void FormatMetrics(xstring& buf);
+};
+void RateLimitMetrics::FormatMetrics(xstring& buf)
+{
+   static const char *const dir_name[2]={"get","put"};
+   Declare(buf,"lftp_ratelimit_throttled_seconds_total","counter",
+      "Time transfers spent waiting for the rate limit.");
+   for(int d=0; d<2; d++)
+      Value(buf,"lftp_ratelimit_throttled_seconds_total",Label("dir",dir_name[d]),
+	 RateLimit::TotalThrottledTime(RateLimit::dir_t(d)));
+   Declare(buf,"lftp_ratelimit_throttled","gauge",
+      "Number of transfers currently waiting for the rate limit.");
+   for(int d=0; d<2; d++)
+      Value(buf,"lftp_ratelimit_throttled",Label("dir",dir_name[d]),
+	 (long long)RateLimit::TotalThrottledCount(RateLimit::dir_t(d)));
+}
+static RateLimitMetrics rate_limit_metrics;
@@ -46,6 +46,13 @@ private:
    static BytesPool total[2];
    BytesPool one[2];
 
+   // throttling statistics
+   bool throttled[2];
+   Time throttle_start[2];
+   static double total_throttled_time[2];
+   static int total_throttled_count[2];
+   int AccountThrottle(int dir,int allowed);
+
 public:
    RateLimit(const char *closure);
    ~RateLimit();
@@ -61,6 +68,9 @@ public:
    bool Relaxed(dir_t dir);
 
    void Reconfig(const char *name,const char *c);
+
+   static double TotalThrottledTime(dir_t dir) { return total_throttled_time[dir]; }
+   static int TotalThrottledCount(dir_t dir) { return total_throttled_count[dir]; }
 };
 
 #endif // RATELIMIT_H
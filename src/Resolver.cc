@@ -912,7 +912,7 @@ void Resolver::Reconfig(const char *name)
 
 
 ResolverCache::ResolverCache()
-   : Cache(ResMgr::FindRes("dns:cache-size"),ResMgr::FindRes("dns:cache-enable"))
+   : Cache("dns",ResMgr::FindRes("dns:cache-size"),ResMgr::FindRes("dns:cache-enable"))
 {
 }
 void ResolverCache::Reconfig(const char *r)
@@ -969,8 +969,12 @@ void ResolverCache::Find(const char *h,const char *p,const char *defp,
       if(c->Stopped())
       {
 	 Trim();
+	 CountMiss();
 	 return;
       }
+      CountHit();
       c->GetData(a,n);
    }
+   else
+      CountMiss();
 }
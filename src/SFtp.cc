@@ -38,7 +38,8 @@ bool SFtp::GetBetterConnection(int level,bool limit_reached)
 {
    bool need_sleep=false;
 
-   for(FA *fo=FirstSameSite(); fo!=0; fo=NextSameSite(fo))
+   int n;
+   for(FA *fo=FirstSameSite(&n); fo!=0; fo=NextSameSite(fo,&n))
    {
       SFtp *o=(SFtp*)fo; // we are sure it is SFtp.
 
@@ -115,6 +116,9 @@ int SFtp::Do()
    && rate_limit==0)
       rate_limit=new RateLimit(hostname);
 
+   if(state>=CONNECTED && prefetch_wait.Count()>0)
+      m|=SendPrefetchRequests();
+
    switch(state)
    {
    case DISCONNECTED:
@@ -179,6 +183,8 @@ int SFtp::Do()
       LogNote(9,"%s (%s)",_("Running connect program"),cmd_str.get());
       ssh=new PtyShell(cmd);
       ssh->UsePipes();
+      Trace(TraceRing::CONNECT,hostname);
+      ConnectTimingStart();
       state=CONNECTING;
       timeout_timer.Reset();
       m=MOVED;
@@ -207,6 +213,7 @@ int SFtp::Do()
 	 return MOVED;
       if(!received_greeting)
 	 return m;
+      ConnectTimingConnected();
       SendRequest(new Request_INIT(Query("protocol-version",hostname)),Expect::FXP_VERSION);
       state=CONNECTING_2;
       return MOVED;
@@ -217,6 +224,7 @@ int SFtp::Do()
 	 return MOVED;
       if(protocol_version==0)
 	 return m;
+      ConnectTimingReady();
       if(home_auto==0)
 	 SendRequest(new Request_REALPATH("."),Expect::HOME_PATH);
       state=CONNECTED;
@@ -297,6 +305,7 @@ void SFtp::MoveConnectionHere(SFtp *o)
    send_translate=o->send_translate.borrow();
    rate_limit=o->rate_limit.borrow();
    expect_queue_size=o->expect_queue_size; o->expect_queue_size=0;
+   prefetch_queue_size=o->prefetch_queue_size; o->prefetch_queue_size=0;
    expect_chain=o->expect_chain; o->expect_chain=0;
    expect_chain_end=o->expect_chain_end;
    if(expect_chain_end==&o->expect_chain)
@@ -304,6 +313,15 @@ void SFtp::MoveConnectionHere(SFtp *o)
    o->expect_chain_end=&o->expect_chain;
    timeout_timer.Reset(o->timeout_timer);
    ssh_id=o->ssh_id;
+   server_max_read=o->server_max_read;
+   server_max_write=o->server_max_write;
+   server_max_handles=o->server_max_handles;
+   ApplyServerLimits();
+   check_file_supported=o->check_file_supported;
+   prefetch_wait.MoveHere(o->prefetch_wait);
+   prefetch_active.unset();
+   prefetch_active.move_here(o->prefetch_active);
+   prefetch_next_id=o->prefetch_next_id;
    state=CONNECTED;
    o->Disconnect();
    if(!home)
@@ -324,6 +342,10 @@ void SFtp::Disconnect()
    send_translate=0;
    recv_translate=0;
    ssh_id=0;
+   server_max_read=server_max_write=server_max_handles=0;
+   check_file_supported=false;
+   prefetch_wait.Empty();
+   prefetch_active.unset();
    home_auto.set(FindHomeAuto());
    // may have to resend file info queries.
    if(fileset_for_info)
@@ -338,6 +360,7 @@ void SFtp::Init()
    received_greeting=false;
    password_sent=0;
    expect_queue_size=0;
+   prefetch_queue_size=0;
    expect_chain=0;
    expect_chain_end=&expect_chain;
    ooo_chain=0;
@@ -349,6 +372,12 @@ void SFtp::Init()
    size_read=0x8000;
    size_write=0x8000;
    use_full_path=false;
+   server_max_read=0;
+   server_max_write=0;
+   server_max_handles=0;
+   check_file_supported=false;
+   prefetch_next_id=0;
+   max_prefetch_dirs=0;
    flush_timer.Set(0,500);
 }
 
@@ -454,6 +483,8 @@ SFtp::unpack_status_t SFtp::UnpackPacket(Buffer *b,SFtp::Packet **p)
 
    Log::global->Format(9,"<--- got a packet, length=%d, type=%d(%s), id=%u\n",
       probe.GetLength(),probe.GetPacketType(),probe.GetPacketTypeText(),probe.GetID());
+   TracePacket(TraceRing::PACKET_RECV,probe.GetPacketTypeText(),2,
+      probe.GetID(),probe.GetLength());
 
    switch(probe.GetPacketType())
    {
@@ -501,8 +532,8 @@ SFtp::unpack_status_t SFtp::UnpackPacket(Buffer *b,SFtp::Packet **p)
       LogError(0,"request in reply??");
       return UNPACK_WRONG_FORMAT;
    case SSH_FXP_EXTENDED_REPLY:
-      LogError(0,"unexpected SSH_FXP_EXTENDED_REPLY");
-      return UNPACK_WRONG_FORMAT;
+      pp=new Reply_EXTENDED();
+      break;
    }
    res=pp->Unpack(b);
    if(res!=UNPACK_SUCCESS)
@@ -532,6 +563,8 @@ void SFtp::SendRequest(Packet *request,Expect::expect_t tag,int i)
    request->ComputeLength();
    Log::global->Format(9,"---> sending a packet, length=%d, type=%d(%s), id=%u\n",
       request->GetLength(),request->GetPacketType(),request->GetPacketTypeText(),request->GetID());
+   TracePacket(TraceRing::PACKET_SEND,request->GetPacketTypeText(),2,
+      request->GetID(),request->GetLength());
    request->Pack(send_buf.get_non_const());
    PushExpect(new Expect(request,tag,i));
 }
@@ -555,7 +588,10 @@ const char *SFtp::SkipHome(const char *path)
 }
 const char *SFtp::WirePath(const char *path)
 {
-   path=dir_file(cwd,path);
+   return WireFullPath(dir_file(cwd,path));
+}
+const char *SFtp::WireFullPath(const char *path)
+{
    if(!use_full_path || path[0]=='~')
       path=SkipHome(path);
    LogNote(9,"path on wire is `%s'",path);
@@ -675,6 +711,10 @@ void SFtp::SendArrayInfoRequests()
       if(fi->need&fi->SYMLINK_DEF && protocol_version>=3)
 	 SendRequest(new Request_READLINK(lc_to_utf8(dir_file(cwd,fi->name))),
 	    Expect::INFO_READLINK,fileset_for_info->curr_index());
+      if(fi->need&fi->CHECKSUM && check_file_supported)
+	 SendRequest(new Request_CHECK_FILE(lc_to_utf8(dir_file(cwd,fi->name)),
+	    "sha256,sha1,md5,crc32"),
+	    Expect::INFO_CHECKSUM,fileset_for_info->curr_index());
    }
    if(RespQueueIsEmpty())
       state=DONE;
@@ -713,8 +753,7 @@ void SFtp::Close()
    CloseHandle(Expect::IGNORE);
    super::Close();
    // don't need these out-of-order packets anymore
-   while(ooo_chain)
-      DeleteExpect(&ooo_chain);
+   EmptyOOOChain();
    if(recv_buf)
       recv_buf->Resume();
 }
@@ -783,6 +822,9 @@ void SFtp::HandleExpect(Expect *e)
 	    send_translate->SetTranslation(charset,false);
 	    recv_translate->SetTranslation(charset,true);
 	 }
+	 if(((Reply_VERSION*)reply)->GetExtension("limits@openssh.com"))
+	    SendRequest(new Request_EXTENDED("limits@openssh.com"),Expect::LIMITS);
+	 check_file_supported=(((Reply_VERSION*)reply)->GetExtension("check-file")!=0);
       }
       else
       {
@@ -790,6 +832,28 @@ void SFtp::HandleExpect(Expect *e)
 	 SetError(FATAL,"cannot negotiate protocol version");
       }
       break;
+   case Expect::LIMITS:
+      if(reply->TypeIs(SSH_FXP_EXTENDED_REPLY))
+      {
+	 const xstring& d=((Reply_EXTENDED*)reply)->GetData();
+	 if(d.length()>=32)
+	 {
+	    Buffer b;
+	    b.Put(d,d.length());
+	    server_max_read=b.UnpackUINT64BE(8);
+	    server_max_write=b.UnpackUINT64BE(16);
+	    server_max_handles=b.UnpackUINT64BE(24);
+	    LogNote(9,"server limits: read=%llu, write=%llu, open handles=%llu",
+	       server_max_read,server_max_write,server_max_handles);
+	    ApplyServerLimits();
+	 }
+      }
+      break;
+   case Expect::PREFETCH_HANDLE:
+   case Expect::PREFETCH_DATA:
+   case Expect::PREFETCH_CLOSE:
+      HandlePrefetch(e);
+      break;
    case Expect::HOME_PATH:
       if(reply->TypeIs(SSH_FXP_NAME))
       {
@@ -901,36 +965,11 @@ void SFtp::HandleExpect(Expect *e)
       {
 	 Reply_NAME *r=(Reply_NAME*)reply;
 	 LogNote(9,"file name count=%d",r->GetCount());
-	 for(int i=0; i<r->GetCount(); i++)
-	 {
-	    const NameAttrs *a=r->GetNameAttrs(i);
-	    if(!file_set)
-	       file_set=new FileSet;
-	    FileInfo *info=MakeFileInfo(a);
-	    if(info)
-	       file_set->Add(info);
-	    if(mode==LIST)
-	    {
-	       file_buf->Put(a->name);
-	       if(a->attrs.type==SSH_FILEXFER_TYPE_DIRECTORY)
-		  file_buf->Put("/");
-	       file_buf->Put("\n");
-	    }
-	    else if(mode==LONG_LIST)
-	    {
-	       if(a->longname)
-	       {
-		  file_buf->Put(a->longname);
-		  file_buf->Put("\n");
-	       }
-	       else if(info)
-	       {
-		  info->MakeLongName();
-		  file_buf->Put(info->longname);
-		  file_buf->Put("\n");
-	       }
-	    }
-	 }
+	 if(!file_set && r->GetCount()>0)
+	    file_set=new FileSet;
+	 xstring list("");
+	 AddNames(r,file_set.get_non_const(),&list,mode);
+	 file_buf->Put(list,list.length());
 	 if(r->Eof())
 	    goto eof;
       }
@@ -989,6 +1028,29 @@ void SFtp::HandleExpect(Expect *e)
 	 }
       }
       break;
+   case Expect::INFO_CHECKSUM:
+      if(reply->TypeIs(SSH_FXP_EXTENDED_REPLY) && mode==ARRAY_INFO)
+      {
+	 // string hash-algo-used, then the hash itself.
+	 const xstring& d=((Reply_EXTENDED*)reply)->GetData();
+	 if(d.length()<4)
+	    break;
+	 Buffer b;
+	 b.Put(d,d.length());
+	 unsigned name_len=b.UnpackUINT32BE(0);
+	 if(name_len>d.length()-4)
+	    break;
+	 xstring name(d.get()+4,name_len);
+	 xstring hash(d.get()+4+name_len,d.length()-4-name_len);
+	 Checksum::algo_t a=Checksum::Find(name);
+	 LogNote(9,"file checksum: %s:%s",name.get(),hash.hexdump());
+	 if(a!=Checksum::NONE && (int)hash.length()==Checksum::DigestSize(a))
+	    (*fileset_for_info)[e->i]->SetChecksum(a,hash);
+      }
+      else if(reply->TypeIs(SSH_FXP_STATUS)
+      && ((Reply_STATUS*)reply)->GetCode()==SSH_FX_OP_UNSUPPORTED)
+	 check_file_supported=false;
+      break;
    case Expect::WRITE_STATUS:
       if(reply->TypeIs(SSH_FXP_STATUS))
       {
@@ -1014,6 +1076,201 @@ void SFtp::HandleExpect(Expect *e)
    delete e;
 }
 
+void SFtp::AddNames(Reply_NAME *r,FileSet *set,xstring *list,int list_mode)
+{
+   for(int i=0; i<r->GetCount(); i++)
+   {
+      const NameAttrs *a=r->GetNameAttrs(i);
+      FileInfo *info=MakeFileInfo(a);
+      if(info)
+	 set->Add(info);
+      if(list_mode==LIST)
+      {
+	 list->append(a->name);
+	 if(a->attrs.type==SSH_FILEXFER_TYPE_DIRECTORY)
+	    list->append('/');
+	 list->append('\n');
+      }
+      else if(list_mode==LONG_LIST)
+      {
+	 if(a->longname)
+	 {
+	    list->append(a->longname);
+	    list->append('\n');
+	 }
+	 else if(info)
+	 {
+	    info->MakeLongName();
+	    list->append(info->longname);
+	    list->append('\n');
+	 }
+      }
+   }
+}
+
+xmap<time_t> SFtp::prefetched_dirs;
+
+const xstring& SFtp::PrefetchKey(const char *path) const
+{
+   return xstring::cat(user?user.get():"","@",hostname.get(),":",
+			 portname?portname.get():"",path,NULL);
+}
+int SFtp::FindPrefetch(int id) const
+{
+   for(int i=0; i<prefetch_active.count(); i++)
+   {
+      if(prefetch_active[i]->id==id)
+	 return i;
+   }
+   return -1;
+}
+
+void SFtp::PrefetchSubdirs(const FileSet *set)
+{
+   if(max_prefetch_dirs<=0 || state<CONNECTED)
+      return;
+   ExpirePrefetched(hostname);
+   // the listings are kept in LsCache only.
+   if(!cache->IsEnabled(hostname))
+      return;
+   // push in reverse order, so that the first subdirectory is popped first
+   // and the prefetch follows the depth-first order of a recursive walk.
+   for(int i=set->get_fnum()-1; i>=0; i--)
+   {
+      const FileInfo *fi=(*set)[i];
+      if(!(fi->defined&fi->TYPE) || fi->filetype!=fi->DIRECTORY)
+	 continue;
+      Path p(cwd);
+      p.Change(fi->name);
+      if(prefetched_dirs.lookup(PrefetchKey(p.path)))
+	 continue;
+      if(prefetch_wait.Count()>=PREFETCH_WAIT_MAX)
+	 prefetch_wait.Remove(0);
+      prefetch_wait.Append(p.path);
+   }
+}
+
+int SFtp::SendPrefetchRequests()
+{
+   int m=STALL;
+   int max=max_prefetch_dirs;
+   // OPENDIR uses a handle, leave some for file transfers.
+   if(server_max_handles>0 && (unsigned long long)max>server_max_handles/2)
+      max=server_max_handles/2;
+   while(prefetch_wait.Count()>0 && prefetch_active.count()<max)
+   {
+      xstring_c path(prefetch_wait.Pop(prefetch_wait.Count()-1));
+      if(prefetched_dirs.lookup(PrefetchKey(path)))
+	 continue;
+      DirPrefetch *p=new DirPrefetch;
+      p->path.set(path);
+      p->id=prefetch_next_id++;
+      p->fset=new FileSet;
+      p->list.set("");
+      prefetch_active.append(p);
+      LogNote(9,"prefetching directory `%s'",p->path.get());
+      SendRequest(new Request_OPENDIR(WireFullPath(p->path)),Expect::PREFETCH_HANDLE,p->id);
+      m=MOVED;
+   }
+   return m;
+}
+
+void SFtp::HandlePrefetch(Expect *e)
+{
+   if(e->tag==Expect::PREFETCH_CLOSE)
+      return;
+   int i=FindPrefetch(e->i);
+   if(i==-1)
+      return;
+   DirPrefetch *p=prefetch_active[i];
+   const Packet *reply=e->reply;
+   if(e->tag==Expect::PREFETCH_HANDLE && reply->TypeIs(SSH_FXP_HANDLE))
+   {
+      p->handle.set(((Reply_HANDLE*)reply)->GetHandle());
+      SendRequest(new Request_READDIR(p->handle),Expect::PREFETCH_DATA,p->id);
+      return;
+   }
+   bool ok=false;
+   if(e->tag==Expect::PREFETCH_DATA && reply->TypeIs(SSH_FXP_NAME))
+   {
+      Reply_NAME *r=(Reply_NAME*)reply;
+      AddNames(r,p->fset.get_non_const(),&p->list,LONG_LIST);
+      if(!r->Eof())
+      {
+	 SendRequest(new Request_READDIR(p->handle),Expect::PREFETCH_DATA,p->id);
+	 return;
+      }
+      ok=true;
+   }
+   else if(e->tag==Expect::PREFETCH_DATA && reply->TypeIs(SSH_FXP_STATUS))
+      ok=(((Reply_STATUS*)reply)->GetCode()==SSH_FX_EOF);
+   if(p->handle)
+      SendRequest(new Request_CLOSE(p->handle),Expect::PREFETCH_CLOSE);
+   if(ok)
+   {
+      LogNote(9,"prefetched directory `%s' (%d files)",p->path.get(),p->fset->get_fnum());
+      Path dir(cwd);
+      dir.Change(p->path);
+      SMTaskRef<FileAccess> loc(Clone());
+      loc->SetCwd(dir);
+      cache->Add(loc,"",LONG_LIST,OK,p->list,p->list.length(),p->fset);
+      prefetched_dirs.add(PrefetchKey(p->path),SMTask::now.UnixTime());
+   }
+   // a failed prefetch is dropped, the error is reported by normal listing.
+   prefetch_active.remove(i);
+}
+
+void SFtp::ExpirePrefetched(const char *host)
+{
+   TimeIntervalR expire(ResMgr::Query("cache:expire",host));
+   if(expire.IsInfty())
+      return;
+   StringSet old;
+   for(time_t t=prefetched_dirs.each_begin(); t; t=prefetched_dirs.each_next())
+   {
+      if(t+expire.Seconds()<=SMTask::now.UnixTime())
+	 old.Append(prefetched_dirs.each_key());
+   }
+   for(int i=0; i<old.Count(); i++)
+      prefetched_dirs.remove(xstring::get_tmp(old[i]));
+}
+
+// true if the listing of cwd is being read ahead on this connection.
+bool SFtp::PrefetchPending() const
+{
+   for(int i=0; i<prefetch_active.count(); i++)
+   {
+      if(!strcmp(prefetch_active[i]->path,cwd.path))
+	 return true;
+   }
+   return false;
+}
+
+// Finds a prefetched listing of cwd in LsCache. It is taken only once,
+// a later listing is read from the cache by the usual rules.
+bool SFtp::FindPrefetched(const char **list,int *len,const FileSet **set)
+{
+   if(prefetched_dirs.count()==0)
+      return false;
+   const xstring& key=PrefetchKey(cwd.path);
+   if(!prefetched_dirs.lookup(key))
+      return false;
+   prefetched_dirs.remove(key);
+   int err;
+   if(!cache->Find(this,"",LONG_LIST,&err,list,len,set) || err)
+      return false;   // flushed or expired from the cache
+   LogNote(9,"using prefetched listing of `%s'",cwd.path.get());
+   return true;
+}
+
+void SFtp::ApplyServerLimits()
+{
+   if(server_max_read>0 && (unsigned long long)size_read>server_max_read)
+      size_read=server_max_read;
+   if(server_max_write>0 && (unsigned long long)size_write>server_max_write)
+      size_write=server_max_write;
+}
+
 void SFtp::RequestMoreData()
 {
    if(mode==RETRIEVE) {
@@ -1117,6 +1374,8 @@ void SFtp::PushExpect(Expect *e)
    *expect_chain_end=e;
    expect_chain_end=&e->next;
    expect_queue_size++;
+   if(e->IsPrefetch())
+      prefetch_queue_size++;
 }
 void SFtp::DeleteExpect(Expect **e)
 {
@@ -1124,8 +1383,10 @@ void SFtp::DeleteExpect(Expect **e)
       expect_chain_end=e;
    Expect *d=*e;
    *e=e[0]->next;
-   delete d;
    expect_queue_size--;
+   if(d->IsPrefetch())
+      prefetch_queue_size--;
+   delete d;
 }
 SFtp::Expect *SFtp::FindExpectExclusive(Packet *p)
 {
@@ -1137,6 +1398,8 @@ SFtp::Expect *SFtp::FindExpectExclusive(Packet *p)
       expect_chain_end=e;
    *e=res->next;
    expect_queue_size--;
+   if(res->IsPrefetch())
+      prefetch_queue_size--;
    return res;
 }
 void SFtp::CloseExpectQueue()
@@ -1149,10 +1412,15 @@ void SFtp::CloseExpectQueue()
       case Expect::HANDLE_STALE:
       case Expect::HOME_PATH:
       case Expect::FXP_VERSION:
+      case Expect::LIMITS:
+      case Expect::PREFETCH_HANDLE:
+      case Expect::PREFETCH_DATA:
+      case Expect::PREFETCH_CLOSE:
 	 break;
       case Expect::CWD:
       case Expect::INFO:
       case Expect::INFO_READLINK:
+      case Expect::INFO_CHECKSUM:
       case Expect::DEFAULT:
       case Expect::DATA:
       case Expect::WRITE_STATUS:
@@ -1396,6 +1664,8 @@ void SFtp::Reconfig(const char *name)
    if(size_write<16)
       size_write=16;
    use_full_path=QueryBool("use-full-path",c);
+   max_prefetch_dirs=Query("prefetch-dirs",c);
+   ApplyServerLimits();
    if(!xstrcmp(name,"sftp:charset") && protocol_version && protocol_version<4)
    {
       if(!IsSuspended())
@@ -1564,6 +1834,47 @@ SFtp::unpack_status_t SFtp::PacketSTRING::Unpack(const Buffer *b)
    return res;
 }
 
+SFtp::unpack_status_t SFtp::Reply_VERSION::Unpack(const Buffer *b)
+{
+   unpack_status_t res=PacketUINT32::Unpack(b);
+   if(res!=UNPACK_SUCCESS)
+      return res;
+   int limit=length+4;
+   while(unpacked<limit)
+   {
+      xstring name,data;
+      res=UnpackString(b,&unpacked,limit,&name);
+      if(res!=UNPACK_SUCCESS)
+	 return res;
+      res=UnpackString(b,&unpacked,limit,&data);
+      if(res!=UNPACK_SUCCESS)
+	 return res;
+      Log::global->Format(9,"extension %s (%s)\n",name.get(),data.get());
+      extension_name.Append(name);
+      extension_data.Append(data);
+   }
+   return UNPACK_SUCCESS;
+}
+const char *SFtp::Reply_VERSION::GetExtension(const char *name) const
+{
+   for(int i=0; i<extension_name.Count(); i++)
+      if(!strcmp(extension_name[i],name))
+	 return extension_data[i];
+   return 0;
+}
+SFtp::unpack_status_t SFtp::Reply_EXTENDED::Unpack(const Buffer *b)
+{
+   unpack_status_t res=Packet::Unpack(b);
+   if(res!=UNPACK_SUCCESS)
+      return res;
+   const char *d;
+   int len;
+   b->Get(&d,&len);
+   data.nset(d+unpacked,length+4-unpacked);
+   unpacked=length+4;
+   return UNPACK_SUCCESS;
+}
+
 SFtp::unpack_status_t SFtp::Reply_NAME::Unpack(const Buffer *b)
 {
    unpack_status_t res=Packet::Unpack(b);
@@ -2233,12 +2544,30 @@ int SFtpListInfo::Do()
 	 ubuf->PutEOF();
 	 result=new FileSet(fset_c);
       }
+      else if(session.Cast<SFtp>()->PrefetchPending() && !prefetch_timer.Stopped())
+      {
+	 if(prefetch_timer.IsInfty())
+	    prefetch_timer.Set(PREFETCH_WAIT_TIME);
+	 return m;	// will be ready soon
+      }
       else
       {
-	 session->Open("",FA::LONG_LIST);
-	 ubuf=new IOBufferFileAccess(session);
-	 if(FileAccess::cache->IsEnabled(session->GetHostName()))
-	    ubuf->Save(FileAccess::cache->SizeLimit());
+	 if(session.Cast<SFtp>()->FindPrefetched(&cache_buffer,&cache_buffer_size,&fset_c))
+	 {
+	    ubuf=new IOBuffer(IOBuffer::GET);
+	    ubuf->Put(cache_buffer,cache_buffer_size);
+	    ubuf->PutEOF();
+	    result=new FileSet(fset_c);
+	    result->Exclude(exclude_prefix,exclude);
+	    m=MOVED;
+	 }
+	 else
+	 {
+	    session->Open("",FA::LONG_LIST);
+	    ubuf=new IOBufferFileAccess(session);
+	    if(FileAccess::cache->IsEnabled(session->GetHostName()))
+	       ubuf->Save(FileAccess::cache->SizeLimit());
+	 }
       }
    }
    if(!result) {
@@ -2256,7 +2585,7 @@ int SFtpListInfo::Do()
 	 return MOVED;
       }
       if(b)
-	 return MOVED;
+	 return m;
       // eof
       if(!result && session->IsOpen())
 	 result=session.Cast<SFtp>()->GetFileSet();
@@ -2266,6 +2595,8 @@ int SFtpListInfo::Do()
    }
    if(result && session->OpenMode()!=FA::ARRAY_INFO)
    {
+      if(recursive)
+	 session.Cast<SFtp>()->PrefetchSubdirs(result);
       ubuf=0;
       result->rewind();
       for(FileInfo *file=result->curr(); file!=0; file=result->next())
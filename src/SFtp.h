@@ -25,6 +25,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include "FileSet.h"
+#include "StringSet.h"
+#include "xmap.h"
 
 class SFtp : public SSH_Access
 {
@@ -242,6 +244,7 @@ private:
 
    const char *SkipHome(const char *path);
    const char *WirePath(const char *path);
+   const char *WireFullPath(const char *path);
 
 public:
    enum unpack_status_t
@@ -345,20 +348,50 @@ private:
    };
    class Reply_VERSION : public PacketUINT32
    {
-      char **extension_name;
-      char **extension_data;
+      StringSet extension_name;
+      StringSet extension_data;
    public:
       Reply_VERSION() : PacketUINT32(SSH_FXP_VERSION) {}
-      unpack_status_t Unpack(const Buffer *b)
+      unpack_status_t Unpack(const Buffer *b);
+      unsigned GetVersion() { return data; }
+      const char *GetExtension(const char *name) const;
+   };
+   class Request_EXTENDED : public PacketSTRING
+   {
+   public:
+      Request_EXTENDED(const char *name) : PacketSTRING(SSH_FXP_EXTENDED,name) {}
+   };
+   // check-file-name from draft-ietf-secsh-filexfer-extensions,
+   // asks for a hash of the whole file.
+   class Request_CHECK_FILE : public Request_EXTENDED
+   {
+      xstring path;
+      xstring algos;
+   public:
+      Request_CHECK_FILE(const char *p,const char *a)
+	 : Request_EXTENDED("check-file-name"), path(p), algos(a) {}
+      void ComputeLength()
 	 {
-	    unpack_status_t res;
-	    res=PacketUINT32::Unpack(b);
-	    if(res!=UNPACK_SUCCESS)
-	       return res;
-   	    // FIXME: unpack extensions.
-	    return res;
+	    Request_EXTENDED::ComputeLength();
+	    length+=4+path.length()+4+algos.length()+8+8+4;
 	 }
-      unsigned GetVersion() { return data; }
+      void Pack(Buffer *b)
+	 {
+	    Request_EXTENDED::Pack(b);
+	    Packet::PackString(b,path,path.length());
+	    Packet::PackString(b,algos,algos.length());
+	    b->PackUINT64BE(0);	 // start offset
+	    b->PackUINT64BE(0);	 // length, zero for whole file
+	    b->PackUINT32BE(0);	 // block size, zero for single hash
+	 }
+   };
+   class Reply_EXTENDED : public Packet
+   {
+      xstring data;
+   public:
+      Reply_EXTENDED() : Packet(SSH_FXP_EXTENDED_REPLY) {}
+      unpack_status_t Unpack(const Buffer *b);
+      const xstring& GetData() const { return data; }
    };
    class Request_REALPATH : public PacketSTRING
    {
@@ -695,9 +728,14 @@ private:
 	 DATA,
 	 INFO,
 	 INFO_READLINK,
+	 INFO_CHECKSUM,
 	 DEFAULT,
 	 WRITE_STATUS,
-	 IGNORE
+	 IGNORE,
+	 LIMITS,
+	 PREFETCH_HANDLE,
+	 PREFETCH_DATA,
+	 PREFETCH_CLOSE
       };
 
       Ref<Packet> request;
@@ -706,6 +744,7 @@ private:
       int i;
       expect_t tag;
       Expect(Packet *req,expect_t t,int j=0) : request(req), i(j), tag(t) {}
+      bool IsPrefetch() const { return tag>=PREFETCH_HANDLE; }
    };
 
    void PushExpect(Expect *);
@@ -717,6 +756,7 @@ private:
    int ReplyLogPriority(int);
 
    int expect_queue_size;
+   int prefetch_queue_size;   // part of expect_queue_size
    Expect *expect_chain;
    Expect **expect_chain_end;
    Expect **FindExpect(Packet *reply);
@@ -724,14 +764,24 @@ private:
    Expect *FindExpectExclusive(Packet *reply);
    Expect *ooo_chain; 	// out of order replies buffered
 
-   int   RespQueueIsEmpty() { return expect_chain==0; }
-   int	 RespQueueSize() { return expect_queue_size; }
+   // directory prefetch requests are not counted as they are not
+   // related to the current operation.
+   int   RespQueueIsEmpty() { return expect_queue_size==prefetch_queue_size; }
+   int	 RespQueueSize() { return expect_queue_size-prefetch_queue_size; }
+   void  EmptyOOOChain()
+      {
+	 while(ooo_chain)
+	 {
+	    Expect *next=ooo_chain->next;
+	    delete ooo_chain;
+	    ooo_chain=next;
+	 }
+      }
    void  EmptyRespQueue()
       {
 	 while(expect_chain)
 	    DeleteExpect(&expect_chain);
-	 while(ooo_chain)
-	    DeleteExpect(&ooo_chain);
+	 EmptyOOOChain();
       }
 
    bool GetBetterConnection(int level,bool limit_reached);
@@ -753,6 +803,40 @@ private:
    int size_write;
    bool use_full_path;
 
+   // limits@openssh.com values, zero when unknown.
+   unsigned long long server_max_read;
+   unsigned long long server_max_write;
+   unsigned long long server_max_handles;
+   void ApplyServerLimits();
+
+   bool check_file_supported;
+
+   // Directory prefetch for recursive listings. Subdirectories of a listed
+   // directory are read ahead with several OPENDIR/READDIR chains in
+   // flight. Complete listings are added to LsCache; prefetched_dirs
+   // remembers which of them are fresh, so that they are used even when
+   // the listing was asked without cache.
+   struct DirPrefetch
+   {
+      xstring path;
+      xstring handle;
+      int id;
+      Ref<FileSet> fset;
+      xstring list;
+   };
+   enum { PREFETCH_WAIT_MAX=1024 };
+   static xmap<time_t> prefetched_dirs;
+   StringSet prefetch_wait;   // paths, used as a stack
+   xarray_p<DirPrefetch> prefetch_active;
+   int prefetch_next_id;
+   int max_prefetch_dirs;
+   const xstring& PrefetchKey(const char *path) const;
+   int FindPrefetch(int id) const;
+   int SendPrefetchRequests();
+   void HandlePrefetch(Expect *e);
+   static void ExpirePrefetched(const char *host);
+   void AddNames(Reply_NAME *r,FileSet *set,xstring *list,int list_mode);
+
 protected:
    void SetError(int code,const Packet *reply);
    void SetError(int code,const char *mess=0) { FA::SetError(code,mess); }
@@ -797,6 +881,10 @@ public:
    void CleanupThis();
 
    FileSet *GetFileSet();
+
+   void PrefetchSubdirs(const FileSet *set);
+   bool PrefetchPending() const;
+   bool FindPrefetched(const char **list,int *len,const FileSet **set);
 };
 
 class SFtpDirList : public DirList
@@ -819,6 +907,10 @@ public:
 class SFtpListInfo : public ListInfo
 {
    SMTaskRef<IOBuffer> ubuf;
+   // a prefetch of the directory in progress is waited for this long,
+   // then the directory is read directly.
+   enum { PREFETCH_WAIT_TIME=10 };
+   Timer prefetch_timer;
 
 public:
    SFtpListInfo(SFtp *session,const char *dir)
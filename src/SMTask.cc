@@ -36,6 +36,9 @@ SMTask	 *SMTask::current;
 xarray<SMTask*>	SMTask::stack;
 PollVec	 SMTask::block;
 TimeDate SMTask::now;
+unsigned long long SMTask::sched_count;
+double	 SMTask::sched_time_total;
+double	 SMTask::sched_time_last;
 
 static int task_count=0;
 static SMTask *init_task=new SMTaskInit;
@@ -249,6 +252,7 @@ void SMTask::Schedule()
    if(timer_timeout>=0)
       block.SetTimeout(timer_timeout);
 
+   Time start(now);
    int res=STALL;
    for(scan=chain_ready; scan; scan=scan->next_ready)
    {
@@ -258,6 +262,11 @@ void SMTask::Schedule()
       res|=scan->Do();	   // let it run.
       Leave(scan);	   // unmark it running and change current.
    }
+   Time done;
+   done.SetToCurrentTime();
+   sched_time_last=TimeDiff(done,start);
+   sched_time_total+=sched_time_last;
+   sched_count++;
    if(CollectGarbage() || res)
       block.NoWait();
 }
@@ -283,6 +292,14 @@ int SMTask::TaskCount()
    return count;
 }
 
+int SMTask::ReadyTaskCount()
+{
+   int count=0;
+   for(SMTask *scan=chain_ready; scan; scan=scan->next_ready)
+      count++;
+   return count;
+}
+
 void SMTask::Cleanup()
 {
    CollectGarbage();
@@ -42,6 +42,11 @@ class SMTask
    static PollVec block;
    static xarray<SMTask*> stack;
 
+   // scheduler statistics
+   static unsigned long long sched_count;
+   static double sched_time_total;
+   static double sched_time_last;
+
    bool	 suspended;
    bool	 suspended_slave;
 
@@ -109,6 +114,10 @@ public:
    void Leave() { Leave(this); }
 
    static int TaskCount();
+   static int ReadyTaskCount();
+   static unsigned long long ScheduleCount() { return sched_count; }
+   static double ScheduleTimeTotal() { return sched_time_total; }
+   static double ScheduleTimeLast() { return sched_time_last; }
    static void PrintTasks();
    static bool NonFatalError(int err);
    static bool TemporaryNetworkError(int err);
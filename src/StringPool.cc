@@ -18,35 +18,98 @@
  */
 
 #include <config.h>
+#include <string.h>
 #include "StringPool.h"
 #include "xarray.h"
+#include "xmap.h"
 
-xarray_p<char> StringPool::strings;
+StringPool::slot *StringPool::table;
+unsigned StringPool::table_mask;
+int StringPool::count;
+xarray_p<char> StringPool::chunks;
+char *StringPool::chunk_ptr;
+size_t StringPool::chunk_avail;
 
-const char *StringPool::Get(const char *s)
+const char *StringPool::Store(const char *s,int len)
+{
+   size_t need=len+1;
+   char *p;
+   if(need>CHUNK_SIZE/4)
+   {
+      // big strings get their own chunk, the current one is kept.
+      p=(char*)xmalloc(need);
+      chunks.append(p);
+   }
+   else
+   {
+      if(need>chunk_avail)
+      {
+	 chunk_ptr=(char*)xmalloc(CHUNK_SIZE);
+	 chunk_avail=CHUNK_SIZE;
+	 chunks.append(chunk_ptr);
+      }
+      p=chunk_ptr;
+      chunk_ptr+=need;
+      chunk_avail-=need;
+   }
+   memcpy(p,s,len);
+   p[len]=0;
+   return p;
+}
+
+void StringPool::Grow()
+{
+   unsigned old_size=(table?table_mask+1:0);
+   unsigned new_size=(old_size?old_size*2:64);
+   slot *old_table=table;
+   table=(slot*)xmalloc(new_size*sizeof(slot));
+   memset(table,0,new_size*sizeof(slot));
+   table_mask=new_size-1;
+   for(unsigned i=0; i<old_size; i++)
+   {
+      if(!old_table[i].str)
+	 continue;
+      unsigned j=old_table[i].hash&table_mask;
+      while(table[j].str)
+	 j=(j+1)&table_mask;
+      table[j]=old_table[i];
+   }
+   xfree(old_table);
+}
+
+const char *StringPool::Get(const char *s,int len)
 {
    if(!s)
       return 0;
 
-   int l=0;
-   int u=strings.count();
+   // keep the table at most half full, so that probe sequences are short.
+   if(!table || unsigned(count+1)*2>table_mask+1)
+      Grow();
 
-   while(l<u)
+   unsigned hash=_xmap::make_hash(s,len);
+   unsigned i=hash&table_mask;
+   for(;;)
    {
-      int m = (l + u) / 2;
-      int cmp = strcmp(strings[m], s);
-
-      if(cmp==0)  // found it.
-	 return strings[m];
-
-      if(cmp>0)
-	 u=m;
-      else
-	 l=m+1;
+      const slot& e=table[i];
+      if(!e.str)
+	 break;
+      if(e.hash==hash && e.len==unsigned(len) && !memcmp(e.str,s,len))
+	 return e.str;	// found it.
+      i=(i+1)&table_mask;
    }
 
-   // not found.
-   // l==u points to first elementh greater than s or past end of array.
-   strings.insert(xstrdup(s),u);
-   return strings[u];
+   // not found, i points to a free slot.
+   slot& e=table[i];
+   e.str=Store(s,len);
+   e.hash=hash;
+   e.len=len;
+   count++;
+   return e.str;
+}
+
+const char *StringPool::Get(const char *s)
+{
+   if(!s)
+      return 0;
+   return Get(s,strlen(s));
 }
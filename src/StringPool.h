@@ -22,13 +22,33 @@
 
 #include "xarray.h"
 
-// maybe it is better to have many separate pools with dtors.
+// String interner. The strings are stored in arena chunks and are never
+// freed, so the returned pointers stay valid and equal strings can be
+// compared by pointer. The index is an open addressing hash table.
 class StringPool
 {
-   static xarray_p<char> strings;
+   struct slot
+   {
+      const char *str;
+      unsigned hash;
+      unsigned len;
+   };
+   static slot *table;
+   static unsigned table_mask;
+   static int count;
+
+   enum { CHUNK_SIZE=0x10000 };
+   static xarray_p<char> chunks;
+   static char *chunk_ptr;
+   static size_t chunk_avail;
+
+   static const char *Store(const char *s,int len);
+   static void Grow();
 
 public:
    static const char *Get(const char *);
+   // s need not be nul-terminated, len bytes of it are interned.
+   static const char *Get(const char *s,int len);
 };
 
 #endif
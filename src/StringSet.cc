@@ -81,8 +81,8 @@ void StringSet::AppendFormat(const char *f,...)
 
 void StringSet::MoveHere(StringSet &o)
 {
-   set.set(o.set);
-   o.set.borrow();
+   set.unset();
+   set.move_here(o.set);
 }
 
 char *StringSet::Pop(int i)
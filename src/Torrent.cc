@@ -27,6 +27,7 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <errno.h>
 #include <sha1.h>
 
@@ -47,6 +48,10 @@ static ResType torrent_vars[] = {
    {"torrent:ip", "", ResMgr::IPv4AddrValidate, ResMgr::NoClosure},
    {"torrent:retracker", ""},
    {"torrent:use-dht", "yes", ResMgr::BoolValidate, ResMgr::NoClosure},
+   {"torrent:cache-size", "32M", ResMgr::UNumberValidate, ResMgr::NoClosure},
+   {"torrent:use-mmap", "no", ResMgr::BoolValidate, ResMgr::NoClosure},
+   {"torrent:upload-slots", "8", ResMgr::UNumberValidate, ResMgr::NoClosure},
+   {"dht:max-stored-torrents", "1024", ResMgr::UNumberValidate, ResMgr::NoClosure},
 #if INET6
    {"torrent:ipv6", "", ResMgr::IPv6AddrValidate, ResMgr::NoClosure},
 #endif
@@ -106,6 +111,9 @@ xstring Torrent::my_peer_id;
 xstring Torrent::my_key;
 unsigned Torrent::my_key_num;
 xmap<Torrent*> Torrent::torrents;
+int Torrent::upload_slots;
+Timer Torrent::unchoke_timer;
+Timer Torrent::optimistic_unchoke_timer;
 SMTaskRef<TorrentListener> Torrent::listener;
 SMTaskRef<TorrentListener> Torrent::listener_udp;
 SMTaskRef<DHT> Torrent::dht;
@@ -165,11 +173,15 @@ void Torrent::StartDHT()
 }
 void Torrent::StopDHT()
 {
-   dht->Save();
-   dht=0;
+   if(dht) {
+      dht->Save();
+      dht=0;
+   }
 #if INET6
-   dht_ipv6->Save();
-   dht_ipv6=0;
+   if(dht_ipv6) {
+      dht_ipv6->Save();
+      dht_ipv6=0;
+   }
 #endif
 }
 
@@ -209,11 +221,12 @@ void Torrent::StopListenerUDP()
 }
 
 Torrent::Torrent(const char *mf,const char *c,const char *od)
-   : metainfo_url(mf),
+   : resume_save_timer(300),
+     metainfo_url(mf),
      pieces_needed_rebuild_timer(10),
      cwd(c), output_dir(od), rate_limit(mf),
      seed_timer("torrent:seed-max-time",0),
-     optimistic_unchoke_timer(30), peers_scan_timer(1),
+     peers_scan_timer(1),
      am_interested_timer(1), dht_announce_timer(10*60)
 {
    shutting_down=false;
@@ -223,6 +236,7 @@ Torrent::Torrent(const char *mf,const char *c,const char *od)
    validating=false;
    force_valid=false;
    validate_index=0;
+   resume_dirty=false;
    metadata_size=0;
    info=0;
    pieces=0;
@@ -299,6 +313,9 @@ void Torrent::Shutdown()
 
 void Torrent::PrepareToDie()
 {
+   FlushPieceCache();
+   if(resume_dirty)
+      SaveResume();
    peers.unset();
    if(info_hash && this==FindTorrent(info_hash)) {
       RemoveTorrent(this);
@@ -398,10 +415,15 @@ void Torrent::ValidatePiece(unsigned p)
       xstring& sha1=xstring::get_tmp();
       SHA1(buf,sha1);
       valid=!memcmp(pieces->get()+p*SHA1_DIGEST_SIZE,sha1,SHA1_DIGEST_SIZE);
+      if(!valid)
+	 LogError(11,"piece %u digest mismatch",p);
    }
+   SetPieceValid(p,valid);
+}
+void Torrent::SetPieceValid(unsigned p,bool valid)
+{
+   resume_dirty=true;
    if(!valid) {
-      if(buf.length()==PieceLength(p))
-	 LogError(11,"piece %u digest mismatch",p);
       if(my_bitfield->get_bit(p)) {
 	 total_left+=PieceLength(p);
 	 complete_pieces--;
@@ -418,6 +440,131 @@ void Torrent::ValidatePiece(unsigned p)
    }
 }
 
+const char *Torrent::GetResumeFile() const
+{
+   return xstring::format("%s/torrent/%s",get_lftp_cache_dir(),info_hash.hexdump());
+}
+// size and mtime of a torrent file, size is -1 when the file is missing.
+static void GetFileStamp(const char *file,long long *size,long long *mtime)
+{
+   struct stat st;
+   if(stat(file,&st)==-1) {
+      *size=-1;
+      *mtime=0;
+      return;
+   }
+   *size=st.st_size;
+   *mtime=st.st_mtime;
+}
+void Torrent::SaveResume()
+{
+   if(!metadata || validating)
+      return;
+   resume_dirty=false;
+
+   xarray_p<BeNode> stamps;
+   BeNode *files=info->lookup("files",BeNode::BE_LIST);
+   int files_count=files?files->list.count():1;
+   for(int i=0; i<files_count; i++) {
+      long long size,mtime;
+      GetFileStamp(dir_file(output_dir,files?MakePath(files->list[i]):name.get()),&size,&mtime);
+      xarray_p<BeNode> stamp;
+      stamp.append(new BeNode(size));
+      stamp.append(new BeNode(mtime));
+      stamps.append(new BeNode(&stamp));
+   }
+   xmap_p<BeNode> state;
+   state.add("info_hash",new BeNode(info_hash));
+   state.add("output_dir",new BeNode(output_dir));
+   state.add("pieces",new BeNode((const char*)my_bitfield->get(),my_bitfield->length()));
+   state.add("files",new BeNode(&stamps));
+   xstring buf;
+   BeNode(&state).Pack(buf);
+
+   mkdir(xstring::format("%s/torrent",get_lftp_cache_dir()),0700);
+   const char *file=GetResumeFile();
+   const xstring& tmp=xstring::cat(file,".tmp",NULL);
+   int fd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC,0600);
+   if(fd==-1) {
+      LogError(1,"open(%s): %s",tmp.get(),strerror(errno));
+      return;
+   }
+   int res=write(fd,buf.get(),buf.length());
+   if(res!=(int)buf.length()) {
+      LogError(1,"write(%s): %s",tmp.get(),res==-1?strerror(errno):"short write");
+      close(fd);
+      unlink(tmp);
+      return;
+   }
+   close(fd);
+   if(rename(tmp,file)==-1) {
+      LogError(1,"rename(%s): %s",tmp.get(),strerror(errno));
+      unlink(tmp);
+      return;
+   }
+   LogNote(9,"saved resume state, %u pieces complete",complete_pieces);
+}
+void Torrent::LoadResume()
+{
+   int fd=open(GetResumeFile(),O_RDONLY);
+   if(fd==-1)
+      return;
+   xstring buf;
+   int res;
+   while((res=read(fd,buf.add_space(0x4000),0x4000))>0)
+      buf.add_commit(res);
+   close(fd);
+
+   int rest;
+   Ref<BeNode> state(BeNode::Parse(buf,buf.length(),&rest));
+   if(!state || state->type!=BeNode::BE_DICT)
+      return;
+   if(!state->lookup_str("info_hash").eq(info_hash)
+   || !state->lookup_str("output_dir").eq(output_dir))
+      return;
+   const xstring& bits=state->lookup_str("pieces");
+   BeNode *stamps=state->lookup("files",BeNode::BE_LIST);
+   BeNode *files=info->lookup("files",BeNode::BE_LIST);
+   int files_count=files?files->list.count():1;
+   if(bits.length()!=(size_t)my_bitfield->length() || !stamps || stamps->list.count()!=files_count)
+      return;
+
+   // trust all pieces except those overlapping changed files
+   resume_trusted=new BitField(total_pieces);
+   for(unsigned p=0; p<total_pieces; p++)
+      resume_trusted->set_bit(p,1);
+   int changed=0;
+   off_t pos=0;
+   for(int i=0; i<files_count; i++) {
+      off_t length=files?files->list[i]->lookup_int("length"):total_length;
+      const char *path=files?MakePath(files->list[i]):name.get();
+      long long size,mtime;
+      GetFileStamp(dir_file(output_dir,path),&size,&mtime);
+      BeNode *stamp=stamps->list[i];
+      if(stamp->type!=BeNode::BE_LIST || stamp->list.count()<2
+      || stamp->list[0]->type!=BeNode::BE_INT || stamp->list[0]->num!=size
+      || stamp->list[1]->type!=BeNode::BE_INT || stamp->list[1]->num!=mtime) {
+	 LogNote(4,"file %s changed, validating",path);
+	 changed++;
+	 if(length>0) {
+	    unsigned last=(pos+length-1)/piece_length;
+	    for(unsigned p=pos/piece_length; p<=last; p++)
+	       resume_trusted->set_bit(p,0);
+	 }
+      }
+      pos+=length;
+   }
+   BitField saved(total_pieces);
+   memcpy(saved.get_non_const(),bits.get(),bits.length());
+   for(unsigned p=0; p<total_pieces; p++) {
+      if(resume_trusted->get_bit(p) && saved.get_bit(p))
+	 SetPieceValid(p,true);
+   }
+   resume_dirty=false;
+   LogNote(3,"loaded resume state, %u pieces complete, %d of %d files changed",
+      complete_pieces,changed,files_count);
+}
+
 bool TorrentPiece::has_a_downloader() const
 {
    for(int i=0; i<downloader.count(); i++)
@@ -647,6 +794,7 @@ void Torrent::SetMetadata(const xstring& md)
       validate_index=0;
       validating=true;
       recv_rate.Reset();
+      LoadResume();
    } else {
       for(unsigned i=0; i<total_pieces; i++)
 	 my_bitfield->set_bit(i,1);
@@ -913,14 +1061,22 @@ int Torrent::Do()
 	 return m;
    }
    if(validating) {
-      ValidatePiece(validate_index++);
+      // pieces restored from the resume state need no validation
+      while(resume_trusted && validate_index<total_pieces
+      && resume_trusted->get_bit(validate_index))
+	 validate_index++;
       if(validate_index<total_pieces) {
-	 recv_rate.Add(piece_length);
-	 return MOVED;
+	 ValidatePiece(validate_index++);
+	 if(validate_index<total_pieces) {
+	    recv_rate.Add(piece_length);
+	    return MOVED;
+	 }
+	 recv_rate.Add(last_piece_length);
       }
-      recv_rate.Add(last_piece_length);
       validating=false;
+      resume_trusted=0;
       recv_rate.Reset();
+      SaveResume();
       if(total_left==0) {
 	 complete=true;
 	 seed_timer.Reset();
@@ -933,8 +1089,13 @@ int Torrent::Do()
 
    if(peers_scan_timer.Stopped())
       ScanPeers();
-   if(optimistic_unchoke_timer.Stopped())
-      OptimisticUnchoke();
+   if(resume_save_timer.Stopped()) {
+      if(resume_dirty)
+	 SaveResume();
+      resume_save_timer.Reset();
+   }
+   if(unchoke_timer.Stopped())
+      ScheduleUnchokes();
 
    if(dht_announce_timer.Stopped())
       AnnounceDHT();
@@ -1099,6 +1260,7 @@ FDCache::FDCache()
 {
    max_count=16;
    max_time=30;
+   max_mapped=16;
 }
 FDCache::~FDCache()
 {
@@ -1118,7 +1280,11 @@ void FDCache::Clean()
 	 }
       }
    }
-   if(Count()>0)
+   for(const Map *m=&maps.each_begin(); m->addr; m=&maps.each_next()) {
+      if(m->last_used+max_time<now.UnixTime())
+	 Unmap(maps.each_key());
+   }
+   if(Count()>0 || maps.count()>0)
       clean_timer.Reset();
 }
 int FDCache::Do()
@@ -1140,6 +1306,7 @@ void FDCache::Close(const char *name)
 	 cache[i].remove(n);
       }
    }
+   Unmap(n);
 }
 void FDCache::CloseAll()
 {
@@ -1150,6 +1317,8 @@ void FDCache::CloseAll()
 	 cache[i].remove(cache[i].each_key());
       }
    }
+   for(const Map *m=&maps.each_begin(); m->addr; m=&maps.each_next())
+      Unmap(maps.each_key());
 }
 bool FDCache::CloseOne()
 {
@@ -1229,6 +1398,72 @@ int FDCache::OpenFile(const char *file,int m,off_t size)
    return fd;
 }
 
+const char *FDCache::MapFile(const char *file,size_t *size)
+{
+   int fd=OpenFile(file,O_RDONLY);
+   struct stat st;
+   if(fd==-1 || fstat(fd,&st)==-1) {
+      Unmap(xstring::get_tmp(file));
+      return 0;
+   }
+   Map& m=maps.lookup_Lv(file);
+   if(m.addr) {
+      if(off_t(m.size)<=st.st_size) {
+	 m.last_used=now.UnixTime();
+	 *size=m.size;
+	 return m.addr;
+      }
+      // the file was truncated behind our back, touching the mapped pages
+      // past the new end would raise SIGBUS.
+      ProtoLog::LogError(1,"%s: file was truncated",file);
+      Unmap(xstring::get_tmp(file));
+   }
+   maps.remove(file);
+   if(st.st_size==0 || off_t(size_t(st.st_size))!=st.st_size)
+      return 0;
+   if(maps.count()>=max_mapped)
+      UnmapOne();
+   void *addr=mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+   if(addr==MAP_FAILED) {
+      ProtoLog::LogError(9,"mmap(%s): %s",file,strerror(errno));
+      return 0;
+   }
+#ifdef MADV_RANDOM
+   // pieces are requested in random order, readahead is done per piece
+   madvise(addr,st.st_size,MADV_RANDOM);
+#endif
+   ProtoLog::LogNote(9,"mapped %s",file);
+   Map new_map={(const char*)addr,size_t(st.st_size),now.UnixTime()};
+   maps.add(file,new_map);
+   clean_timer.Reset();
+   *size=new_map.size;
+   return new_map.addr;
+}
+void FDCache::Unmap(const xstring& name)
+{
+   const Map& m=maps.lookup(name);
+   if(!m.addr)
+      return;
+   ProtoLog::LogNote(9,"unmapping %s",name.get());
+   munmap((void*)m.addr,m.size);
+   maps.remove(name);
+}
+bool FDCache::UnmapOne()
+{
+   const xstring *oldest_key=0;
+   time_t oldest_time=0;
+   for(const Map *m=&maps.each_begin(); m->addr; m=&maps.each_next()) {
+      if(oldest_key==0 || m->last_used<oldest_time) {
+	 oldest_key=&maps.each_key();
+	 oldest_time=m->last_used;
+      }
+   }
+   if(!oldest_key)
+      return false;
+   Unmap(xstring::get_tmp(*oldest_key));
+   return true;
+}
+
 int Torrent::OpenFile(const char *file,int m,off_t size)
 {
    bool did_mkdir=false;
@@ -1276,14 +1511,115 @@ void Torrent::SetPieceNotWanted(unsigned piece)
 
 #define MIN(a,b) ((a)<(b)?(a):(b))
 
-void Torrent::StoreBlock(unsigned piece,unsigned begin,unsigned len,const char *buf,TorrentPeer *src_peer)
+TorrentPieceBuffer::TorrentPieceBuffer(unsigned p,unsigned len)
+   : piece(p), dirty(false), hashed(0)
 {
-   for(int i=0; i<peers.count(); i++)
-      peers[i]->CancelBlock(piece,begin);
+   sha1_init_ctx(&sha1);
+   data.get_space(len);
+   data.set_length(len);
+}
 
-   unsigned b=begin/BLOCK_SIZE;
-   int bc=(len+BLOCK_SIZE-1)/BLOCK_SIZE;
+unsigned long long Torrent::piece_cache_size;
+unsigned long long Torrent::piece_cache_max;
+
+TorrentPieceBuffer *Torrent::FindCachedPiece(unsigned piece)
+{
+   for(int i=piece_cache.count()-1; i>=0; i--) {
+      TorrentPieceBuffer *pb=piece_cache[i];
+      if(pb->piece!=piece)
+	 continue;
+      pb->last_used=now;
+      if(i<piece_cache.count()-1) {
+	 // move to the end (most recently used)
+	 piece_cache[i]=0;
+	 piece_cache.remove(i);
+	 piece_cache.append(pb);
+      }
+      return pb;
+   }
+   return 0;
+}
+// the cache size limit is global, so the least recently used piece
+// is searched in all torrents.
+Torrent *Torrent::FindOldestCachedPiece(bool clean_only,int *index)
+{
+   Torrent *oldest=0;
+   for(Torrent *t=torrents.each_begin(); t; t=torrents.each_next()) {
+      for(int i=0; i<t->piece_cache.count(); i++) {
+	 const TorrentPieceBuffer *pb=t->piece_cache[i];
+	 if(clean_only && pb->dirty)
+	    continue;
+	 if(!oldest || pb->last_used<oldest->piece_cache[*index]->last_used) {
+	    oldest=t;
+	    *index=i;
+	 }
+	 break;	// the rest of this torrent's cache is newer
+      }
+   }
+   return oldest;
+}
+TorrentPieceBuffer *Torrent::NewCachedPiece(unsigned piece)
+{
+   unsigned len=PieceLength(piece);
+   // evict clean pieces first, then write out partial ones.
+   for(int pass=0; pass<2 && piece_cache_size+len>piece_cache_max; ) {
+      int i;
+      Torrent *t=FindOldestCachedPiece(pass==0,&i);
+      if(!t) {
+	 pass++;
+	 continue;
+      }
+      if(!t->FlushCachedPiece(t->piece_cache[i]))
+	 return 0;
+      t->DropCachedPiece(i);
+   }
+   if(piece_cache_size+len>piece_cache_max)
+      return 0;
+   TorrentPieceBuffer *pb=new TorrentPieceBuffer(piece,len);
+   piece_cache.append(pb);
+   piece_cache_size+=len;
+   return pb;
+}
+void Torrent::DropCachedPiece(int i)
+{
+   piece_cache_size-=piece_cache[i]->data.length();
+   piece_cache.remove(i);
+}
+bool Torrent::FlushCachedPiece(TorrentPieceBuffer *pb)
+{
+   if(!pb->dirty)
+      return true;
+   // write the present blocks, merging adjacent ones.
+   unsigned p=pb->piece;
+   const BitField& map=piece_info[p]->block_map;
+   unsigned blocks=BlocksInPiece(p);
+   for(unsigned b=0; b<blocks; ) {
+      if(!map.get_bit(b)) {
+	 b++;
+	 continue;
+      }
+      unsigned e=b+1;
+      while(e<blocks && map.get_bit(e))
+	 e++;
+      unsigned begin=b*BLOCK_SIZE;
+      unsigned end=MIN(e*BLOCK_SIZE,PieceLength(p));
+      if(!WriteBlock(p,begin,end-begin,pb->data.get()+begin))
+	 return false;
+      b=e;
+   }
+   pb->dirty=false;
+   return true;
+}
+void Torrent::FlushPieceCache()
+{
+   for(int i=0; i<piece_cache.count(); i++)
+      FlushCachedPiece(piece_cache[i]);
+   while(piece_cache.count()>0)
+      DropCachedPiece(piece_cache.count()-1);
+}
 
+bool Torrent::WriteBlock(unsigned piece,unsigned begin,unsigned len,const char *buf)
+{
    off_t f_pos=0;
    off_t f_rest=len;
    while(len>0) {
@@ -1291,28 +1627,80 @@ void Torrent::StoreBlock(unsigned piece,unsigned begin,unsigned len,const char *
       int fd=OpenFile(file,O_RDWR|O_CREAT,f_pos+f_rest);
       if(fd==-1) {
 	 SetError(xstring::format("open(%s): %s",file,strerror(errno)));
-	 return;
+	 return false;
       }
       int w=pwrite(fd,buf,MIN(f_rest,len),f_pos);
       int saved_errno=errno;
       if(w==-1) {
 	 SetError(xstring::format("pwrite(%s): %s",file,strerror(saved_errno)));
-	 return;
+	 return false;
       }
       if(w==0) {
 	 SetError(xstring::format("pwrite(%s): write error - disk full?",file));
-	 return;
+	 return false;
       }
       buf+=w;
       begin+=w;
       len-=w;
    }
+   return true;
+}
+
+void Torrent::StoreBlock(unsigned piece,unsigned begin,unsigned len,const char *buf,TorrentPeer *src_peer)
+{
+   for(int i=0; i<peers.count(); i++)
+      peers[i]->CancelBlock(piece,begin);
+
+   if(my_bitfield->get_bit(piece))
+      return;
+
+   unsigned b=begin/BLOCK_SIZE;
+   int bc=(len+BLOCK_SIZE-1)/BLOCK_SIZE;
+
+   TorrentPiece *pi=piece_info[piece].get_non_const();
+   // a duplicate block (e.g. in end game) must not replace the data
+   // already fed to the piece hash or written to disk.
+   for(int i=0; i<bc; i++) {
+      if(pi->block_map.get_bit(b+i))
+	 return;
+   }
+   // a piece is assembled in memory only if it is started there.
+   TorrentPieceBuffer *pb=FindCachedPiece(piece);
+   if(!pb && !pi->block_map.has_any_set())
+      pb=NewCachedPiece(piece);
+   if(pb) {
+      memcpy(pb->data.get_non_const()+begin,buf,len);
+      pb->dirty=true;
+   } else if(!WriteBlock(piece,begin,len,buf))
+      return;
 
    while(bc-->0) {
-      piece_info[piece]->block_map.set_bit(b++,1);
+      pi->block_map.set_bit(b++,1);
    }
-   if(piece_info[piece]->block_map.has_all_set() && !my_bitfield->get_bit(piece)) {
-      ValidatePiece(piece);
+   if(pb) {
+      // hash the blocks as soon as all the preceding ones are present.
+      unsigned piece_len=PieceLength(piece);
+      while(pb->hashed<piece_len && pi->block_map.get_bit(pb->hashed/BLOCK_SIZE)) {
+	 unsigned h_len=MIN(BLOCK_SIZE,piece_len-pb->hashed);
+	 sha1_process_bytes(pb->data.get()+pb->hashed,h_len,&pb->sha1);
+	 pb->hashed+=h_len;
+      }
+   }
+   if(pi->block_map.has_all_set() && !my_bitfield->get_bit(piece)) {
+      if(pb) {
+	 char sha1[SHA1_DIGEST_SIZE];
+	 sha1_finish_ctx(&pb->sha1,sha1);
+	 bool valid=!memcmp(pieces->get()+piece*SHA1_DIGEST_SIZE,sha1,SHA1_DIGEST_SIZE);
+	 if(valid) {
+	    if(!FlushCachedPiece(pb))
+	       return;
+	 } else {
+	    assert(piece_cache.last()==pb);
+	    DropCachedPiece(piece_cache.count()-1);
+	 }
+	 SetPieceValid(piece,valid);
+      } else
+	 ValidatePiece(piece);
       if(!my_bitfield->get_bit(piece)) {
 	 LogError(0,"new piece %u digest mismatch",piece);
 	 src_peer->MarkPieceInvalid(piece);
@@ -1371,6 +1759,57 @@ const xstring& Torrent::RetrieveBlock(unsigned piece,unsigned begin,unsigned len
    return buf;
 }
 
+const xstring& Torrent::RetrieveCachedBlock(unsigned piece,unsigned begin,unsigned len)
+{
+   if(begin+len>PieceLength(piece))
+      return xstring::null;
+   // peers usually request all blocks of a piece, read it once.
+   TorrentPieceBuffer *pb=FindCachedPiece(piece);
+   if(!pb && my_bitfield->get_bit(piece)) {
+      // without a cache slot, read just the requested block.
+      pb=NewCachedPiece(piece);
+      if(!pb)
+	 return RetrieveBlock(piece,begin,len);
+      const xstring& buf=RetrieveBlock(piece,0,PieceLength(piece));
+      if(buf.length()!=PieceLength(piece)) {
+	 DropCachedPiece(piece_cache.count()-1);
+	 return xstring::null;
+      }
+      pb->data.nset(buf,buf.length());
+      pb->hashed=buf.length();
+   }
+   if(!pb || pb->dirty)
+      return RetrieveBlock(piece,begin,len);
+   return xstring::get_tmp(pb->data.get()+begin,len);
+}
+// returns a pointer into the file mapping, or 0 if the block cannot be mapped.
+const char *Torrent::MapBlock(unsigned piece,unsigned begin,unsigned len)
+{
+   if(begin+len>PieceLength(piece) || !my_bitfield->get_bit(piece))
+      return 0;
+   off_t f_pos=0;
+   off_t f_rest=len;
+   const char *file=FindFileByPosition(piece,begin,&f_pos,&f_rest);
+   if(!file || f_rest<len)
+      return 0;   // the block spans files
+   size_t size;
+   const char *addr=fd_cache->MapFile(dir_file(output_dir,file),&size);
+   if(!addr || f_pos+len>off_t(size))
+      return 0;
+#ifdef MADV_WILLNEED
+   if(begin==0) {
+      // the peer is likely to request the rest of the piece, read it ahead.
+      static long page_size=sysconf(_SC_PAGESIZE);
+      off_t start=f_pos&~off_t(page_size-1);
+      off_t end=f_pos+MIN(f_rest,off_t(PieceLength(piece)));
+      if(end>off_t(size))
+	 end=size;
+      madvise((void*)(addr+start),end-start,MADV_WILLNEED);
+   }
+#endif
+   return addr+f_pos;
+}
+
 TorrentPeer *Torrent::FindPeerById(const xstring& p_id)
 {
    // linear search - peers count<100, called rarely
@@ -1422,8 +1861,6 @@ void Torrent::ReducePeers()
    }
    peers.qsort(complete ? PeersCompareSendRate : PeersCompareRecvRate);
    ReduceUploaders();
-   ReduceDownloaders();
-   UnchokeBestUploaders();
 }
 void Torrent::ReduceUploaders()
 {
@@ -1442,24 +1879,6 @@ void Torrent::ReduceUploaders()
       }
    }
 }
-void Torrent::ReduceDownloaders()
-{
-   bool rate_low = RateLow(RateLimit::PUT);
-   if(am_not_choking_peers_count < (rate_low?max_downloaders:min_downloaders+1))
-      return;
-   // choke the slowest
-   for(int i=0; i<peers.count(); i++) {
-      TorrentPeer *peer=peers[i].get_non_const();
-      if(!peer->am_choking && peer->peer_interested) {
-	 if(peer->choke_timer.TimePassed() <= 30)
-	    break;
-	 peer->SetAmChoking(true);
-	 if(am_not_choking_peers_count < max_downloaders)
-	    break;
-      }
-   }
-}
-
 bool Torrent::NeedMoreUploaders()
 {
    if(!metadata || validating)
@@ -1474,50 +1893,94 @@ bool Torrent::AllowMoreDownloaders()
    return RateLow(RateLimit::PUT) && am_not_choking_peers_count < max_downloaders;
 }
 
-void Torrent::UnchokeBestUploaders()
+bool Torrent::NeedsUpload() const
 {
-   // unchoke 4 best uploaders
-   int limit = 4;
+   // downloading torrents reciprocate, seeding ones work towards the ratio
+   if(!complete)
+      return true;
+   return !(stop_on_ratio>0 && GetRatio()>=stop_on_ratio);
+}
+float Torrent::UnchokeRate(const TorrentPeer *peer) const
+{
+   return (complete ? peer->peer_send_rate : peer->peer_recv_rate).Get();
+}
+int Torrent::PeersCompareUnchoke(TorrentPeer *const*p1,TorrentPeer *const*p2)
+{
+   const Torrent *t1=(*p1)->parent;
+   const Torrent *t2=(*p2)->parent;
+   // best first: torrents below share target, faster peers, lower ratio
+   int c=cmp(t2->NeedsUpload(),t1->NeedsUpload());
+   if(c) return c;
+   c=cmp(t2->UnchokeRate(*p2),t1->UnchokeRate(*p1));
+   if(c) return c;
+   return cmp(t1->GetRatio(),t2->GetRatio());
+}
+void Torrent::ScheduleUnchokes()
+{
+   unchoke_timer.Set(10);
 
-   int count=0;
-   for(int i=peers.count()-1; i>=0 && count<limit; i--) {
-      TorrentPeer *peer=peers[i].get_non_const();
-      if(!peer->Connected())
+   xarray<TorrentPeer*> candidates;
+   for(Torrent *t=torrents.each_begin(); t; t=torrents.each_next()) {
+      if(!t->metadata || t->validating || t->shutting_down)
 	 continue;
-      if(!peer->choke_timer.Stopped())
-	 continue;   // cannot change choke status yet
-      if(!peer->peer_interested)
+      for(int i=0; i<t->peers.count(); i++) {
+	 TorrentPeer *peer=t->peers[i].get_non_const();
+	 if(!peer->Connected())
+	    continue;
+	 if(!peer->peer_interested) {
+	    if(peer->am_choking && peer->choke_timer.Stopped())
+	       peer->SetAmChoking(false);
+	    continue;
+	 }
+	 candidates.append(peer);
+      }
+   }
+   candidates.qsort(PeersCompareUnchoke);
+
+   // the best peers of all torrents get the slots, the rest
+   // keep unchoked only while there is spare upload bandwidth.
+   for(int i=0; i<candidates.count(); i++) {
+      TorrentPeer *peer=candidates[i];
+      if(i<upload_slots) {
+	 if(peer->am_choking && peer->choke_timer.Stopped())
+	    peer->SetAmChoking(false);
 	 continue;
-      peer->SetAmChoking(false);
-      count++;
+      }
+      if(peer->am_choking || peer->choke_timer.TimePassed() <= 30)
+	 continue;
+      Torrent *t=peer->parent;
+      if(t->RateLow(RateLimit::PUT) && t->am_not_choking_peers_count <= max_downloaders)
+	 continue;
+      peer->SetAmChoking(true);
    }
+
+   if(optimistic_unchoke_timer.Stopped())
+      OptimisticUnchoke(candidates);
 }
-void Torrent::OptimisticUnchoke()
+void Torrent::OptimisticUnchoke(const xarray<TorrentPeer*>& candidates)
 {
    xarray<TorrentPeer*> choked_peers;
-   for(int i=peers.count()-1; i>=0; i--) {
-      TorrentPeer *peer=peers[i].get_non_const();
-      if(!peer->Connected())
-	 continue;
-      if(!peer->choke_timer.Stopped())
+   for(int i=0; i<candidates.count(); i++) {
+      TorrentPeer *peer=candidates[i];
+      if(!peer->am_choking || !peer->choke_timer.Stopped())
 	 continue;   // cannot change choke status yet
-      if(peer->am_choking) {
-	 if(!peer->peer_interested) {
-	    peer->SetAmChoking(false);
-	    continue;
-	 }
+      choked_peers.append(peer);
+      if(peer->retry_timer.TimePassed()<60) {
+	 // newly connected is more likely to be unchoked
+	 choked_peers.append(peer);
 	 choked_peers.append(peer);
-	 if(peer->retry_timer.TimePassed()<60) {
-	    // newly connected is more likely to be unchoked
-	    choked_peers.append(peer);
-	    choked_peers.append(peer);
-	 }
       }
    }
-   if(choked_peers.count()==0)
-      return;
-   choked_peers[rand()/13%choked_peers.count()]->SetAmChoking(false);
-   optimistic_unchoke_timer.Reset();
+   // one optimistic unchoke per four slots
+   for(int n=upload_slots/4+1; n>0 && choked_peers.count()>0; n--) {
+      TorrentPeer *peer=choked_peers[rand()/13%choked_peers.count()];
+      peer->SetAmChoking(false);
+      for(int i=choked_peers.count()-1; i>=0; i--) {
+	 if(choked_peers[i]==peer)
+	    choked_peers.remove(i);
+      }
+   }
+   optimistic_unchoke_timer.Set(30);
 }
 
 int Torrent::PeerBytesAllowed(const TorrentPeer *peer,RateLimit::dir_t dir)
@@ -1541,6 +2004,9 @@ void Torrent::Reconfig(const char *name)
    max_peers=ResMgr::Query("torrent:max-peers",c);
    seed_min_peers=ResMgr::Query("torrent:seed-min-peers",c);
    stop_on_ratio=ResMgr::Query("torrent:stop-on-ratio",c);
+   piece_cache_max=(unsigned long)ResMgr::Query("torrent:cache-size",0);
+   use_mmap=ResMgr::QueryBool("torrent:use-mmap",0);
+   upload_slots=ResMgr::Query("torrent:upload-slots",0);
    rate_limit.Reconfig(name,metainfo_url);
    if(listener)
       StartDHT();
@@ -1621,6 +2087,9 @@ TorrentPeer::TorrentPeer(Torrent *p,const sockaddr_u *a,int t_no)
    peer_bytes_pool[0]=peer_bytes_pool[1]=0;
    peer_recv=peer_sent=0;
    invalid_piece_count=0;
+   queue_len=MIN_QUEUE_LEN;
+   peer_reqq=MAX_QUEUE_LEN;
+   block_rtt=0;
 }
 TorrentPeer::~TorrentPeer()
 {
@@ -1673,6 +2142,9 @@ void TorrentPeer::Disconnect()
    peer_interested=false;
    peer_choking=true;
    peer_complete_pieces=0;
+   queue_len=MIN_QUEUE_LEN;
+   peer_reqq=MAX_QUEUE_LEN;
+   block_rtt=0;
    retry_timer.Reset();
    choke_timer.Stop();
    interest_timer.Stop();
@@ -1760,7 +2232,7 @@ void TorrentPeer::SendExtensions()
    ext.add("m",new BeNode(&m));
    ext.add("p",new BeNode(parent->GetPort()));
    ext.add("v",new BeNode(PACKAGE"/"VERSION));
-   ext.add("reqq",new BeNode(MAX_QUEUE_LEN*16));
+   ext.add("reqq",new BeNode(MAX_QUEUE_LEN));
    if(parent->Complete())
       ext.add("upload_only",new BeNode(1));
    if(parent->metadata)
@@ -1792,28 +2264,36 @@ void TorrentPeer::SendExtensions()
    }
 
    PacketExtended pkt(MSG_EXT_HANDSHAKE,new BeNode(&ext));
-   pkt.Pack(send_buf);
+   SendPacket(pkt);
    LogSend(9,xstring::format("extended(%u,%s)",pkt.code,pkt.data->Format1()));
 }
 
 void TorrentPeer::SendDataReply()
 {
    const PacketRequest *p=recv_queue.next();
+   const char *data=0;
    Enter(parent);
-   const xstring& data=parent->RetrieveBlock(p->index,p->begin,p->req_length);
+   if(parent->use_mmap && parent->complete)
+      data=parent->MapBlock(p->index,p->begin,p->req_length);
+   if(!data) {
+      const xstring& buf=parent->RetrieveCachedBlock(p->index,p->begin,p->req_length);
+      if(buf.length()==p->req_length)
+	 data=buf.get();
+   }
    Leave(parent);
-   if(data.length()!=p->req_length) {
+   if(!data) {
       if(parent->my_bitfield->get_bit(p->index))
 	 parent->SetError(xstring::format("failed to read piece %u",p->index));
       return;
    }
+   PacketPiece pkt(p->index,p->begin,data,p->req_length);
+   SendPacket(pkt);
    LogSend(8,xstring::format("piece:%u begin:%u size:%u",p->index,p->begin,p->req_length));
-   PacketPiece(p->index,p->begin,data).Pack(send_buf);
-   peer_sent+=data.length();
-   parent->total_sent+=data.length();
-   parent->send_rate.Add(data.length());
-   peer_send_rate.Add(data.length());
-   BytesPut(data.length());
+   peer_sent+=p->req_length;
+   parent->total_sent+=p->req_length;
+   parent->send_rate.Add(p->req_length);
+   peer_send_rate.Add(p->req_length);
+   BytesPut(p->req_length);
    activity_timer.Reset();
 }
 
@@ -1853,7 +2333,8 @@ int TorrentPeer::SendDataRequests(unsigned p)
       parent->SetDownloader(p,b,0,this);
       PacketRequest *req=new PacketRequest(p,b*Torrent::BLOCK_SIZE,len);
       LogSend(6,xstring::format("request piece:%u begin:%u size:%u",p,b*Torrent::BLOCK_SIZE,len));
-      req->Pack(send_buf);
+      SendPacket(*req);
+      req->sent_time=now;
       sent_queue.push(req);
       SetLastPiece(p);
       sent++;
@@ -1861,12 +2342,52 @@ int TorrentPeer::SendDataRequests(unsigned p)
       bytes_allowed-=len;
       BytesGot(len);
 
-      if(sent_queue.count()>=MAX_QUEUE_LEN)
+      if(SentQueueFull())
 	 break;
    }
    return sent;
 }
 
+void TorrentPeer::UpdateQueueLen(const PacketRequest *req)
+{
+   // The latency of a block includes the time it waited in the peer's
+   // queue, so the base round trip time is tracked as a slowly rising
+   // minimum of the samples.
+   double rtt=TimeDiff(now,req->sent_time);
+   if(rtt<0.001)
+      rtt=0.001;
+   if(block_rtt==0 || rtt<block_rtt)
+      block_rtt=rtt;
+   else
+      block_rtt+=(rtt-block_rtt)/256;
+
+   // Estimate how many of our requests wait at the peer. If few do, the
+   // pipeline is what limits the transfer, so make it deeper (by one per
+   // received block, that doubles it every round trip); if most of them
+   // wait, the peer is the bottleneck and the queue can shrink.
+   int len=queue_len;
+   double queued=queue_len*(1-block_rtt/rtt);
+   if(queued<2 && sent_queue.count()>=queue_len-1)
+      len++;
+   else if(queued>queue_len/2)
+      len--;
+
+   // and never go below twice the bandwidth-delay product.
+   double bdp=peer_recv_rate.Get()*block_rtt/Torrent::BLOCK_SIZE;
+   if(len<bdp*2)
+      len=int(bdp*2);
+   if(len<MIN_QUEUE_LEN)
+      len=MIN_QUEUE_LEN;
+   if(len>MAX_QUEUE_LEN)
+      len=MAX_QUEUE_LEN;
+   if(len>peer_reqq)
+      len=peer_reqq;
+   if(len!=queue_len)
+      LogNote(10,"request queue length %d (rtt %.3fs, rate %s)",
+	 len,block_rtt,peer_recv_rate.GetStrS());
+   queue_len=len;
+}
+
 bool TorrentPeer::InFastSet(unsigned p) const
 {
    for(int i=0; i<fast_set.count(); i++)
@@ -1881,7 +2402,7 @@ void TorrentPeer::SendDataRequests()
 
    if(peer_choking && !FastExtensionEnabled())
       return;
-   if(sent_queue.count()>=MAX_QUEUE_LEN)
+   if(SentQueueFull())
       return;
    if(!BytesAllowedToGet(Torrent::BLOCK_SIZE))
       return;
@@ -1940,7 +2461,7 @@ void TorrentPeer::Have(unsigned p)
       return;
    Enter();
    LogSend(9,xstring::format("have(%u)",p));
-   PacketHave(p).Pack(send_buf);
+   SendPacket(PacketHave(p));
    Leave();
 }
 int TorrentPeer::FindRequest(unsigned piece,unsigned begin) const
@@ -1961,7 +2482,7 @@ void TorrentPeer::CancelBlock(unsigned p,unsigned b)
    if(i>=0) {
       const PacketRequest *req=sent_queue[i];
       LogSend(9,xstring::format("cancel(%u,%u)",p,b));
-      PacketCancel(p,b,req->req_length).Pack(send_buf);
+      SendPacket(PacketCancel(p,b,req->req_length));
       parent->SetDownloader(p,b/Torrent::BLOCK_SIZE,this,0);
       sent_queue.remove(i);
    }
@@ -2068,7 +2589,7 @@ void TorrentPeer::SetAmInterested(bool interest)
       return;
    Enter();
    LogSend(6,interest?"interested":"uninterested");
-   Packet(interest?MSG_INTERESTED:MSG_UNINTERESTED).Pack(send_buf);
+   SendPacket(Packet(interest?MSG_INTERESTED:MSG_UNINTERESTED));
    parent->am_interested_peers_count+=(interest-am_interested);
    am_interested=interest;
    interest_timer.Reset();
@@ -2083,7 +2604,7 @@ void TorrentPeer::SetAmChoking(bool c)
       return;
    Enter();
    LogSend(6,c?"choke":"unchoke");
-   Packet(c?MSG_CHOKE:MSG_UNCHOKE).Pack(send_buf);
+   SendPacket(Packet(c?MSG_CHOKE:MSG_UNCHOKE));
    parent->am_not_choking_peers_count-=(c-am_choking);
    am_choking=c;
    choke_timer.Reset();
@@ -2095,7 +2616,7 @@ void TorrentPeer::SetAmChoking(bool c)
 	 while(recv_queue.count()>0) {
 	    const PacketRequest *p=recv_queue.next();
 	    LogSend(6,xstring::format("reject-request piece:%u begin:%u size:%u",p->index,p->begin,p->req_length));
-	    PacketRejectRequest(p->index,p->begin,p->req_length).Pack(send_buf);
+	    SendPacket(PacketRejectRequest(p->index,p->begin,p->req_length));
 	 }
       }
    }
@@ -2122,6 +2643,7 @@ void TorrentPeer::SetPieceHaving(unsigned p,bool have)
 
 void TorrentPeer::HandlePacket(Packet *p)
 {
+   TraceMessage(TraceRing::PACKET_RECV,p);
    switch(p->GetPacketType())
    {
    case MSG_KEEPALIVE: {
@@ -2291,6 +2813,7 @@ void TorrentPeer::HandlePacket(Packet *p)
 // 	    SetError("got a piece that was not requested");
 	    break;
 	 }
+	 UpdateQueueLen(sent_queue[i]);
 	 ClearSentQueue(i);
 	 parent->PeerBytesGot(pp->data.length()); // re-take the bytes returned by ClearSentQueue
 	 Enter(parent);
@@ -2331,7 +2854,7 @@ void TorrentPeer::HandlePacket(Packet *p)
 	    SetError("invalid data length");
 	    break;
 	 }
-	 if(recv_queue.count()>=MAX_QUEUE_LEN*16) {
+	 if(recv_queue.count()>=MAX_QUEUE_LEN) {
 	    SetError("too many requests");
 	    break;
 	 }
@@ -2379,7 +2902,7 @@ void TorrentPeer::SendMetadataRequest()
    req.add("piece",new BeNode(parent->md_download.length()/Torrent::BLOCK_SIZE));
    PacketExtended pkt(msg_ext_metadata,new BeNode(&req));
    LogSend(4,xstring::format("ut_metadata request %s",pkt.data->Format1()));
-   pkt.Pack(send_buf);
+   SendPacket(pkt);
 }
 
 void TorrentPeer::HandleExtendedMessage(PacketExtended *pp)
@@ -2397,6 +2920,14 @@ void TorrentPeer::HandleExtendedMessage(PacketExtended *pp)
       metadata_size=parent->metadata_size=pp->data->lookup_int("metadata_size");
       upload_only=pp->data->lookup_int("upload_only");
 
+      int reqq=pp->data->lookup_int("reqq");
+      if(reqq>0) {
+	 peer_reqq=(reqq<MAX_QUEUE_LEN?reqq:MAX_QUEUE_LEN);
+	 if(queue_len>peer_reqq)
+	    queue_len=peer_reqq;
+	 LogNote(9,"peer request queue limit is %d",reqq);
+      }
+
       if(!parent->HasMetadata() && !msg_ext_metadata) {
 	 Disconnect();
 	 return;
@@ -2459,7 +2990,7 @@ void TorrentPeer::HandleExtendedMessage(PacketExtended *pp)
 	       reply.add("piece",new BeNode(piece->num));
 	       PacketExtended pkt(msg_ext_metadata,new BeNode(&reply));
 	       LogSend(4,xstring::format("ut_metadata reject %s",pkt.data->Format1()));
-	       pkt.Pack(send_buf);
+	       SendPacket(pkt);
 	       break;
 	    }
 	    const char *d=parent->metadata+offset;
@@ -2472,7 +3003,7 @@ void TorrentPeer::HandleExtendedMessage(PacketExtended *pp)
 	    PacketExtended pkt(msg_ext_metadata,new BeNode(&reply));
 	    LogSend(4,xstring::format("ut_metadata data %s",pkt.data->Format1()));
 	    pkt.SetAppendix(d,len);
-	    pkt.Pack(send_buf);
+	    SendPacket(pkt);
 	    break;
 	 }
 	 case UT_METADATA_DATA: {
@@ -2618,7 +3149,7 @@ void TorrentPeer::SendPEXPeers()
       req.add("dropped6",new BeNode(dropped6));
    PacketExtended pkt(msg_ext_pex,new BeNode(&req));
    LogSend(4,xstring::format("ut_pex message: added=[%d,%d], dropped=[%d,%d]",a,a6,d,d6));
-   pkt.Pack(send_buf);
+   SendPacket(pkt);
 }
 
 bool TorrentPeer::HasNeededPieces()
@@ -2722,17 +3253,19 @@ int TorrentPeer::Do()
       if(FastExtensionEnabled()) {
 	 if(parent->complete_pieces==0) {
 	    LogSend(5,"have-none");
-	    Packet(MSG_HAVE_NONE).Pack(send_buf);
+	    SendPacket(Packet(MSG_HAVE_NONE));
 	 } else if(parent->complete_pieces==parent->total_pieces) {
 	    LogSend(5,"have-all");
-	    Packet(MSG_HAVE_ALL).Pack(send_buf);
+	    SendPacket(Packet(MSG_HAVE_ALL));
 	 } else {
 	    LogSend(5,"bitfield");
-	    PacketBitField(parent->my_bitfield).Pack(send_buf);
+	    PacketBitField pkt(parent->my_bitfield);
+	    SendPacket(pkt);
 	 }
       } else if(parent->my_bitfield && parent->my_bitfield->has_any_set()) {
 	 LogSend(5,"bitfield");
-	 PacketBitField(parent->my_bitfield).Pack(send_buf);
+	 PacketBitField pkt(parent->my_bitfield);
+	 SendPacket(pkt);
       }
       if(Torrent::listener_udp && DHT_Enabled()) {
 	 int udp_port=Torrent::listener_udp->GetPort();
@@ -2742,7 +3275,7 @@ int TorrentPeer::Do()
 #endif
 	 if(udp_port) {
 	    LogSend(5,xstring::format("port(%d)",udp_port));
-	    PacketPort(udp_port).Pack(send_buf);
+	    SendPacket(PacketPort(udp_port));
 	 }
       }
       keepalive_timer.Reset();
@@ -2750,7 +3283,7 @@ int TorrentPeer::Do()
 
    if(keepalive_timer.Stopped()) {
       LogSend(5,"keep-alive");
-      Packet(MSG_KEEPALIVE).Pack(send_buf);
+      SendPacket(Packet(MSG_KEEPALIVE));
       keepalive_timer.Reset();
    }
 
@@ -2774,7 +3307,7 @@ int TorrentPeer::Do()
    && HasNeededPieces() && parent->NeedMoreUploaders())
       SetAmInterested(true);
 
-   if(am_interested && sent_queue.count()<MAX_QUEUE_LEN)
+   if(am_interested && !SentQueueFull())
       SendDataRequests();
 
    if(peer_interested && am_choking && choke_timer.Stopped()
@@ -2996,13 +3529,58 @@ TorrentPeer::Packet::Packet(packet_type t)
    if(type>=0)
       length+=1;
 }
-void TorrentPeer::Packet::Pack(SMTaskRef<IOBuffer>& b)
+void TorrentPeer::Packet::Pack(SMTaskRef<IOBuffer>& b) const
 {
    b->PackUINT32BE(length);
    if(type>=0)
       b->PackUINT8(type);
 }
 
+void TorrentPeer::SendPacket(const Packet& p)
+{
+   TraceMessage(TraceRing::PACKET_SEND,&p);
+   p.Pack(send_buf);
+}
+
+void TorrentPeer::TraceMessage(TraceRing::event_t e,const Packet *p) const
+{
+   if(!TraceRing::enabled)
+      return;
+   const char *name=p->GetPacketTypeText();
+   switch(p->GetPacketType())
+   {
+   case MSG_HAVE:
+   case MSG_SUGGEST_PIECE:
+   case MSG_ALLOWED_FAST:
+      TracePacket(e,name,1,static_cast<const _PacketPiece*>(p)->piece);
+      break;
+   case MSG_REQUEST:
+   case MSG_CANCEL:
+   case MSG_REJECT_REQUEST: {
+	 const _PacketIBL *pp=static_cast<const _PacketIBL*>(p);
+	 TracePacket(e,name,3,pp->index,pp->begin,pp->req_length);
+	 break;
+      }
+   case MSG_PIECE: {
+	 const PacketPiece *pp=static_cast<const PacketPiece*>(p);
+	 TracePacket(e,name,3,pp->index,pp->begin,pp->send_data?pp->send_len:pp->data.length());
+	 break;
+      }
+   case MSG_PORT:
+      TracePacket(e,name,1,static_cast<const PacketPort*>(p)->port);
+      break;
+   case MSG_EXTENDED:
+      TracePacket(e,name,1,static_cast<const PacketExtended*>(p)->code);
+      break;
+   case MSG_BITFIELD:
+      TracePacket(e,name,1,p->GetLength());
+      break;
+   default:
+      TracePacket(e,name,0);
+      break;
+   }
+}
+
 TorrentPeer::PacketBitField::PacketBitField(const BitField *bf)
    : Packet(MSG_BITFIELD)
 {
@@ -3030,7 +3608,7 @@ void TorrentPeer::PacketBitField::ComputeLength()
    Packet::ComputeLength();
    length+=bitfield->count();
 }
-void TorrentPeer::PacketBitField::Pack(SMTaskRef<IOBuffer>& b)
+void TorrentPeer::PacketBitField::Pack(SMTaskRef<IOBuffer>& b) const
 {
    Packet::Pack(b);
    b->Put((const char*)(bitfield->get()),bitfield->count());
@@ -3057,7 +3635,7 @@ void TorrentPeer::_PacketIBL::ComputeLength()
    Packet::ComputeLength();
    length+=12;
 }
-void TorrentPeer::_PacketIBL::Pack(SMTaskRef<IOBuffer>& b)
+void TorrentPeer::_PacketIBL::Pack(SMTaskRef<IOBuffer>& b) const
 {
    Packet::Pack(b);
    b->PackUINT32BE(index);
@@ -3245,21 +3823,9 @@ int TorrentListener::Do()
    }
 
    if(type==SOCK_DGRAM) {
-      char buf[0x4000];
-      sockaddr_u src;
-      socklen_t src_len=sizeof(src);
-      int res=recvfrom(sock,buf,sizeof(buf),0,&src.sa,&src_len);
-      if(res==-1) {
-	 if(!E_RETRY(errno))
-	    LogError(9,"recvfrom: %s",strerror(errno));
-	 Block(sock,POLLIN);
-	 return m;
-      }
-      if(res==0)
-	 return MOVED;
-      rate.Add(1);
-      Torrent::DispatchUDP(buf,res,src);
-      return MOVED;
+      m|=RecvUDP();
+      m|=FlushUDP();
+      return m;
    }
 
    if(rate.Get()>5 || Torrent::NoTorrentCanAccept())
@@ -3281,6 +3847,118 @@ int TorrentListener::Do()
 
    return m;
 }
+int TorrentListener::RecvUDP()
+{
+   recv_buf.get_space(UDP_BATCH*UDP_MAX_PACKET);
+   char *buf=recv_buf.get_non_const();
+   sockaddr_u src[UDP_BATCH];
+   int len[UDP_BATCH];
+   int count=0;
+#ifdef HAVE_RECVMMSG
+   struct iovec iov[UDP_BATCH];
+   struct mmsghdr msg[UDP_BATCH];
+   memset(msg,0,sizeof(msg));
+   for(int i=0; i<UDP_BATCH; i++) {
+      iov[i].iov_base=buf+i*UDP_MAX_PACKET;
+      iov[i].iov_len=UDP_MAX_PACKET;
+      msg[i].msg_hdr.msg_iov=iov+i;
+      msg[i].msg_hdr.msg_iovlen=1;
+      msg[i].msg_hdr.msg_name=&src[i].sa;
+      msg[i].msg_hdr.msg_namelen=sizeof(src[i]);
+   }
+   count=recvmmsg(sock,msg,UDP_BATCH,MSG_DONTWAIT,0);
+   if(count==-1) {
+      if(!E_RETRY(errno))
+	 LogError(9,"recvmmsg: %s",strerror(errno));
+      Block(sock,POLLIN);
+      return STALL;
+   }
+   for(int i=0; i<count; i++) {
+      len[i]=msg[i].msg_len;
+      if(msg[i].msg_hdr.msg_flags&MSG_TRUNC)
+	 len[i]=-1;
+   }
+#else
+   while(count<UDP_BATCH) {
+      socklen_t src_len=sizeof(src[count]);
+      int res=recvfrom(sock,buf+count*UDP_MAX_PACKET,UDP_MAX_PACKET,MSG_TRUNC,&src[count].sa,&src_len);
+      if(res==-1) {
+	 if(!E_RETRY(errno))
+	    LogError(9,"recvfrom: %s",strerror(errno));
+	 break;
+      }
+      len[count++]=(res>UDP_MAX_PACKET?-1:res);
+   }
+   if(count==0) {
+      Block(sock,POLLIN);
+      return STALL;
+   }
+#endif
+   for(int i=0; i<count; i++) {
+      if(len[i]==0)
+	 continue;
+      rate.Add(1);
+      if(len[i]<0) {
+	 LogError(9,"dropping too long datagram from %s",src[i].to_string());
+	 continue;
+      }
+      Torrent::DispatchUDP(buf+i*UDP_MAX_PACKET,len[i],src[i]);
+   }
+   return MOVED;
+}
+int TorrentListener::FlushUDP()
+{
+   int sent=0;
+   while(sent<send_queue.count()) {
+      const udp_out *out=send_queue.get()+sent;
+#ifdef HAVE_SENDMMSG
+      struct iovec iov[UDP_BATCH];
+      struct mmsghdr msg[UDP_BATCH];
+      int count=send_queue.count()-sent;
+      if(count>UDP_BATCH)
+	 count=UDP_BATCH;
+      memset(msg,0,count*sizeof(*msg));
+      for(int i=0; i<count; i++) {
+	 iov[i].iov_base=send_buf.get_non_const()+out[i].offset;
+	 iov[i].iov_len=out[i].length;
+	 msg[i].msg_hdr.msg_iov=iov+i;
+	 msg[i].msg_hdr.msg_iovlen=1;
+	 msg[i].msg_hdr.msg_name=const_cast<sockaddr*>(&out[i].addr.sa);
+	 msg[i].msg_hdr.msg_namelen=out[i].addr.addr_len();
+      }
+      int res=sendmmsg(sock,msg,count,0);
+      const char *func="sendmmsg";
+#else
+      int res=sendto(sock,send_buf+out->offset,out->length,0,&out->addr.sa,out->addr.addr_len());
+      if(res!=-1)
+	 res=1;
+      const char *func="sendto";
+#endif
+      if(res==-1) {
+	 if(E_RETRY(errno)) {
+	    Block(sock,POLLOUT);
+	    break;
+	 }
+	 // the first datagram has failed, drop it and continue
+	 LogError(0,"%s(%s): %s",func,out->addr.to_string(),strerror(errno));
+	 res=1;
+      }
+      sent+=res;
+   }
+   if(sent==0)
+      return STALL;
+   if(sent==send_queue.count()) {
+      send_queue.truncate();
+      send_buf.truncate();
+   } else {
+      int off=send_queue[sent].offset;
+      send_queue.remove(0,sent);
+      for(int i=0; i<send_queue.count(); i++)
+	 send_queue[i].offset-=off;
+      send_buf.set_substr(0,off,"",0);
+   }
+   return MOVED;
+}
 bool TorrentListener::MaySendUDP()
 {
    // limit udp rate
@@ -3295,35 +3973,33 @@ bool TorrentListener::MaySendUDP()
       last_sent_udp_count=0;
       last_sent_udp=now;
    }
-   // check if output buffer is available
-   struct pollfd pfd;
-   pfd.fd=sock;
-   pfd.events=POLLOUT;
-   pfd.revents=0;
-   int res=poll(&pfd,1,0);
-   if(res>0)
-      return true;
-   Block(sock,POLLOUT);
-   return false;
+   // the queue is flushed by Do, wait for it if it is full
+   return send_queue.count()<UDP_MAX_SEND_QUEUE;
 }
 int TorrentListener::SendUDP(const sockaddr_u& a,const xstring& buf)
 {
-   int res=sendto(sock,buf,buf.length(),0,&a.sa,a.addr_len());
-   if(res==-1)
-      LogError(0,"sendto(%s): %s",a.to_string(),strerror(errno));
-   return res;
+   if(sock==-1 || send_queue.count()>=UDP_MAX_SEND_QUEUE)
+      return -1;
+   udp_out out;
+   out.addr=a;
+   out.offset=send_buf.length();
+   out.length=buf.length();
+   send_queue.append(out);
+   send_buf.append(buf);
+   Timeout(0);	  // the queue is flushed on the next scheduler pass
+   return buf.length();
 }
 
 void Torrent::DispatchUDP(const char *buf,int len,const sockaddr_u& src)
 {
    int rest;
    if(buf[0]=='d' && buf[len-1]=='e' && dht) {
-      Ref<BeNode> msg(BeNode::Parse(buf,len,&rest));
-      if(!msg)
+      static BeView msg;
+      if(!msg.Parse(buf,len,&rest) || msg.Type(0)!=BeNode::BE_DICT)
 	 goto unknown;
       const SMTaskRef<DHT> &d=Torrent::GetDHT(src);
       d->Enter();
-      d->HandlePacket(msg.get_non_const(),src);
+      d->HandlePacket(msg,src);
       d->Leave();
    } else if(buf[0]==0x41) {
       LogRecv(9,xstring::format("uTP SYN v1 from %s {%s}",src.to_string(),xstring::get_tmp(buf,len).hexdump()));
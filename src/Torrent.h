@@ -20,6 +20,7 @@
 #ifndef TORRENT_H
 #define TORRENT_H
 
+#include <sha1.h>
 #include "FileAccess.h"
 #include "Bencode.h"
 #include "Error.h"
@@ -68,6 +69,21 @@ struct TorrentPiece
    bool has_a_downloader() const;
 };
 
+// Piece data kept in memory. Blocks of a new piece are assembled here and
+// hashed as they arrive, the complete piece is written at once. Complete
+// pieces stay here to serve uploads until evicted.
+struct TorrentPieceBuffer
+{
+   unsigned piece;
+   bool dirty;		 // has blocks not written to disk
+   unsigned hashed;	 // length of the prefix fed to sha1
+   struct sha1_ctx sha1;
+   xstring data;
+   Time last_used;
+
+   TorrentPieceBuffer(unsigned p,unsigned len);
+};
+
 class TorrentListener : public SMTask, protected ProtoLog, protected Networker
 {
    Ref<Error> error;
@@ -79,6 +95,21 @@ class TorrentListener : public SMTask, protected ProtoLog, protected Networker
    void FillAddress(int port);
    Time last_sent_udp;
    int  last_sent_udp_count;
+
+   // datagrams are received and sent in batches of up to UDP_BATCH
+   static const int UDP_BATCH = 32;
+   static const int UDP_MAX_PACKET = 0x1000;
+   static const int UDP_MAX_SEND_QUEUE = 256;
+   xstring recv_buf;
+   struct udp_out {
+      sockaddr_u addr;
+      int offset;
+      int length;
+   };
+   xarray<udp_out> send_queue;   // outgoing datagrams queued during this tick
+   xstring send_buf;		 // their data, concatenated
+   int RecvUDP();
+   int FlushUDP();
 public:
    TorrentListener(int a,int type=SOCK_STREAM);
    ~TorrentListener();
@@ -109,6 +140,15 @@ class Torrent : public SMTask, protected ProtoLog, public ResClient
    unsigned validate_index;
    Ref<Error> invalid_cause;
 
+   // fast resume: piece bitfield saved with the files' sizes and mtimes,
+   // pieces of unchanged files are not validated again.
+   Ref<BitField> resume_trusted;
+   bool resume_dirty;
+   Timer resume_save_timer;
+   const char *GetResumeFile() const;
+   void LoadResume();
+   void SaveResume();
+
    static const unsigned PEER_ID_LEN = 20;
    static xstring my_peer_id;
    static xstring my_key;
@@ -232,7 +272,21 @@ class Torrent : public SMTask, protected ProtoLog, public ResClient
    void CloseFile(const char *f) const;
 
    void StoreBlock(unsigned piece,unsigned begin,unsigned len,const char *buf,TorrentPeer *src_peer);
+   bool WriteBlock(unsigned piece,unsigned begin,unsigned len,const char *buf);
    const xstring& RetrieveBlock(unsigned piece,unsigned begin,unsigned len);
+   const xstring& RetrieveCachedBlock(unsigned piece,unsigned begin,unsigned len);
+   bool use_mmap;
+   const char *MapBlock(unsigned piece,unsigned begin,unsigned len);
+
+   xarray_p<TorrentPieceBuffer> piece_cache;	// LRU order, last is newest
+   static unsigned long long piece_cache_size;	// total for all torrents
+   static unsigned long long piece_cache_max;
+   TorrentPieceBuffer *FindCachedPiece(unsigned piece);
+   TorrentPieceBuffer *NewCachedPiece(unsigned piece);
+   static Torrent *FindOldestCachedPiece(bool clean_only,int *index);
+   bool FlushCachedPiece(TorrentPieceBuffer *pb);
+   void DropCachedPiece(int i);
+   void FlushPieceCache();
 
    Speedometer recv_rate;
    Speedometer send_rate;
@@ -253,7 +307,6 @@ class Torrent : public SMTask, protected ProtoLog, public ResClient
    Timer seed_timer;
 
    Timer decline_timer;
-   Timer optimistic_unchoke_timer;
    Timer peers_scan_timer;
    Timer am_interested_timer;
 
@@ -262,16 +315,22 @@ class Torrent : public SMTask, protected ProtoLog, public ResClient
    static const int max_uploaders = 20;
    static const int min_uploaders = 1;
    static const int max_downloaders = 20;
-   static const int min_downloaders = 4;
+
+   // choking is scheduled over the peers of all torrents at once
+   static int upload_slots;
+   static Timer unchoke_timer;
+   static Timer optimistic_unchoke_timer;
+   static void ScheduleUnchokes();
+   static void OptimisticUnchoke(const xarray<TorrentPeer*>& candidates);
+   static int PeersCompareUnchoke(TorrentPeer *const*p1,TorrentPeer *const*p2);
+   bool NeedsUpload() const;
+   float UnchokeRate(const TorrentPeer *peer) const;
 
    bool NeedMoreUploaders();
    bool AllowMoreDownloaders();
-   void UnchokeBestUploaders();
    void ScanPeers();
-   void OptimisticUnchoke();
    void ReducePeers();
    void ReduceUploaders();
-   void ReduceDownloaders();
 
    int PeerBytesAllowed(const TorrentPeer *peer,RateLimit::dir_t dir);
    void PeerBytesUsed(int b,RateLimit::dir_t dir);
@@ -302,6 +361,7 @@ public:
 
    static void SHA1(const xstring& str,xstring& buf);
    void ValidatePiece(unsigned p);
+   void SetPieceValid(unsigned p,bool valid);
    unsigned PieceLength(unsigned p) const { return p==total_pieces-1 ? last_piece_length : piece_length; }
    unsigned BlocksInPiece(unsigned p) const { return (PieceLength(p)+BLOCK_SIZE-1)/BLOCK_SIZE; }
 
@@ -367,8 +427,21 @@ class FDCache : public SMTask, public ResClient
    xmap<FD> cache[3];
    Timer clean_timer;
 
+   // read-only mappings of complete files
+   struct Map
+   {
+      const char *addr;
+      size_t size;
+      time_t last_used;
+   };
+   int max_mapped;
+   xmap<Map> maps;
+   void Unmap(const xstring& name);
+   bool UnmapOne();
+
 public:
    int OpenFile(const char *name,int mode,off_t size=0);
+   const char *MapFile(const char *name,size_t *size);
    void Close(const char *name);
    int Count() const;
    void Clean();
@@ -491,7 +564,7 @@ public:
       Packet(packet_type t);
       Packet() { length=0; }
       virtual void ComputeLength() { length=(type>=0); }
-      virtual void Pack(SMTaskRef<IOBuffer>& b);
+      virtual void Pack(SMTaskRef<IOBuffer>& b) const;
       virtual unpack_status_t Unpack(const Buffer *b);
       virtual ~Packet() {}
       int GetLength() const { return length; }
@@ -517,7 +590,7 @@ public:
 	    return UNPACK_SUCCESS;
 	 }
       void ComputeLength() { Packet::ComputeLength(); length+=4; }
-      void Pack(SMTaskRef<IOBuffer>& b) { Packet::Pack(b); b->PackUINT32BE(piece); }
+      void Pack(SMTaskRef<IOBuffer>& b) const { Packet::Pack(b); b->PackUINT32BE(piece); }
    };
    class PacketHave : public _PacketPiece {
    public:
@@ -532,7 +605,7 @@ public:
       ~PacketBitField();
       unpack_status_t Unpack(const Buffer *b);
       void ComputeLength();
-      void Pack(SMTaskRef<IOBuffer>& b);
+      void Pack(SMTaskRef<IOBuffer>& b) const;
    };
    class _PacketIBL : public Packet
    {
@@ -541,11 +614,12 @@ public:
       _PacketIBL(packet_type t,unsigned i,unsigned b,unsigned l);
       unpack_status_t Unpack(const Buffer *b);
       void ComputeLength();
-      void Pack(SMTaskRef<IOBuffer>& b);
+      void Pack(SMTaskRef<IOBuffer>& b) const;
    };
    class PacketRequest : public _PacketIBL
    {
    public:
+      Time sent_time;
       PacketRequest(unsigned i=0,unsigned b=0,unsigned l=0)
 	 : _PacketIBL(MSG_REQUEST,i,b,l) {}
    };
@@ -559,9 +633,11 @@ public:
    public:
       unsigned index,begin;
       xstring data;
-      PacketPiece() : Packet(MSG_PIECE), index(0), begin(0) {}
-      PacketPiece(unsigned i,unsigned b,const xstring &s)
-	 : Packet(MSG_PIECE), index(i), begin(b) { data.set(s); length+=8+data.length(); }
+      const char *send_data;	// outgoing data, not copied
+      unsigned send_len;
+      PacketPiece() : Packet(MSG_PIECE), index(0), begin(0), send_data(0), send_len(0) {}
+      PacketPiece(unsigned i,unsigned b,const char *s,unsigned len)
+	 : Packet(MSG_PIECE), index(i), begin(b), send_data(s), send_len(len) { length+=8+len; }
       unpack_status_t Unpack(const Buffer *b)
 	 {
 	    unpack_status_t res;
@@ -575,12 +651,15 @@ public:
 	    unpacked+=bytes;
 	    return UNPACK_SUCCESS;
 	 }
-      void ComputeLength() { Packet::ComputeLength(); length+=8+data.length(); }
-      void Pack(SMTaskRef<IOBuffer>& b) {
+      void ComputeLength() { Packet::ComputeLength(); length+=8+(send_data?send_len:data.length()); }
+      void Pack(SMTaskRef<IOBuffer>& b) const {
 	 Packet::Pack(b);
 	 b->PackUINT32BE(index);
 	 b->PackUINT32BE(begin);
-	 b->Put(data);
+	 if(send_data)
+	    b->Put(send_data,send_len);
+	 else
+	    b->Put(data);
       }
    };
    class PacketPort : public Packet
@@ -599,7 +678,7 @@ public:
 	    return UNPACK_SUCCESS;
 	 }
       void ComputeLength() { Packet::ComputeLength(); length+=2; }
-      void Pack(SMTaskRef<IOBuffer>& b) { Packet::Pack(b); b->PackUINT16BE(port); }
+      void Pack(SMTaskRef<IOBuffer>& b) const { Packet::Pack(b); b->PackUINT16BE(port); }
    };
    class PacketSuggestPiece : public _PacketPiece {
    public:
@@ -637,19 +716,29 @@ public:
 	    return res;
 	 }
       void ComputeLength() { Packet::ComputeLength(); length++; if(data) length+=data->ComputeLength(); length+=appendix.length(); }
-      void Pack(SMTaskRef<IOBuffer>& b) { Packet::Pack(b); b->PackUINT8(code); if(data) data->Pack(b); }
+      void Pack(SMTaskRef<IOBuffer>& b) const { Packet::Pack(b); b->PackUINT8(code); if(data) data->Pack(b); }
       void SetAppendix(const char *s,int len) { appendix.nset(s,len); length+=len; }
    };
 
 private:
    unpack_status_t UnpackPacket(SMTaskRef<IOBuffer>& ,Packet **);
    void HandlePacket(Packet *);
+   void SendPacket(const Packet& p);
+   void TraceMessage(TraceRing::event_t e,const Packet *p) const;
    void HandleExtendedMessage(PacketExtended *);
 
-   static const int MAX_QUEUE_LEN = 16;
+   static const int MAX_QUEUE_LEN = 256;
+   static const int MIN_QUEUE_LEN = 16;
    RefQueue<PacketRequest> recv_queue;
    RefQueue<PacketRequest> sent_queue;
 
+   // the request pipeline depth follows the bandwidth-delay product.
+   int queue_len;	// current limit of sent_queue
+   int peer_reqq;	// limit advertised by the peer
+   double block_rtt;	// base latency of a block request, seconds
+   void UpdateQueueLen(const PacketRequest *req);
+   bool SentQueueFull() const { return sent_queue.count()>=queue_len; }
+
    unsigned last_piece;
    static const unsigned NO_PIECE = ~0U;
    void SetLastPiece(unsigned p);
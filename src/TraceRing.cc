@@ -0,0 +1,290 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2013 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include "TraceRing.h"
+#include "SMTask.h"
+#include "SignalHook.h"
+#include "misc.h"
+
+// the compiler must not move record stores across the seq store.
+#ifdef __GNUC__
+# define TRACE_BARRIER() __asm__ __volatile__("":::"memory")
+#else
+# define TRACE_BARRIER()
+#endif
+
+TraceRing::record *TraceRing::ring;
+int TraceRing::time_offset;
+unsigned TraceRing::ring_mask;
+volatile unsigned TraceRing::head=1;
+char TraceRing::dump_file[1024];
+bool TraceRing::enabled;
+TraceRing TraceRing::config;
+
+static const int crash_signals[]={
+   SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT, 0
+};
+
+TraceRing::record *TraceRing::Claim(unsigned session,event_t type,unsigned *seq)
+{
+   unsigned s=head++;
+   if(s==0) // zero marks a record being written
+      s=head++;
+   record *r=&ring[s&ring_mask];
+   r->seq=0;
+   TRACE_BARRIER();
+   r->session=session;
+   r->msec=(long long)SMTask::now.UnixTime()*1000+SMTask::now.MilliSecond();
+   r->type=type;
+   r->len=0;
+   r->nargs=0;
+   *seq=s;
+   return r;
+}
+void TraceRing::Publish(record *r,unsigned seq)
+{
+   TRACE_BARRIER();
+   r->seq=seq;
+}
+
+void TraceRing::AddText(unsigned session,event_t type,const char *s,int len)
+{
+   if(!ring)
+      return;
+   if(len<0)
+      len=strlen(s);
+   while(len>0 && (s[len-1]=='\n' || s[len-1]=='\r'))
+      len--;
+   if(len>TEXT_SIZE)
+      len=TEXT_SIZE;
+   unsigned seq;
+   record *r=Claim(session,type,&seq);
+   memcpy(r->text,s,len);
+   r->len=len;
+   Publish(r,seq);
+}
+
+void TraceRing::AddPacket(unsigned session,event_t type,const char *name,
+   int nargs,unsigned a0,unsigned a1,unsigned a2)
+{
+   if(!ring)
+      return;
+   unsigned seq;
+   record *r=Claim(session,type,&seq);
+   r->pkt.name=name;
+   r->pkt.arg[0]=a0;
+   r->pkt.arg[1]=a1;
+   r->pkt.arg[2]=a2;
+   r->nargs=(nargs>MAX_ARGS?MAX_ARGS:nargs);
+   Publish(r,seq);
+}
+
+// The dump can run in a signal handler, where stdio and localtime are
+// not safe; these append to buf and stop at end.
+static char *put_str(char *p,char *end,const char *s,int len)
+{
+   while(len-->0 && p<end)
+      *p++=*s++;
+   return p;
+}
+static char *put_str(char *p,char *end,const char *s)
+{
+   return put_str(p,end,s,strlen(s));
+}
+// width pads with zeros
+static char *put_uint(char *p,char *end,unsigned long long n,int width=1)
+{
+   char digits[24];
+   int len=0;
+   do {
+      digits[sizeof(digits)-++len]='0'+n%10;
+      n/=10;
+   } while(n>0 || len<width);
+   return put_str(p,end,digits+sizeof(digits)-len,len);
+}
+
+// the local time offset, taken outside of signal handlers.
+void TraceRing::UpdateTimeOffset()
+{
+   time_t t=time(0);
+   struct tm tm;
+   localtime_r(&t,&tm);
+   struct tm utc;
+   gmtime_r(&t,&utc);
+   int d=(tm.tm_yday-utc.tm_yday);
+   if(d>1)	  // new year between the two
+      d=-1;
+   else if(d<-1)
+      d=1;
+   time_offset=((d*24+tm.tm_hour-utc.tm_hour)*60+tm.tm_min-utc.tm_min)*60;
+}
+
+int TraceRing::FormatRecord(const record *r,char *buf,int size)
+{
+   static const char *const prefix[]={
+      "==== connecting to ", "---- ", "---> ", "<--- ", "---> ", "<--- ",
+   };
+   if(r->type>PACKET_RECV)
+      return 0;
+
+   char *p=buf;
+   char *end=buf+size;
+   long long t=r->msec/1000+time_offset;
+   int day_sec=(t%86400+86400)%86400;
+   p=put_uint(p,end,day_sec/3600,2);
+   p=put_str(p,end,":",1);
+   p=put_uint(p,end,day_sec/60%60,2);
+   p=put_str(p,end,":",1);
+   p=put_uint(p,end,day_sec%60,2);
+   p=put_str(p,end,".",1);
+   p=put_uint(p,end,r->msec%1000,3);
+   p=put_str(p,end," #",2);
+   p=put_uint(p,end,r->session);
+   p=put_str(p,end," ",1);
+   p=put_str(p,end,prefix[r->type]);
+   if(r->type==PACKET_SEND || r->type==PACKET_RECV)
+   {
+      p=put_str(p,end,r->pkt.name?r->pkt.name:"?");
+      for(int i=0; i<r->nargs; i++)
+      {
+	 p=put_str(p,end," ",1);
+	 p=put_uint(p,end,r->pkt.arg[i]);
+      }
+   }
+   else
+      p=put_str(p,end,r->text,r->len);
+   if(p==end)
+      p--;
+   *p++='\n';
+   return p-buf;
+}
+
+unsigned TraceRing::Count()
+{
+   if(!ring)
+      return 0;
+   unsigned h=head;
+   return h-1<=ring_mask ? h-1 : ring_mask+1;
+}
+
+void TraceRing::Dump(int fd)
+{
+   UpdateTimeOffset();
+   DumpRecords(fd);
+}
+void TraceRing::DumpRecords(int fd)
+{
+   char buf[256];
+   char *p=put_str(buf,buf+sizeof(buf),"---- trace dump, ");
+   p=put_uint(p,buf+sizeof(buf),Count());
+   p=put_str(p,buf+sizeof(buf)," record(s)\n");
+   write(fd,buf,p-buf);
+   if(!ring)
+      return;
+   unsigned end=head;
+   unsigned start=(end-1>ring_mask ? end-ring_mask-1 : 1);
+   for(unsigned s=start; s!=end; s++)
+   {
+      const record *r=&ring[s&ring_mask];
+      if(r->seq!=s)
+	 continue;   // overwritten or being written
+      int n=FormatRecord(r,buf,sizeof(buf));
+      if(n>0)
+	 write(fd,buf,n);
+   }
+}
+
+void TraceRing::SignalDump(int sig)
+{
+   int fd=2;
+   if(dump_file[0])
+      fd=open(dump_file,O_WRONLY|O_CREAT|O_APPEND,0600);
+   if(fd==-1)
+      return;
+   DumpRecords(fd);
+   if(fd!=2)
+      close(fd);
+}
+void TraceRing::CrashDump(int sig)
+{
+   SignalDump(sig);
+   SignalHook::Default(sig);
+   raise(sig);
+}
+
+void TraceRing::HookSignals(bool on)
+{
+   SignalHook::ClassInit();
+   if(on)
+   {
+      SignalHook::Handle(SIGUSR2,SignalDump);
+      for(int i=0; crash_signals[i]; i++)
+	 SignalHook::Handle(crash_signals[i],CrashDump);
+   }
+   else
+   {
+      SignalHook::Restore(SIGUSR2);
+      for(int i=0; crash_signals[i]; i++)
+	 SignalHook::Restore(crash_signals[i]);
+   }
+}
+
+void TraceRing::Resize(unsigned size)
+{
+   unsigned n=16;
+   while(n<size && n<(1U<<24))
+      n<<=1;
+   if(ring && n==ring_mask+1)
+      return;
+   record *old=ring;
+   ring=0;
+   record *r=new record[n];
+   memset(r,0,n*sizeof(*r));
+   head=1;
+   ring_mask=n-1;
+   ring=r;
+   delete[] old;
+}
+
+void TraceRing::Reconfig(const char *name)
+{
+   if(name && strncmp(name,"log:trace",9))
+      return;
+
+   const char *file=ResMgr::Query("log:trace-file",0);
+   strncpy(dump_file,file?file:"",sizeof(dump_file)-1);
+
+   bool on=ResMgr::QueryBool("log:trace",0);
+   if(on)
+   {
+      Resize(ResMgr::Query("log:trace-size",0));
+      UpdateTimeOffset();
+   }
+   if(on!=enabled)
+   {
+      HookSignals(on);
+      enabled=on;
+   }
+}
@@ -0,0 +1,98 @@
+/*
+ * lftp - file transfer program
+ *
+ * Copyright (c) 1996-2013 by Alexander V. Lukyanov (lav@yars.free.net)
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TRACERING_H
+#define TRACERING_H
+
+#include "ResMgr.h"
+
+// In-memory protocol trace. Events are stored as fixed-size binary
+// records in a ring buffer and formatted only when the ring is dumped
+// (by `debug dump', on SIGUSR2 or on a fatal signal). The writer never
+// blocks or allocates; every record carries its sequence number, which is
+// written last, so a dump from a signal handler skips partially written
+// or overwritten records instead of locking.
+class TraceRing : public ResClient
+{
+public:
+   enum event_t
+   {
+      CONNECT,		// text: peer being connected to
+      NOTE,		// text
+      SEND,		// text: command line sent
+      RECV,		// text: reply line received
+      PACKET_SEND,	// binary: packet name and up to 3 arguments
+      PACKET_RECV,
+   };
+   enum { TEXT_SIZE=40, MAX_ARGS=3 };
+
+private:
+   struct record
+   {
+      volatile unsigned seq;
+      unsigned session;
+      long long msec;
+      unsigned char type;
+      unsigned char len;
+      unsigned char nargs;
+      union {
+	 char text[TEXT_SIZE];
+	 struct {
+	    const char *name;	// must point to static storage
+	    unsigned arg[MAX_ARGS];
+	 } pkt;
+      };
+   };
+
+   static record *ring;
+   static unsigned ring_mask;
+   static volatile unsigned head;
+   static char dump_file[1024];
+   static int time_offset;	// of local time from UTC, in seconds
+
+   static record *Claim(unsigned session,event_t type,unsigned *seq);
+   static void Publish(record *r,unsigned seq);
+   static void UpdateTimeOffset();
+   static int FormatRecord(const record *r,char *buf,int size);
+   static void DumpRecords(int fd);
+   static void SignalDump(int sig);
+   static void CrashDump(int sig);
+   static void Resize(unsigned size);
+   static void HookSignals(bool on);
+
+   static TraceRing config;
+   TraceRing() {}
+
+protected:
+   void Reconfig(const char *name);
+
+public:
+   static bool enabled;
+
+   static void AddText(unsigned session,event_t type,const char *s,int len=-1);
+   static void AddPacket(unsigned session,event_t type,const char *name,
+      int nargs,unsigned a0=0,unsigned a1=0,unsigned a2=0);
+
+   // The signal handlers format records without stdio or localtime,
+   // using the local time offset of the last Reconfig or Dump.
+   static void Dump(int fd);
+   static unsigned Count();
+};
+
+#endif//TRACERING_H
@@ -0,0 +1,178 @@
+/*
+	Microbenchmark of DHT packet decoding: typical KRPC messages are
+	parsed with BeNode::Parse (a tree) and with BeView (a flat view),
+	and the fields DHT::HandlePacket needs are looked up.
+
+	Build with `make bencode-bench' and run as
+	   ./bencode-bench [iterations]
+	Times are the best of several rounds, in nanoseconds per packet.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "Bencode.h"
+
+char *program_name;
+
+static double now_ns()
+{
+   struct timeval tv;
+   gettimeofday(&tv,0);
+   return tv.tv_sec*1e9+tv.tv_usec*1e3;
+}
+
+static void random_str(xstring& s,int len)
+{
+   s.truncate();
+   for(int i=0; i<len; i++)
+      s.append(char(random()));
+}
+
+static void make_query(xstring& pkt)
+{
+   xstring id,hash;
+   random_str(id,20);
+   random_str(hash,20);
+   BeEncoder e(&pkt);
+   e.Dict();
+      e.Key("a");
+      e.Dict();
+	 e.Key("id"); e.Str(id);
+	 e.Key("info_hash"); e.Str(hash);
+      e.End();
+      e.Key("q"); e.Str("get_peers");
+      e.Key("t"); e.Str("aa");
+      e.Key("y"); e.Str("q");
+   e.End();
+}
+
+static void make_nodes_reply(xstring& pkt)
+{
+   xstring id,nodes;
+   random_str(id,20);
+   random_str(nodes,8*26);
+   BeEncoder e(&pkt);
+   e.Dict();
+      e.Key("r");
+      e.Dict();
+	 e.Key("id"); e.Str(id);
+	 e.Key("nodes"); e.Str(nodes);
+      e.End();
+      e.Key("t"); e.Str("aa");
+      e.Key("y"); e.Str("r");
+   e.End();
+}
+
+static void make_peers_reply(xstring& pkt)
+{
+   xstring id,token,peer;
+   random_str(id,20);
+   random_str(token,8);
+   BeEncoder e(&pkt);
+   e.Dict();
+      e.Key("r");
+      e.Dict();
+	 e.Key("id"); e.Str(id);
+	 e.Key("token"); e.Str(token);
+	 e.Key("values");
+	 e.List();
+	 for(int i=0; i<50; i++) {
+	    random_str(peer,6);
+	    e.Str(peer);
+	 }
+	 e.End();
+      e.End();
+      e.Key("t"); e.Str("aa");
+      e.Key("y"); e.Str("r");
+   e.End();
+}
+
+// look up what HandlePacket looks at first, so that lazy decoding
+// does not get an unfair advantage.
+static long use_tree(BeNode *p)
+{
+   long sum=p->lookup_str("y").length()+p->lookup_str("t").length();
+   BeNode *a=p->lookup("a",BeNode::BE_DICT);
+   if(!a)
+      a=p->lookup("r",BeNode::BE_DICT);
+   if(a) {
+      sum+=a->lookup_str("id").length();
+      BeNode *v=a->lookup("values",BeNode::BE_LIST);
+      for(int i=0; v && i<v->list.count(); i++)
+	 sum+=v->list[i]->str.length();
+   }
+   return sum;
+}
+static long use_view(const BeView& p)
+{
+   int len;
+   long sum=0;
+   if(p.LookupStr(0,"y",&len))
+      sum+=len;
+   if(p.LookupStr(0,"t",&len))
+      sum+=len;
+   int a=p.Lookup(0,"a",BeNode::BE_DICT);
+   if(a<0)
+      a=p.Lookup(0,"r",BeNode::BE_DICT);
+   if(a>=0) {
+      if(p.LookupStr(a,"id",&len))
+	 sum+=len;
+      int v=p.Lookup(a,"values",BeNode::BE_LIST);
+      if(v>=0) {
+	 int w=p.First(v);
+	 for(int i=0; i<p[v].count; i++, w=p.Next(w))
+	    sum+=p[w].len;
+      }
+   }
+   return sum;
+}
+
+enum { ROUNDS=5 };
+
+static void bench(const char *name,const xstring& pkt,int n)
+{
+   double best_tree=1e30,best_view=1e30;
+   long sum=0;
+   BeView view;
+   for(int r=0; r<ROUNDS; r++) {
+      double t0=now_ns();
+      for(int i=0; i<n; i++) {
+	 int rest;
+	 BeNode *p=BeNode::Parse(pkt,pkt.length(),&rest);
+	 sum+=use_tree(p);
+	 delete p;
+      }
+      double t1=now_ns();
+      for(int i=0; i<n; i++) {
+	 int rest;
+	 if(view.Parse(pkt,pkt.length(),&rest))
+	    sum+=use_view(view);
+      }
+      double t2=now_ns();
+      if(t1-t0<best_tree)
+	 best_tree=t1-t0;
+      if(t2-t1<best_view)
+	 best_view=t2-t1;
+   }
+   printf("%-18s %6d %10.1f %10.1f%s\n",name,(int)pkt.length(),
+      best_tree/n,best_view/n,sum==-1?" ":"");
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+   int n=(argc>1?atoi(argv[1]):100000);
+   srandom(1);
+   xstring query,nodes,peers;
+   make_query(query);
+   make_nodes_reply(nodes);
+   make_peers_reply(peers);
+   printf("ns per packet, best of %d rounds of %d\n",ROUNDS,n);
+   printf("%-18s %6s %10s %10s\n","packet","bytes","BeNode","BeView");
+   bench("get_peers query",query,n);
+   bench("find_node reply",nodes,n);
+   bench("get_peers values",peers,n);
+   return 0;
+}
@@ -19,6 +19,7 @@
 
 #include <config.h>
 #include <errno.h>
+#include <limits.h>
 #include "buffer.h"
 #include "FileAccess.h"
 #include "misc.h"
@@ -346,6 +347,89 @@ void DirectedBuffer::SetTranslation(const char *enc,bool translit)
 }
 #endif //HAVE_ICONV
 
+#if USE_ZLIB
+DataInflator::DataInflator()
+{
+   memset(&z,0,sizeof(z));
+   inited=false;
+   stream_end=false;
+}
+DataInflator::~DataInflator()
+{
+   if(inited)
+      inflateEnd(&z);
+}
+void DataInflator::ResetTranslation()
+{
+   Empty();
+   if(inited)
+      inflateEnd(&z);
+   inited=false;
+   stream_end=false;
+}
+void DataInflator::PutTranslated(Buffer *target,const char *put_buf,int size)
+{
+   bool from_untranslated=false;
+   if(Size()>0)
+   {
+      Put(put_buf,size);
+      Get(&put_buf,&size);
+      from_untranslated=true;
+   }
+   if(size<=0 || Error())
+      return;
+   if(!inited)
+   {
+      // "deflate" is sometimes sent without zlib header, detect it.
+      if(size<2)
+      {
+	 if(!from_untranslated)
+	    Put(put_buf,size);
+	 return;
+      }
+      unsigned char b0=put_buf[0];
+      unsigned char b1=put_buf[1];
+      bool wrapped=(b0==0x1f && b1==0x8b) || ((b0&0x0f)==Z_DEFLATED && (b0*256+b1)%31==0);
+      if(inflateInit2(&z,wrapped?15+32:-15)!=Z_OK)
+      {
+	 SetError("inflateInit2 failed",true);
+	 return;
+      }
+      inited=true;
+   }
+   z.next_in=(Bytef*)put_buf;
+   z.avail_in=size;
+   while(z.avail_in>0)
+   {
+      if(stream_end)
+      {
+	 // only another gzip member may follow, ignore trailing garbage.
+	 if(*z.next_in!=0x1f)
+	 {
+	    z.avail_in=0;
+	    break;
+	 }
+	 inflateReset(&z);
+	 stream_end=false;
+      }
+      const int out_size=0x10000;
+      z.next_out=(Bytef*)target->GetSpace(out_size);
+      z.avail_out=out_size;
+      int res=inflate(&z,Z_NO_FLUSH);
+      target->SpaceAdd(out_size-z.avail_out);
+      if(res==Z_STREAM_END)
+	 stream_end=true;
+      else if(res!=Z_OK)
+      {
+	 SetError(xstring::format("inflate: %s",z.msg?z.msg:"error"),true);
+	 break;
+      }
+   }
+   if(from_untranslated)
+      Skip(size);
+}
+#endif //USE_ZLIB
+
 void DirectedBuffer::ResetTranslation()
 {
    if(translator)
@@ -383,12 +467,92 @@ void DirectedBuffer::EmbraceNewData(int len)
 }
 
 
+// BufferMemory implementation
+ResDecl memory_limit("xfer:memory-limit","0",ResMgr::UNumberValidate,ResMgr::NoClosure);
+
+BufferMemory *BufferMemory::instance;
+
+BufferMemory::BufferMemory()
+   : limit(0), used(0), high_water(0), holders(0), waits(0)
+{
+   Reconfig("xfer:memory-limit");
+}
+
+void BufferMemory::Reconfig(const char *name)
+{
+   if(!xstrcmp(name,"xfer:memory-limit"))
+      limit=memory_limit.Query(0).to_unumber(LLONG_MAX);
+}
+
+void BufferMemory::Charge(int& charged,int size)
+{
+   if(charged>0)
+      holders--;
+   if(size>0)
+      holders++;
+   used+=size-charged;
+   charged=size;
+   if(used>high_water)
+      high_water=used;
+}
+
+int BufferMemory::Allowance(int charged,int size) const
+{
+   if(limit==0)
+      return size;
+   long long room=limit-used;
+   // a buffer under its equal share can always read, this way
+   // the budget cannot be locked up by the buffers which do not drain.
+   long long share=limit/(holders+(charged>0?0:1))-charged;
+   if(room<share)
+      room=share;
+   if(room<=0)
+      return 0;
+   if(room<size)
+      size=room;
+   return size;
+}
+
+xstring& BufferMemory::FormatStatus(xstring& s,const char *prefix) const
+{
+   if(high_water==0)
+      return s;
+   s.appendf("%s%s: %lld %s, %lld %s",prefix,_("Transfer buffers"),
+      used,_("bytes used"),high_water,_("peak"));
+   if(limit>0)
+      s.appendf(", %lld %s, %llu %s",limit,_("limit"),waits,_("reads deferred"));
+   s.append('\n');
+   return s;
+}
+
 IOBuffer::IOBuffer(dir_t m)
-   : DirectedBuffer(m), event_time(now), max_buf(0)
+   : DirectedBuffer(m), event_time(now), max_buf(0),
+     mem_charged(0), mem_wait(false)
 {
 }
 IOBuffer::~IOBuffer()
 {
+   if(mem_charged)
+      BufferMemory::GetInstance()->Charge(mem_charged,0);
+}
+
+int IOBuffer::ReadAllowance(int size)
+{
+   Charge();
+   BufferMemory *mem=BufferMemory::GetInstance();
+   size=mem->Allowance(mem_charged,size);
+   if(size>0)
+   {
+      mem_wait=false;
+      return size;
+   }
+   // don't poll the source until the memory is released;
+   // draining buffers make the scheduler loop, timeout is a safety net.
+   if(!mem_wait)
+      mem->Wait();
+   mem_wait=true;
+   TimeoutS(1);
+   return 0;
 }
 
 void IOBuffer::Put(const char *buf,int size)
@@ -419,6 +583,7 @@ int IOBuffer::Do()
    if(Done() || Error())
       return STALL;
    int res=0;
+   int size;
    switch(mode)
    {
    case PUT:
@@ -430,6 +595,7 @@ int IOBuffer::Do()
 	 RateAdd(res);
 	 buffer_ptr+=res;
 	 event_time=now;
+	 Charge();
 	 return MOVED;
       }
       break;
@@ -437,11 +603,15 @@ int IOBuffer::Do()
    case GET:
       if(eof)
 	 return STALL;
-      res=Get_LL(GET_BUFSIZE);
+      size=ReadAllowance(GET_BUFSIZE);
+      if(size==0)
+	 return STALL;
+      res=Get_LL(size);
       if(res>0)
       {
 	 EmbraceNewData(res);
 	 event_time=now;
+	 Charge();
 	 return MOVED;
       }
       if(eof)
@@ -490,6 +660,7 @@ int IOBufferStacked::Do()
 	 m=MOVED;
 	 down->Do();
       }
+      Charge();
       break;
 
    case GET:
@@ -502,6 +673,7 @@ int IOBufferStacked::Do()
 	 EmbraceNewData(res);
 	 m=MOVED;
       }
+      Charge();
       if(eof)
 	 m=MOVED;
       if(down->Error())
@@ -26,6 +26,7 @@
 #include "fg.h"
 #include "xstring.h"
 #include "Speedometer.h"
+#include "ResMgr.h"
 
 #include <stdarg.h>
 
@@ -34,6 +35,9 @@ CDECL_BEGIN
 # include <iconv.h>
 CDECL_END
 #endif
+#if USE_ZLIB
+# include <zlib.h>
+#endif
 
 #define GET_BUFSIZE 0x10000
 #define PUT_LL_MIN  0x2000
@@ -156,6 +160,22 @@ public:
 };
 #endif //HAVE_ICONV
 
+#if USE_ZLIB
+// decodes gzip, zlib or raw deflate stream (HTTP content coding)
+class DataInflator : public DataTranslator
+{
+   z_stream z;
+   bool inited;
+   bool stream_end;
+public:
+   void PutTranslated(Buffer *dst,const char *buf,int size);
+   void ResetTranslation();
+   bool StreamEnd() const { return stream_end; }
+   DataInflator();
+   ~DataInflator();
+};
+#endif //USE_ZLIB
+
 class DirectedBuffer : public Buffer
 {
 public:
@@ -186,6 +206,45 @@ public:
    dir_t GetDirection() { return mode; }
 };
 
+// Global budget for data held in transfer buffers (xfer:memory-limit).
+// IOBuffers charge their contents here as they are processed; when the
+// budget is exhausted, reads are deferred for buffers holding more than
+// an equal share, so that the big holders drain first.
+class BufferMemory : public ResClient
+{
+   static BufferMemory *instance;
+
+   long long limit;
+   long long used;
+   long long high_water;
+   int holders;	  // buffers with data charged
+   unsigned long long waits; // times a read was deferred
+
+   void Reconfig(const char *name);
+   BufferMemory();
+
+public:
+   void Charge(int& charged,int size);
+   int Allowance(int charged,int size) const;
+   void Wait() { waits++; }
+
+   long long GetLimit() const { return limit; }
+   long long GetUsed() const { return used; }
+   xstring& FormatStatus(xstring& s,const char *prefix="") const;
+
+   static BufferMemory *GetInstance()
+      {
+	 if(!instance)
+	    instance=new BufferMemory();
+	 return instance;
+      }
+   static void DeleteInstance()
+      {
+	 delete instance;
+	 instance=0;
+      }
+};
+
 class IOBuffer : public DirectedBuffer, public SMTask
 {
 protected:
@@ -197,6 +256,11 @@ protected:
    Time event_time; // used to detect timeouts
    int max_buf;
 
+   int mem_charged; // bytes charged to BufferMemory
+   bool mem_wait;
+   // returns how much can be read now, 0 if the read must wait.
+   int ReadAllowance(int size);
+
 public:
    IOBuffer(dir_t m);
    virtual ~IOBuffer();
@@ -225,12 +289,20 @@ public:
    void PutEOF() { DirectedBuffer::PutEOF(); PutEOF_LL(); }
 
    void SetMaxBuffered(int m) { max_buf=m; }
+
+   void Charge()
+      {
+	 if(mem_charged!=Size())
+	    BufferMemory::GetInstance()->Charge(mem_charged,Size());
+      }
 };
 
 class IOBufferStacked : public IOBuffer
 {
+protected:
    SMTaskRef<IOBuffer> down;
 
+private:
    int Get_LL(int size);
    int Put_LL(const char *buf,int size);
 
@@ -64,6 +64,7 @@
 #include "FileFeeder.h"
 #include "bookmark.h"
 #include "log.h"
+#include "TraceRing.h"
 #include "module.h"
 #include "FileCopy.h"
 #include "DummyProto.h"
@@ -211,8 +212,9 @@ const struct CmdExec::cmd_rec CmdExec::static_cmd_table[]=
 	   )},
    {"connect", cmd_open,   0,"open"},
    {"command", cmd_command},
-   {"debug",   cmd_debug,  N_("debug [<level>|off] [-o <file>]"),
+   {"debug",   cmd_debug,  N_("debug [<level>|off|dump] [-o <file>]"),
 	 N_("Set debug level to given value or turn debug off completely.\n"
+	 "`debug dump' prints the protocol trace recorded with log:trace.\n"
 	 " -o <file>  redirect debug output to the file.\n")},
    {"du",      cmd_du,  N_("du [options] <dirs>"),
 	 N_("Summarize disk usage.\n"
@@ -231,7 +233,8 @@ const struct CmdExec::cmd_rec CmdExec::static_cmd_table[]=
 	 " -m, --megabytes       like --block-size=1048576\n"
 	 " -S, --separate-dirs   do not include size of subdirectories\n"
 	 " -s, --summarize       display only a total for each argument\n"
-	 "     --exclude=PAT     exclude files that match PAT\n")},
+	 "     --exclude=PAT     exclude files that match PAT\n"
+	 "     --parallel[=N]    read N directories at once (3 if N is omitted)\n")},
    {"echo",    cmd_echo,   0},
    {"eval",    cmd_eval,   0},
    {"exit",    cmd_exit,   N_("exit [<code>|bg]"),
@@ -245,7 +248,8 @@ const struct CmdExec::cmd_rec CmdExec::static_cmd_table[]=
 	 "Print contents of specified directory or current directory recursively.\n"
 	 "Directories in the list are marked with trailing slash.\n"
 	 "You can redirect output of this command.\n"
-	 " -d, --maxdepth=LEVELS  Descend at most LEVELS of directories.\n")},
+	 " -d, --maxdepth=LEVELS  Descend at most LEVELS of directories.\n"
+	 " -P, --parallel[=N]     Read N directories at once (3 if N is omitted).\n")},
    {"get",     cmd_get,    N_("get [OPTS] <rfile> [-o <lfile>]"),
 	 N_("Retrieve remote file <rfile> and store it to local file <lfile>.\n"
 	 " -o <lfile> specifies local file name (default - basename of rfile)\n"
@@ -311,6 +315,7 @@ const struct CmdExec::cmd_rec CmdExec::static_cmd_table[]=
 	 " -s, --allow-suid       set suid/sgid bits according to remote site\n"
 	 "     --allow-chown      try to set owner and group on files\n"
 	 "     --ignore-time      ignore time when deciding whether to download\n"
+	 "     --compare=checksum compare file contents by checksums instead of time\n"
 	 " -n, --only-newer       download only newer files (-c won't work)\n"
 	 " -r, --no-recursion     don't go to subdirectories\n"
 	 " -p, --no-perms         don't set file permissions\n"
@@ -386,10 +391,12 @@ const struct CmdExec::cmd_rec CmdExec::static_cmd_table[]=
 	 " -p  show password\n")},
    {"queue",   cmd_queue,  N_("queue [OPTS] [<cmd>]"),
 	 N_("\n"
-	 "       queue [-n num] <command>\n\n"
+	 "       queue [-n num] [-p pri] [--deadline=time] <command>\n\n"
 	 "Add the command to queue for current site. Each site has its own command\n"
 	 "queue. `-n' adds the command before the given item in the queue. It is\n"
 	 "possible to queue up a running job by using command `queue wait <jobno>'.\n"
+	 "Commands with higher priority (-p) and then with earlier deadline run\n"
+	 "first; a command waits while its host runs cmd:queue-host-parallel jobs.\n"
 	 "\n"
 	 "       queue --delete|-d [index or wildcard expression]\n\n"
 	 "Delete one or more items from the queue. If no argument is given, the last\n"
@@ -404,6 +411,8 @@ const struct CmdExec::cmd_rec CmdExec::static_cmd_table[]=
 	 " -v                  Be verbose.\n"
 	 " -Q                  Output in a format that can be used to re-queue.\n"
 	 "                     Useful with --delete.\n"
+	 " -p <pri>            Priority of the command, higher runs first.\n"
+	 "     --deadline=<time> Time interval, nearer deadlines run first.\n"
 	 )},
    {"quit",    cmd_exit,   0,"exit"},
    {"quote",   cmd_ls,	   N_("quote <cmd>"),
@@ -1149,6 +1158,8 @@ Job *CmdExec::builtin_queue()
       {"quiet",no_argument,0,'q'},
       {"verbose",no_argument,0,'v'},
       {"queue",required_argument,0,'Q'},
+      {"priority",required_argument,0,'p'},
+      {"deadline",required_argument,0,'D'},
       {0,0,0,0}
    };
    enum { ins, del, move } mode = ins;
@@ -1157,12 +1168,35 @@ Job *CmdExec::builtin_queue()
    /* position to insert at (ins only) */
    int pos = -1; /* default to the end */
    int verbose = -1; /* default */
+   int priority = 0;
+   time_t deadline = 0;
 
    int opt;
-   while((opt=args->getopt_long("+dm:n:qvQw",queue_options))!=EOF)
+   while((opt=args->getopt_long("+dm:n:p:qvQw",queue_options))!=EOF)
    {
       switch(opt)
       {
+      case 'p':
+	 if(!isdigit((unsigned char)optarg[optarg[0]=='-']))
+	 {
+	    eprintf(_("%s: -p: number expected. "), args->a0());
+	    goto err;
+	 }
+	 priority = atoi(optarg);
+	 break;
+
+      case 'D':
+      {
+	 TimeIntervalR left(optarg);
+	 if(left.Error() || left.IsInfty())
+	 {
+	    eprintf("%s: --deadline: %s. ", args->a0(),
+		    left.Error() ? left.ErrorText() : _("time interval expected"));
+	    goto err;
+	 }
+	 deadline = SMTask::now.UnixTime() + left.Seconds();
+	 break;
+      }
       case 'n':
 	 /* Actually, sending pos == -1 will work, but it'll put the
 	  * job at the end; it's confusing for "-n 0" to mean "put
@@ -1245,8 +1279,18 @@ Job *CmdExec::builtin_queue()
 	 else if(!strcasecmp(cmd,"start"))
 	    queue->Resume();
 	 else
+	 {
 	    queue->queue_feeder->QueueCmd(cmd, session->GetCwd(),
-					  cwd?cwd->GetName():0, pos, verbose);
+					  cwd?cwd->GetName():0, pos, verbose,
+					  priority, deadline);
+	    const char *qcmd=args->getarg(args->getindex());
+	    if(!strcmp(qcmd,"mirror") || !strcmp(qcmd,"pget"))
+	    {
+	       int n=ResMgr::Query("net:prewarm-sessions",session->GetHostName());
+	       if(n>0)
+		  SessionPool::Prewarm(session,n);
+	    }
+	 }
 
 	 last_bg=queue->jobno;
 	 exit_code=0;
@@ -1912,6 +1956,8 @@ CMD(jobs)
    xstring s("");
    if(!arg) {
       parent->top->FormatJobs(s,v);
+      if(v>1)
+	 BufferMemory::GetInstance()->FormatStatus(s);
    } else {
       for(; arg; arg=args->getnext()) {
 	 if(!isdigit((unsigned char)*arg)) {
@@ -2018,12 +2064,22 @@ CMD(debug)
       }
    }
 
+   const char *a=args->getcurr();
+   if(a && !strcasecmp(a,"dump"))
+   {
+      fflush(stdout);
+      TraceRing::Dump(fd==-1?1:fd);
+      if(fd!=-1)
+	 close(fd);
+      exit_code=0;
+      return 0;
+   }
+
    if(fd==-1)
       Log::global->SetOutput(2,false);
    else
       Log::global->SetOutput(fd,true);
 
-   const char *a=args->getcurr();
    if(a)
    {
       if(!strcasecmp(a,"off"))
@@ -2844,13 +2900,15 @@ CMD(find)
    static struct option find_options[]=
    {
       {"maxdepth",required_argument,0,'d'},
+      {"parallel",optional_argument,0,'P'},
       {0,0,0,0}
    };
    int opt;
    int maxdepth = -1;
+   int parallel = 1;
    const char *op=args->a0();
 
-   while((opt=args->getopt_long("+d:",find_options))!=EOF)
+   while((opt=args->getopt_long("+d:P::",find_options))!=EOF)
    {
       switch(opt)
       {
@@ -2862,6 +2920,9 @@ CMD(find)
 	 }
 	 maxdepth = atoi(optarg);
 	 break;
+      case 'P':
+	 parallel = optarg ? atoi(optarg) : 3;
+	 break;
       case '?':
 	 eprintf(_("Usage: %s [-d #] dir\n"),op);
 	 return 0;
@@ -2872,6 +2933,7 @@ CMD(find)
       args->Append(".");
    FinderJob_List *j=new class FinderJob_List(session->Clone(),args.borrow(),output.borrow());
    j->set_maxdepth(maxdepth);
+   j->SetParallel(parallel);
    return j;
 }
 
@@ -2879,7 +2941,8 @@ CMD(du)
 {
    enum {
       OPT_BLOCK_SIZE,
-      OPT_EXCLUDE
+      OPT_EXCLUDE,
+      OPT_PARALLEL
    };
    static struct option du_options[]=
    {
@@ -2899,6 +2962,7 @@ CMD(du)
       {"separate-dirs",no_argument,0,'S'},
       {"summarize",no_argument,0,'s'},
       {"exclude",required_argument,0,OPT_EXCLUDE},
+      {"parallel",optional_argument,0,OPT_PARALLEL},
       {0,0,0,0}
    };
    int maxdepth = -1;
@@ -2911,6 +2975,7 @@ CMD(du)
    bool file_count=false;
    const char *exclude=0;
    int human_opts=0;
+   int parallel=1;
 
    exit_code=1;
 
@@ -2973,6 +3038,9 @@ CMD(du)
       case OPT_EXCLUDE:
 	 exclude=optarg;
 	 break;
+      case OPT_PARALLEL:
+	 parallel = optarg ? atoi(optarg) : 3;
+	 break;
       case '?':
       default:
 	 eprintf(_("Usage: %s [options] <dirs>\n"),op);
@@ -3016,6 +3084,7 @@ CMD(du)
       j->SeparateDirs();
    if(file_count)
       j->FileCount();
+   j->SetParallel(parallel);
    /* if separate_dirs is on, then there's no point in traversing past
     * max_print_depth at all */
    if(separate_dirs && maxdepth != -1)
@@ -328,6 +328,13 @@ const char *Ftp::get_protect_res()
 // 226 Transfer complete.
 void Ftp::TransferCheck(int act)
 {
+   if(act==226 && conn->data_mode=='B')
+   {
+      // in block mode 226 means the server closes the data connection,
+      // 250 is sent when it is left open.
+      conn->data_sock_closing=true;
+      conn->CloseIdleDataSocket();
+   }
    if(act==225 || act==226) // data connection is still open or ABOR worked.
    {
       copy_done=true;
@@ -377,7 +384,18 @@ void Ftp::TransferCheck(int act)
       }
    found_offset:
       if(copy_mode==COPY_DEST)
-	 real_pos=pos=p;
+      {
+	 // some servers count the bytes of current transfer only; that
+	 // is certain when the count is below the REST position. Else
+	 // take it as is, the lowest possible position.
+	 if(p<conn->last_rest)
+	    conn->stat_relative=true;
+	 if(conn->stat_relative)
+	    p+=conn->last_rest;
+	 if(p>pos)
+	    real_pos=pos=p;
+	 conn->stat_missed=0;
+      }
       return;
    }
    if(copy_mode!=COPY_NONE && is4XX(act))
@@ -464,6 +482,8 @@ void Ftp::LoginCheck(int act)
 	 try_time=now;	// count the reconnect-interval from this moment
       last_connection_failed=true;
    }
+   if(is2XX(act))
+      ConnectTimingReady();
    if(is3XX(act) && !expect->Has(Expect::ACCT_PROXY))
    {
       if(!QueryStringWithUserAtHost("acct"))
@@ -859,7 +879,7 @@ void Ftp::CatchDATE(int act)
    }
 
    fi->NoNeed(fi->DATE);
-   if(!(fi->need&fi->SIZE))
+   if(!(fi->need&(fi->SIZE|fi->CHECKSUM)))
       fileset_for_info->next();
 
    TrySuccess();
@@ -914,7 +934,53 @@ void Ftp::CatchSIZE(int act)
    if(size>=1)
       fi->SetSize(size);
    fi->NoNeed(fi->SIZE);
-   if(!(fi->need&fi->DATE))
+   if(!(fi->need&(fi->DATE|fi->CHECKSUM)))
+      fileset_for_info->next();
+
+   TrySuccess();
+}
+void Ftp::CatchHASH(int act)
+{
+   if(!fileset_for_info)
+      return;
+
+   FileInfo *fi=fileset_for_info->curr();
+   if(!fi)
+      return;
+
+   if(is2XX(act))
+   {
+      // HASH reply: "213 SHA-256 0-1234 hex name",
+      // X-command reply: "250 hex" (sometimes followed by the name).
+      char *r=alloca_strdup(line+4);
+      char *tok=strtok(r," ");
+      Checksum::algo_t a=conn->hash_algo;
+      if(tok && conn->hash_cmd && !strcmp(conn->hash_cmd,"HASH"))
+      {
+	 a=Checksum::Find(tok);
+	 tok=strtok(0," ");   // the range
+	 if(tok)
+	    tok=strtok(0," ");
+      }
+      xstring digest(tok);
+      digest.hex_decode();
+      if(tok && (int)digest.length()*2==(int)strlen(tok)
+      && (int)digest.length()==Checksum::DigestSize(a))
+	 fi->SetChecksum(a,digest);
+   }
+   else if(is5XX(act))
+   {
+      if(cmd_unsupported(act))
+	 conn->hash_cmd=0;
+   }
+   else
+   {
+      Disconnect();
+      return;
+   }
+
+   fi->NoNeed(fi->CHECKSUM);
+   if(!(fi->need&(fi->DATE|fi->SIZE)))
       fileset_for_info->next();
 
    TrySuccess();
@@ -955,7 +1021,11 @@ Ftp::Connection::Connection(const char *c)
 {
    control_sock=-1;
    data_sock=-1;
+   data_block=0;
+   idle_data_sock=-1;
+   data_sock_closing=false;
    aborted_data_sock=-1;
+   trace_session=0;
 #if USE_SSL
    prot='C';  // current protection scheme 'C'lear or 'P'rivate
    auth_sent=false;
@@ -965,8 +1035,12 @@ Ftp::Connection::Connection(const char *c)
    sscn_on=false;
 #endif
    type='A';
+   data_mode='S';
+   want_data_mode='S';
    last_rest=0;
    rest_pos=0;
+   stat_relative=false;
+   stat_missed=0;
 
    quit_sent=false;
    fixed_pasv=false;
@@ -996,6 +1070,9 @@ Ftp::Connection::Connection(const char *c)
    mfmt_supported=false;
    epsv_supported=false;
    tvfs_supported=false;
+   mode_b_supported=false;
+   hash_cmd=0;
+   hash_algo=Checksum::NONE;
 
    proxy_is_http=false;
    may_show_password=false;
@@ -1033,6 +1110,7 @@ void Ftp::InitFtp()
    use_telnet_iac=true;
    use_pret=true;
    use_mlsd=false;
+   use_mode_b=false;
 
    copy_mode=COPY_NONE;
    copy_addr_valid=false;
@@ -1067,6 +1145,7 @@ Ftp::Connection::~Connection()
 {
    CloseAbortedDataConnection();
    CloseDataConnection();
+   CloseIdleDataSocket();
    if(control_sock!=-1)
    {
       LogNote(7,_("Closing control socket"));
@@ -1106,7 +1185,8 @@ bool Ftp::GetBetterConnection(int level,bool limit_reached)
 //    if(level==0 && cwd==0)
 //       return need_sleep;
 
-   for(FA *fo=FirstSameSite(); fo!=0; fo=NextSameSite(fo))
+   int n;
+   for(FA *fo=FirstSameSite(&n); fo!=0; fo=NextSameSite(fo,&n))
    {
       Ftp *o=(Ftp*)fo; // we are sure it is Ftp.
 
@@ -1318,6 +1398,7 @@ int   Ftp::Do()
       assert(!conn);
       assert(!expect);
       conn=new Connection(hostname);
+      conn->trace_session=GetTraceSession();
       expect=new ExpectQueue();
 
       conn->proxy_is_http=ProxyIsHttp();
@@ -1379,6 +1460,8 @@ int   Ftp::Do()
       if(!(res&POLLOUT))
 	 goto usual_return;
 
+      ConnectTimingConnected();
+
 #if USE_SSL
       if(proxy && (!xstrcmp(proxy_proto,"ftps")
 	        || !xstrcmp(proxy_proto,"https")))
@@ -1681,6 +1764,9 @@ int   Ftp::Do()
 	 SendPROT(want_prot);
       }
 #endif
+      if(mode==RETRIEVE || mode==STORE || mode==LIST || mode==MP_LIST
+      || (mode==LONG_LIST && !use_stat_for_list))
+	 SendMODE();
       state=CWD_CWD_WAITING_STATE;
       m=MOVED;
    /* fallthrough */
@@ -1700,6 +1786,9 @@ int   Ftp::Do()
       || expect->Has(Expect::SSCN))
 	 goto usual_return;
 #endif
+      // so is MODE, it determines if the data connection can be reused
+      if(expect->Has(Expect::MODE))
+	 goto usual_return;
 
       // address of peer is not known yet
       if(copy_mode!=COPY_NONE && !copy_passive && !copy_addr_valid)
@@ -1720,7 +1809,25 @@ int   Ftp::Do()
       if(mode==STORE && GetFlag(NOREST_MODE) && pos>0)
 	 pos=0;
 
+      bool data_sock_reused=false;
       if(copy_mode==COPY_NONE
+      && (mode==RETRIEVE || mode==STORE || mode==LIST || mode==MP_LIST
+          || (mode==LONG_LIST && !use_stat_for_list)))
+      {
+	 conn->data_sock_closing=false;
+	 if(conn->data_mode=='B' && conn->idle_data_sock!=-1)
+	 {
+	    // the server could have closed it while it was idle.
+	    if(Poll(conn->idle_data_sock,POLLIN)!=0)
+	       conn->CloseIdleDataSocket();
+	    else
+	    {
+	       conn->TakeIdleDataSocket();
+	       data_sock_reused=true;
+	    }
+	 }
+      }
+      if(copy_mode==COPY_NONE && !data_sock_reused
       && (mode==RETRIEVE || mode==STORE || mode==LIST || mode==MP_LIST
           || (mode==LONG_LIST && !use_stat_for_list)))
       {
@@ -2002,6 +2109,9 @@ int   Ftp::Do()
 	 goto pre_WAITING_STATE;
       }
 
+      if(data_sock_reused)
+	 goto send_transfer_cmd;  // no PASV/PORT for an open data connection
+
       if((copy_mode==COPY_NONE && GetFlag(PASSIVE_MODE))
       || (copy_mode!=COPY_NONE && copy_passive))
       {
@@ -2083,15 +2193,21 @@ int   Ftp::Do()
 #endif
 	 }
       }
+   send_transfer_cmd:
       if(mode==STORE && entity_size!=NO_SIZE && QueryBool("use-allo",hostname))
       {
 	 // ALLO is usually ignored by servers, but send it anyway.
 	 conn->SendCmdF("ALLO %lld",(long long)entity_size);
 	 expect->Push(Expect::ALLO);
       }
+      // in block mode REST takes a restart marker, not a byte offset.
+      // Block mode is used only from the start of a file (see SendMODE),
+      // where no REST is needed.
+      if(conn->want_data_mode=='B' && pos==0)
+	 real_pos=0;
       // some broken servers don't reset REST after a transfer,
       // so check if last_rest was different.
-      if(real_pos==-1 || conn->last_rest!=real_pos)
+      else if(real_pos==-1 || conn->last_rest!=real_pos)
       {
          conn->rest_pos=(real_pos!=-1?real_pos:pos);
 	 conn->SendCmdF("REST %lld",(long long)conn->rest_pos);
@@ -2107,6 +2223,8 @@ int   Ftp::Do()
 	 expect->Push(Expect::TRANSFER);
       }
       m=MOVED;
+      if(data_sock_reused)
+	 goto pre_waiting_150;
       if(copy_mode!=COPY_NONE && !copy_passive)
 	 goto pre_WAITING_STATE;
       if((copy_mode==COPY_NONE && GetFlag(PASSIVE_MODE))
@@ -2288,8 +2406,16 @@ int   Ftp::Do()
 	 if(!conn->data_iobuf || conn->data_iobuf->GetDirection()!=dir)
 	    conn->data_iobuf=new IOBufferFDStream(new FDStream(conn->data_sock,"data-socket"),dir);
       }
+      if(conn->data_mode=='B')
+      {
+	 conn->data_block=new IOBufferBlockMode(conn->data_iobuf.borrow());
+	 conn->data_iobuf=conn->data_block;
+      }
       if(mode==LIST || mode==LONG_LIST || mode==MP_LIST)
       {
+	 // the block layer has its own translator, add one more layer.
+	 if(conn->data_block && (conn->utf8_activated || (charset && *charset)))
+	    conn->data_iobuf=new IOBufferStacked(conn->data_iobuf.borrow());
 	 if(conn->utf8_activated)
 	    conn->data_iobuf->SetTranslation("UTF-8",true);
 	 else if(charset && *charset)
@@ -2465,6 +2591,7 @@ int   Ftp::Do()
 	 {
 	    // send STAT to know current position.
 	    SendUrgentCmd("STAT");
+	    conn->stat_missed++;
 	    expect->Push(Expect::TRANSFER);
 	    FlushSendQueue(true);
 	    m=MOVED;
@@ -2580,6 +2707,23 @@ void Ftp::SendPROT(char want_prot)
 }
 #endif // USE_SSL
 
+void Ftp::SendMODE()
+{
+   // Block mode is used only for our own data connections. FXP peers
+   // and TLS data connections stay in stream mode, and so do restarted
+   // transfers since REST has a different meaning in block mode.
+   char want_mode='S';
+   if(use_mode_b && conn->mode_b_supported && copy_mode==COPY_NONE
+   && pos==0 && !conn->proxy_is_http && !conn->ssl_is_activated())
+      want_mode='B';
+   if(want_mode==conn->want_data_mode)
+      return;
+   conn->CloseIdleDataSocket();
+   conn->want_data_mode=want_mode;
+   conn->SendCmdF("MODE %c",want_mode);
+   expect->Push(new Expect(Expect::MODE,want_mode));
+}
+
 void Ftp::SendSiteIdle()
 {
    if(!QueryBool("use-site-idle"))
@@ -2665,6 +2809,23 @@ void Ftp::SendArrayInfoRequests()
 	 expect->Push(Expect::SIZE);
 	 sent=true;
       }
+      if(fi->need&fi->CHECKSUM)
+      {
+	 if(conn->hash_cmd)
+	 {
+	    if(conn->hash_opts)
+	    {
+	       conn->SendCmd2("OPTS HASH",conn->hash_opts);
+	       expect->Push(Expect::IGNORE);
+	       conn->hash_opts.set(0);
+	    }
+	    conn->SendCmd2(conn->hash_cmd,ExpandTildeStatic(fi->name));
+	    expect->Push(Expect::HASH);
+	    sent=true;
+	 }
+	 else
+	    fi->NoNeed(fi->CHECKSUM);
+      }
       if(!sent)
       {
 	 if(i==fileset_for_info->curr_index())
@@ -2837,6 +2998,7 @@ int  Ftp::ReceiveResp()
 	 log_prio=10;
       }
       LogRecv(log_prio,line);
+      Trace(TraceRing::RECV,line,line.length());
 
       if(conn->multiline_code==0 || all_lines.length()==0)
 	 all_lines.set(line); // not continuation
@@ -3151,6 +3313,7 @@ void Ftp::Connection::CloseDataSocket()
 
 void Ftp::Connection::CloseDataConnection()
 {
+   data_block=0;
    data_iobuf=0;
    fixed_pasv=false;
    CloseDataSocket();
@@ -3172,6 +3335,29 @@ void Ftp::Connection::CloseAbortedDataConnection()
    }
 }
 
+void Ftp::Connection::KeepDataSocket()
+{
+   CloseIdleDataSocket();
+   LogNote(9,"Keeping data connection for the next transfer");
+   idle_data_sock=data_sock;
+   data_sock=-1;
+}
+void Ftp::Connection::TakeIdleDataSocket()
+{
+   assert(data_sock==-1);
+   LogNote(9,"Reusing data connection");
+   data_sock=idle_data_sock;
+   idle_data_sock=-1;
+}
+void Ftp::Connection::CloseIdleDataSocket()
+{
+   if(idle_data_sock==-1)
+      return;
+   LogNote(7,_("Closing data socket"));
+   close(idle_data_sock);
+   idle_data_sock=-1;
+}
+
 void  Ftp::DataClose()
 {
    rate_limit=0;
@@ -3182,6 +3368,9 @@ void  Ftp::DataClose()
    conn->nop_count=0;
    if(conn->data_sock!=-1 && QueryBool("web-mode"))
       disconnect_on_close=true;
+   if(conn->data_block && conn->data_block->Reusable() && !conn->data_sock_closing
+   && !disconnect_on_close)
+      conn->KeepDataSocket();
    conn->CloseDataConnection();
    if(state==DATA_OPEN_STATE || state==DATASOCKET_CONNECTING_STATE)
       state=WAITING_STATE;
@@ -3209,9 +3398,15 @@ int Ftp::Connection::FlushSendQueueOneCmd()
    int log_level=5;
 
    if(!may_show_password && !strncasecmp(cmd_begin,"PASS ",5))
+   {
       LogSend(log_level,"PASS XXXX");
+      if(TraceRing::enabled)
+	 TraceRing::AddText(trace_session,TraceRing::SEND,"PASS XXXX");
+   }
    else
    {
+      if(TraceRing::enabled)
+	 TraceRing::AddText(trace_session,TraceRing::SEND,cmd_begin,line_end-cmd_begin);
       xstring log;
       for(const char *s=cmd_begin; s<=line_end; s++)
       {
@@ -3519,6 +3714,7 @@ void Ftp::ExpectQueue::Close()
       case(Expect::LANG):
       case(Expect::OPTS_UTF8):
       case(Expect::ALLO):
+      case(Expect::MODE):
 #if USE_SSL
       case(Expect::AUTH_TLS):
       case(Expect::PROT):
@@ -3536,6 +3732,7 @@ void Ftp::ExpectQueue::Close()
       case(Expect::SIZE_OPT):
       case(Expect::MDTM):
       case(Expect::MDTM_OPT):
+      case(Expect::HASH):
       case(Expect::PORT):
       case(Expect::FILE_ACCESS):
       case(Expect::RNFR):
@@ -3838,6 +4035,10 @@ void Ftp::CheckFEAT(char *reply)
 #endif
    conn->pret_supported=false;
    conn->epsv_supported=false;
+   conn->mode_b_supported=false;
+   conn->hash_cmd=0;
+   conn->hash_algo=Checksum::NONE;
+   conn->hash_opts.set(0);
 
    char *scan=strchr(reply,'\n');
    if(scan)
@@ -3886,6 +4087,22 @@ void Ftp::CheckFEAT(char *reply)
 	 conn->epsv_supported=true;
       else if(!strcasecmp(f,"TVFS"))
 	 conn->tvfs_supported=true;
+      else if(!strncasecmp(f,"MODE ",5) && strpbrk(f+5,"Bb"))
+	 conn->mode_b_supported=true;
+      else if(!strncasecmp(f,"HASH ",5))
+	 CheckFEAT_HASH(f+5);
+      else if(!strcasecmp(f,"XSHA256") || !strcasecmp(f,"XSHA1")
+	   || !strcasecmp(f,"XMD5") || !strcasecmp(f,"XCRC"))
+      {
+	 // prefer HASH and the strongest algorithm.
+	 Checksum::algo_t a=Checksum::Find(f[1]=='C'||f[1]=='c'?"CRC32":f+1);
+	 if(a>conn->hash_algo && (!conn->hash_cmd || strcmp(conn->hash_cmd,"HASH")))
+	 {
+	    conn->hash_algo=a;
+	    conn->hash_cmd=(a==Checksum::SHA256?"XSHA256":a==Checksum::SHA1?"XSHA1"
+			    :a==Checksum::MD5?"XMD5":"XCRC");
+	 }
+      }
 #if USE_SSL
       else if(!strncasecmp(f,"AUTH ",5))
       {
@@ -3906,6 +4123,35 @@ void Ftp::CheckFEAT(char *reply)
    conn->have_feat_info=true;
 }
 
+// "HASH SHA-1;SHA-256*;MD5": the current one is marked with `*'.
+void Ftp::CheckFEAT_HASH(const char *list)
+{
+   char *l=alloca_strdup(list);
+   Checksum::algo_t curr=Checksum::NONE;
+   Checksum::algo_t best=Checksum::NONE;
+   const char *best_name=0;
+   for(char *name=strtok(l,";"); name; name=strtok(0,";"))
+   {
+      int len=strlen(name);
+      bool is_curr=(len>0 && name[len-1]=='*');
+      if(is_curr)
+	 name[len-1]=0;
+      Checksum::algo_t a=Checksum::Find(name);
+      if(is_curr)
+	 curr=a;
+      if(a>best)
+      {
+	 best=a;
+	 best_name=name;
+      }
+   }
+   if(best==Checksum::NONE)
+      return;
+   conn->hash_cmd="HASH";
+   conn->hash_algo=best;
+   conn->hash_opts.set(best!=curr?best_name:0);
+}
+
 void Ftp::TurnOffStatForList()
 {
    DataClose();
@@ -4074,6 +4320,9 @@ void Ftp::CheckResp(int act)
    case Expect::MDTM_OPT:
       CatchDATE_opt(act);
       break;
+   case Expect::HASH:
+      CatchHASH(act);
+      break;
 
    case Expect::FILE_ACCESS:
    file_access:
@@ -4254,6 +4503,19 @@ void Ftp::CheckResp(int act)
       if(is2XX(act))
 	 conn->type=arg[0];
       break;
+   case Expect::MODE:
+      if(is2XX(act))
+	 conn->data_mode=arg[0];
+      else
+      {
+	 conn->want_data_mode=conn->data_mode;
+	 if(arg[0]=='B')
+	 {
+	    LogNote(2,"MODE B failed, using stream mode");
+	    conn->mode_b_supported=false;
+	 }
+      }
+      break;
    case Expect::OPTS_UTF8:
    case Expect::LANG:
       if(is2XX(act) && conn->utf8_supported)
@@ -4555,6 +4817,7 @@ void Ftp::Reconfig(const char *name)
    use_pret = QueryBool("use-pret");
    use_feat = QueryBool("use-feat");
    use_mlsd = QueryBool("use-mlsd");
+   use_mode_b = QueryBool("use-mode-b");
 
    use_telnet_iac = QueryBool("use-telnet-iac");
 
@@ -4902,6 +5165,63 @@ void TelnetDecode::PutTranslated(Buffer *target,const char *put_buf,int size)
    }
 }
 
+void BlockModeEncode::PutTranslated(Buffer *target,const char *put_buf,int size)
+{
+   while(size>0)
+   {
+      int len=(size>IOBufferBlockMode::BLOCK_MAX?IOBufferBlockMode::BLOCK_MAX:size);
+      char header[3]={0,char(len>>8),char(len&0xff)};
+      target->Put(header,3);
+      target->Put(put_buf,len);
+      put_buf+=len;
+      size-=len;
+   }
+}
+void BlockModeDecode::PutTranslated(Buffer *target,const char *put_buf,int size)
+{
+   if(size>0)
+      Put(put_buf,size);
+   while(!target->Eof() && Size()>=3)
+   {
+      const unsigned char *header=(const unsigned char*)Get();
+      int desc=header[0];
+      int len=(header[1]<<8)|header[2];
+      if(Size()<3+len)
+	 return;  // wait for the rest of the block
+      if(!(desc&IOBufferBlockMode::BLOCK_RESTART))
+	 target->Put(Get()+3,len);
+      Skip(3+len);
+      if(desc&IOBufferBlockMode::BLOCK_EOF)
+	 target->PutEOF();
+   }
+}
+int IOBufferBlockMode::PutEOF_LL()
+{
+   if(mode==PUT)
+   {
+      // the data connection stays open, just mark the end of file.
+      static const char eof_block[3]={BLOCK_EOF,0,0};
+      Buffer::Put(eof_block,3);
+   }
+   return 0;
+}
+bool IOBufferBlockMode::Done()
+{
+   if(broken || Error())
+      return true;
+   if(mode==PUT)
+      return eof && Size()==0 && down->Size()==0;
+   return eof;
+}
+bool IOBufferBlockMode::Reusable()
+{
+   if(!eof || broken || Error() || down->Error())
+      return false;
+   if(mode==PUT)
+      return Size()==0 && down->Size()==0 && !down->Broken();
+   return !down->Eof();
+}
+
 void Ftp::Connection::SetControlConnectionTranslation(const char *cs)
 {
    if(translation_activated)
@@ -46,6 +46,35 @@ public:
    }
 };
 
+// MODE B (RFC959 3.4.2): data is sent in blocks with a 3-byte header,
+// the end of file is marked by a descriptor, so the data connection
+// can stay open for the next transfer.
+class BlockModeEncode : public DataTranslator {
+   void PutTranslated(Buffer *target,const char *buf,int size);
+};
+class BlockModeDecode : public DataTranslator {
+   void PutTranslated(Buffer *target,const char *buf,int size);
+};
+class IOBufferBlockMode : public IOBufferStacked
+{
+   int PutEOF_LL();
+public:
+   enum {
+      BLOCK_RESTART=0x10,  // restart marker, not file data
+      BLOCK_EOF=0x40,
+      BLOCK_EOR=0x80,
+      BLOCK_MAX=0xffff
+   };
+   IOBufferBlockMode(IOBuffer *b) : IOBufferStacked(b) {
+      if(mode==PUT)
+	 SetTranslator(new BlockModeEncode());
+      else
+	 SetTranslator(new BlockModeDecode());
+   }
+   bool Done();
+   bool Reusable();  // EOF block passed and the connection is intact
+};
+
 class Ftp : public NetAccess
 {
    enum automate_state
@@ -76,6 +105,9 @@ class Ftp : public NetAccess
       DirectedBuffer send_cmd_buffer; // holds unsent commands.
       int data_sock;
       SMTaskRef<IOBuffer> data_iobuf;
+      IOBufferBlockMode *data_block; // MODE B layer, owned by data_iobuf
+      int idle_data_sock;  // kept open in MODE B between transfers
+      bool data_sock_closing; // server said it closes the data connection
       int aborted_data_sock;
       sockaddr_u peer_sa;
       sockaddr_u data_sa; // address for data accepting
@@ -95,6 +127,8 @@ class Ftp : public NetAccess
       bool received_150;
 
       char type;  // type of transfer: 'A'scii or 'I'mage
+      char data_mode;  // transfer mode: 'S'tream or 'B'lock
+      char want_data_mode;  // the mode of the last MODE sent
 
       bool dos_path;
       bool vms_path;
@@ -115,9 +149,16 @@ class Ftp : public NetAccess
       bool mfmt_supported;
       bool epsv_supported;
       bool tvfs_supported;
+      bool mode_b_supported;
+
+      const char *hash_cmd;	    // HASH or one of XSHA256, XSHA1, XMD5, XCRC
+      Checksum::algo_t hash_algo;   // what hash_cmd returns
+      xstring_c hash_opts;	    // algorithm to select with OPTS HASH
 
       off_t last_rest;	// last successful REST position.
       off_t rest_pos;	// the number sent with REST command.
+      bool stat_relative;	// STAT reports bytes of transfer, not position.
+      int stat_missed;		// STAT commands sent since the last position.
 
       Timer abor_close_timer;	 // timer for closing aborted connection.
       Timer stat_timer;		 // timer for sending periodic STAT commands.
@@ -145,6 +186,8 @@ class Ftp : public NetAccess
 
       xstring_c mlst_attr_supported;
 
+      unsigned trace_session;
+
       Connection(const char *c);
       ~Connection();
 
@@ -159,6 +202,9 @@ class Ftp : public NetAccess
       void CloseDataConnection();
       void AbortDataConnection();
       void CloseAbortedDataConnection();
+      void KeepDataSocket();
+      void TakeIdleDataSocket();
+      void CloseIdleDataSocket();
 
       void Send(const char *cmd);
       void SendURI(const char *u,const char *home);
@@ -205,6 +251,7 @@ class Ftp : public NetAccess
 	 SIZE_OPT,	// check response for SIZE and save size to *opt_size
 	 MDTM,		// check response for MDTM
 	 MDTM_OPT,	// check response for MDTM and save size to *opt_date
+	 HASH,		// check response for HASH or XSHA1 and the like
 	 PRET,
 	 PASV,		// check response for PASV and save address
 	 EPSV,		// check response for EPSV and save address
@@ -226,6 +273,7 @@ class Ftp : public NetAccess
 	 SITE_UTIME,
 	 SITE_UTIME2,
 	 ALLO,
+	 MODE,		// check response for MODE
 	 QUOTED		// check response for any command submitted by QUOTE_CMD
 #if USE_SSL
 	 ,AUTH_TLS,PROT,SSCN,CCC
@@ -280,12 +328,14 @@ class Ftp : public NetAccess
    void	 proxy_LoginCheck(int);
    void	 proxy_NoPassReqCheck(int);
    void	 CheckFEAT(char *reply);
+   void	 CheckFEAT_HASH(const char *list);
    char *ExtractPWD();
    int   SendCWD(const char *path,const char *path_url,Expect::expect_t c);
    void	 CatchDATE(int);
    void	 CatchDATE_opt(int);
    void	 CatchSIZE(int);
    void	 CatchSIZE_opt(int);
+   void	 CatchHASH(int);
    void	 TurnOffStatForList();
 
    enum pasv_state_t
@@ -332,6 +382,7 @@ private:
    void TuneConnectionAfterFEAT();
    void SendOPTS_MLST();
    void SendPROT(char want_prot);
+   void SendMODE();
 
    const char *QueryStringWithUserAtHost(const char *);
 
@@ -410,6 +461,7 @@ private:
    bool use_pret;
    bool use_feat;
    bool use_mlsd;
+   bool use_mode_b;
 
    bool use_telnet_iac;
 
@@ -526,6 +578,12 @@ public:
 	 copy_allow_store=true;
       }
    bool CopyStoreAllowed() const { return copy_allow_store; }
+   bool CopyStoreStarted() const { return copy_allow_store && copy_connection_open; }
+   bool CopyCanStat()
+      {
+	 return use_stat && (!conn || (!conn->ssl_is_activated() && !conn->proxy_is_http));
+      }
+   bool CopyStatFailed() const { return conn && conn->stat_missed>3; }
    bool CopyIsReadyForStore()
       {
 	 if(!expect)
@@ -48,6 +48,7 @@
 #include "misc.h"
 #include "ArgV.h"
 #include "attach.h"
+#include "MetricsServer.h"
 
 #include "configmake.h"
 
@@ -417,6 +418,7 @@ static void detach()
 }
 
 SMTaskRef<AcceptTermFD> term_acceptor;
+static SMTaskRef<MetricsServer> metrics_server;
 static int move_to_background()
 {
    // notify jobs
@@ -530,6 +532,8 @@ int   main(int argc,char **argv)
    CmdExec::RegisterCommand("attach",cmd_attach,"attach [PID]",
       N_("Attach the terminal to specified backgrounded lftp process.\n"));
 
+   metrics_server=new MetricsServer();
+
    top_exec=new CmdExec(0,0);
    hook_signals();
    top_exec->SetStatusLine(new StatusLine(1));
@@ -587,6 +591,7 @@ revived:
    }
    top_exec->KillAll();
    top_exec=0;
+   metrics_server=0;
 
    if(term_acceptor && term_acceptor->Accepted()) {
       printf(_("[%u] Exiting and detaching from the terminal.\n"),(unsigned)getpid());
@@ -57,6 +57,9 @@ public:
    void Format(int l,const char *fmt,...) PRINTF_LIKE(3,4);
    void vFormat(int l,const char *fmt,va_list v);
 
+   // cheap check to skip formatting of messages which would be discarded
+   bool MayOutput(int l) const { return enabled && l<=level && output!=-1; }
+
    void SetLevel(int l) { level=l; }
    void Enable()  { enabled=true;  }
    void Disable() { enabled=false; }
@@ -691,6 +691,10 @@ char last_char(const char *str)
    return str[len-(len>0)];
 }
 
+/* Conversion table.  */
+static const char base64_tbl[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
 /* How many bytes it will take to store LEN bytes in base64.  */
 int
 base64_length(int len)
@@ -704,17 +708,7 @@ base64_length(int len)
 void
 base64_encode (const char *s, char *store, int length)
 {
-  /* Conversion table.  */
-  static const char tbl[64] = {
-    'A','B','C','D','E','F','G','H',
-    'I','J','K','L','M','N','O','P',
-    'Q','R','S','T','U','V','W','X',
-    'Y','Z','a','b','c','d','e','f',
-    'g','h','i','j','k','l','m','n',
-    'o','p','q','r','s','t','u','v',
-    'w','x','y','z','0','1','2','3',
-    '4','5','6','7','8','9','+','/'
-  };
+  const char *tbl = base64_tbl;
   int i;
   unsigned char *p = (unsigned char *)store;
 
@@ -736,6 +730,29 @@ base64_encode (const char *s, char *store, int length)
   *p = '\0';
 }
 
+/* Decode base64 string S, appending the bytes to OUT. Stops at the padding
+   or at end of string; returns false on an invalid character.  */
+bool
+base64_decode (const char *s, xstring& out)
+{
+  unsigned acc = 0;
+  int bits = 0;
+  for (; *s && *s != '='; s++)
+    {
+      const char *c = strchr (base64_tbl, *s);
+      if (!c)
+	return false;
+      acc = (acc << 6) | (c - base64_tbl);
+      bits += 6;
+      if (bits >= 8)
+	{
+	  bits -= 8;
+	  out.append (char ((acc >> bits) & 0xff));
+	}
+    }
+  return true;
+}
+
 bool temporary_network_error(int err)
 {
    switch(err)
@@ -108,6 +108,7 @@ char last_char(const char *str);
 
 int  base64_length (int len);
 void base64_encode (const char *s, char *store, int length);
+bool base64_decode (const char *s, xstring& out);
 
 bool temporary_network_error(int e);
 
@@ -63,6 +63,19 @@ int pgetJob::Do()
       }
    }
 
+   if(no_parallel && fxp)
+   {
+      fxp=false;
+      // the main copy stops at limit0 by itself, so it has to copy
+      // the rest now, unless it has already stopped.
+      if(c->Error())
+	 ;
+      else if(c->GetPos()<limit0)
+	 c->SetRangeLimit(FILE_END);
+      else
+	 c->SetError(_("pget: a chunk of the server to server copy failed"));
+   }
+
    if(no_parallel || max_chunks<2)
    {
       c->Resume();
@@ -71,9 +84,14 @@ int pgetJob::Do()
 
    if(chunks_done && chunks && c->GetPos()>=limit0)
    {
-      c->SetRangeLimit(limit0);    // make it stop.
-      c->Resume();
-      c->Do();
+      if(fxp && !c->Error() && !CheckTargetSize())
+	 return m;
+      if(!c->Error())
+      {
+	 c->SetRangeLimit(limit0);    // make it stop.
+	 c->Resume();
+	 c->Do();
+      }
       free_chunks();
       m=MOVED;
    }
@@ -91,6 +109,8 @@ int pgetJob::Do()
 	 no_parallel=true;
 	 c->Resume();
       }
+      else if(fxp)
+	 ;  // the main copy has stopped at limit0 by itself.
       else if(!chunks[0]->Done() && chunks[0]->GetBytesCount()<limit0/16)
       {
 	 c->Resume();
@@ -121,11 +141,18 @@ int pgetJob::Do()
       if(size==NO_SIZE_YET)
 	 return m;
 
-      if(size==NO_SIZE || (c->put && c->put->GetLocal()==0))
+      bool remote=(c->put && c->put->GetLocal()==0);
+      // wait until the target file is created by the first copy,
+      // so that it does not truncate the data of other chunks.
+      // Then the connections are known and can be checked.
+      if(remote && size!=NO_SIZE && c->CanSegmentFXP() && !c->FXPStoreStarted())
+	 return m;
+      bool can_fxp=(remote && c->CanSegmentFXP());
+      if(size==NO_SIZE || (remote && !can_fxp))
       {
 	 Log::global->Write(0,_("pget: falling back to plain get"));
 	 Log::global->Write(0," (");
-	 if(c->put && c->put->GetLocal()==0)
+	 if(remote && !can_fxp)
 	 {
 	    Log::global->Write(0,_("the target file is remote"));
 	    if(size==NO_SIZE)
@@ -155,6 +182,16 @@ int pgetJob::Do()
 	 no_parallel=true;
 	 return m;
       }
+      // the target now has data of other chunks; a restart from
+      // the beginning would truncate it, so rather fail.
+      // Suspending an FXP copy would not stop the servers, so the main
+      // copy is made to stop at the end of its range instead.
+      if(can_fxp)
+      {
+	 c->FailIfCannotSeek();
+	 c->SetRangeLimit(limit0);
+	 fxp=true;
+      }
       if(!pget_cont)
       {
 	 SaveStatus();
@@ -215,6 +252,36 @@ int pgetJob::Do()
    return m;
 }
 
+// A server to server chunk is not known to be stored completely until
+// the target reports the file size. Returns false while waiting for it.
+bool pgetJob::CheckTargetSize()
+{
+   if(!size_session)
+   {
+      size_session=c->put->GetSession()->Clone();
+      FileInfo *fi=new FileInfo(c->put->GetFile());
+      fi->Need(fi->SIZE);
+      size_info.Empty();
+      size_info.Add(fi);
+      size_session->GetInfoArray(&size_info);
+   }
+   int res=size_session->Done();
+   if(res==FA::IN_PROGRESS)
+      return false;
+   FileInfo *fi=size_info[0];
+   if(res<0 || !fi->Has(fi->SIZE))
+      Log::global->Format(0,"pget: cannot check the target file size\n");
+   else if(fi->size!=GetSize())
+   {
+      Log::global->Format(0,"pget: the target file has %lld bytes of %lld\n",
+	 (long long)fi->size,(long long)GetSize());
+      c->SetError(_("pget: the target file is incomplete"));
+   }
+   size_session=0;
+   fxp=false;
+   return true;
+}
+
 // xgettext:c-format
 static const char pget_status_format[]=N_("`%s', got %lld of %lld (%d%%) %s%s");
 #define PGET_STATUS _(pget_status_format),name, \
@@ -274,9 +341,10 @@ xstring& pgetJob::FormatJobs(xstring& s,int verbose,int indent)
       if(c->GetPos()<limit0)
       {
 	 s.appendf("%*s\\chunk %lld-%lld\n",indent,"",(long long)start0,(long long)limit0);
+	 off_t lim=c->GetRangeLimit();
 	 c->SetRangeLimit(limit0); // to see right ETA.
 	 CopyJob::FormatStatus(s,verbose,"\t");
-	 c->SetRangeLimit(FILE_END);
+	 c->SetRangeLimit(lim);
       }
       Job::FormatJobs(s,verbose,indent);
    }
@@ -315,6 +383,7 @@ pgetJob::pgetJob(FileCopy *c1,const char *n,int m)
    total_xfer_rate=0;
    no_parallel=false;
    chunks_done=false;
+   fxp=false;
    pget_cont=c->SetContinue(false);
    max_chunks=m?m:ResMgr::Query("pget:default-n",0);
    total_eta=-1;
@@ -339,12 +408,21 @@ pgetJob::~pgetJob()
 pgetJob::ChunkXfer *pgetJob::NewChunk(const char *remote,off_t start,off_t limit)
 {
    const Ref<FDStream>& local=c->put->GetLocal();
-   FileCopyPeerFDStream
-	       	*dst_peer=new FileCopyPeerFDStream(local,FileCopyPeer::PUT);
-   dst_peer->NeedSeek(); // seek before writing
-   dst_peer->SetBase(0);
-
-   FileCopy *c1=FileCopy::New(c->get->Clone(),dst_peer,false);
+   FileCopy *c1;
+   if(local)
+   {
+      FileCopyPeerFDStream
+		  *dst_peer=new FileCopyPeerFDStream(local,FileCopyPeer::PUT);
+      dst_peer->NeedSeek(); // seek before writing
+      dst_peer->SetBase(0);
+      c1=FileCopy::New(c->get->Clone(),dst_peer,false);
+   }
+   else
+   {
+      // server to server copy, the chunk is stored with REST+STOR.
+      c1=FileCopy::New(c->get->Clone(),c->put->Clone(),false);
+      c1->SegmentFXP();
+   }
    c1->SetRange(start,limit);
    c1->SetSize(GetSize());
    c1->DontCopyDate();
@@ -48,6 +48,10 @@ class pgetJob : public CopyJob
    bool	no_parallel:1;
    bool chunks_done:1;
    bool pget_cont:1;
+   bool fxp:1;	   // chunks are server to server copies
+   FileAccessRef size_session;
+   FileSet size_info;
+   bool CheckTargetSize();
 
    void free_chunks();
    ChunkXfer *NewChunk(const char *remote,off_t start,off_t limit);
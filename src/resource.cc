@@ -35,6 +35,7 @@
 #include "configmake.h"
 #include "misc.h"
 #include "localcharset.h"
+#include "Checksum.h"
 
 static const char *FtpProxyValidate(xstring_c *p)
 {
@@ -92,6 +93,13 @@ static const char *PutOrPost(xstring_c *s)
    return 0;
 }
 
+static const char *ChecksumTypeValidate(xstring_c *s)
+{
+   if(Checksum::Find(*s)==Checksum::NONE)
+      return _("unsupported checksum type");
+   return 0;
+}
+
 static const char *const af_list[]=
 {
    "inet",
@@ -223,6 +231,7 @@ static ResType lftp_vars[] = {
    {"ftp:use-mdtm",		 "yes",   ResMgr::BoolValidate,0},
    {"ftp:use-mdtm-overloaded",	 "no",	  ResMgr::BoolValidate,0},
    {"ftp:use-mlsd",		 "no",    ResMgr::BoolValidate,0},
+   {"ftp:use-mode-b",		 "no",    ResMgr::BoolValidate,0},
    {"ftp:use-pret",		 "yes",   ResMgr::BoolValidate,0},
    {"ftp:use-site-chmod",	 "yes",   ResMgr::BoolValidate,0},
    {"ftp:use-site-idle",	 "no",    ResMgr::BoolValidate,0},
@@ -262,7 +271,12 @@ static ResType lftp_vars[] = {
    {"http:proxy",		 "",	  HttpProxyValidate,0},
    {"http:use-mkcol",		 "yes",   ResMgr::BoolValidate,0},
    {"http:use-propfind",	 "no",    ResMgr::BoolValidate,0},
+   {"http:use-propfind-infinity","yes",  ResMgr::BoolValidate,0},
    {"http:use-allprop",		 "no",	  ResMgr::BoolValidate,0},
+   {"http:use-compression",	 "yes",   ResMgr::BoolValidate,0},
+   {"http:use-validators",	 "yes",   ResMgr::BoolValidate,0},
+   {"http:save-validators",	 "no",	  ResMgr::BoolValidate,0},
+   {"http:decompress-files",	 "no",	  ResMgr::BoolValidate,0},
    {"http:user-agent",		 PACKAGE"/"VERSION,0,0},
    {"http:cookie",		 "",	  0,0},
    {"http:set-cookies",		 "no",	  0,0},
@@ -280,10 +294,13 @@ static ResType lftp_vars[] = {
    {"net:limit-total-rate",	 "0:0",   ResMgr::UNumberPairValidate,ResMgr::NoClosure},
    {"net:max-retries",		 "1000",  ResMgr::UNumberValidate,0},
    {"net:persist-retries",	 "0",	  ResMgr::UNumberValidate,0},
+   {"net:prewarm-sessions",	 "0",	  ResMgr::UNumberValidate,0},
    {"net:no-proxy",		 "",	  0,ResMgr::NoClosure},
    {"net:reconnect-interval-base","30",	  ResMgr::UNumberValidate,0},
    {"net:reconnect-interval-multiplier","1.5",ResMgr::FloatValidate,0},
    {"net:reconnect-interval-max","600",	  ResMgr::UNumberValidate,0},
+   {"net:session-pool-max",	 "64",	  ResMgr::UNumberValidate,ResMgr::NoClosure},
+   {"net:session-pool-max-per-host","16", ResMgr::UNumberValidate,0},
    {"net:socket-buffer",	 "0",	  ResMgr::UNumberValidate,0},
    {"net:socket-maxseg",	 "0",	  ResMgr::UNumberValidate,0},
    {"net:socket-bind-ipv4",	 "",	  ResMgr::IPv4AddrValidate,0},
@@ -305,7 +322,14 @@ static ResType lftp_vars[] = {
    {"mirror:skip-noaccess",	 "no",    ResMgr::BoolValidate,ResMgr::NoClosure},
    {"mirror:no-empty-dirs",	 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
 
+   {"log:trace",		 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
+   {"log:trace-file",		 "",	  0,ResMgr::NoClosure},
+   {"log:trace-size",		 "8192",  ResMgr::UNumberValidate,ResMgr::NoClosure},
+
+   {"metrics:listen",		 "",	  0,ResMgr::NoClosure},
+
    {"sftp:max-packets-in-flight","16",	  ResMgr::UNumberValidate,0},
+   {"sftp:prefetch-dirs",	 "8",	  ResMgr::UNumberValidate,0},
    {"sftp:protocol-version",	 "6",	  ResMgr::UNumberValidate,0},
    {"sftp:size-read",		 "32k",	  ResMgr::UNumberValidate,0},
    {"sftp:size-write",		 "32k",	  ResMgr::UNumberValidate,0},
@@ -342,6 +366,10 @@ static ResType lftp_vars[] = {
    {"xfer:destination-directory","",	  0,0},
    {"xfer:verify",		 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"xfer:verify-command",	 "",	  ResMgr::FileExecutable,0},
+   {"xfer:verify-checksum",	 "yes",	  ResMgr::BoolValidate,ResMgr::NoClosure},
+   {"xfer:checksum-cache",	 "yes",	  ResMgr::BoolValidate,ResMgr::NoClosure},
+   {"xfer:checksum-manifest",	 "",	  ResMgr::FileCreatable,ResMgr::NoClosure},
+   {"xfer:checksum-type",	 "sha256",ChecksumTypeValidate,ResMgr::NoClosure},
    {"xfer:log",			 "yes",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"xfer:auto-rename",		 "no",	  ResMgr::BoolValidate,ResMgr::NoClosure},
    {"xfer:log-file",              "",     ResMgr::FileCreatable,ResMgr::NoClosure},
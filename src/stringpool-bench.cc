@@ -0,0 +1,124 @@
+/*
+	Microbenchmark of StringPool against the sorted array it replaced,
+	with short names like the user and group names of file listings.
+
+	Build with `make stringpool-bench' and run as
+	   ./stringpool-bench [names...]
+	The pool cannot be emptied, so the first interning of each name is
+	timed once; lookups are the best of several rounds. Times are in
+	nanoseconds per operation.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "xstring.h"
+#include "xarray.h"
+#include "StringPool.h"
+
+char *program_name;
+
+static double now_ns()
+{
+   struct timeval tv;
+   gettimeofday(&tv,0);
+   return tv.tv_sec*1e9+tv.tv_usec*1e3;
+}
+
+// the former StringPool implementation.
+class SortedPool
+{
+   xarray_p<char> strings;
+public:
+   const char *Get(const char *s)
+   {
+      int l=0;
+      int u=strings.count();
+      while(l<u)
+      {
+	 int m=(l+u)/2;
+	 int cmp=strcmp(strings[m],s);
+	 if(cmp==0)
+	    return strings[m];
+	 if(cmp>0)
+	    u=m;
+	 else
+	    l=m+1;
+      }
+      strings.insert(xstrdup(s),u);
+      return strings[u];
+   }
+};
+
+// the serial number keeps names of different runs apart, as they all
+// go to the same StringPool.
+static xstring *make_names(int n,int serial)
+{
+   xstring *names=new xstring[n];
+   srandom(serial);
+   for(int i=0; i<n; i++) {
+      names[i].setf("%c%d-",'a'+serial%26,serial);
+      int len=3+random()%8;
+      for(int j=0; j<len; j++)
+	 names[i].append(char('a'+random()%26));
+   }
+   return names;
+}
+
+enum { ROUNDS=5, LOOKUPS=200000 };
+
+static void bench(int n)
+{
+   static int serial;
+   xstring *names=make_names(n,++serial);
+   long sum=0;
+
+   SortedPool sorted;
+   double t0=now_ns();
+   for(int i=0; i<n; i++)
+      sum+=long(sorted.Get(names[i]));
+   double t1=now_ns();
+   for(int i=0; i<n; i++)
+      sum+=long(StringPool::Get(names[i]));
+   double t2=now_ns();
+   double insert_sorted=t1-t0;
+   double insert_pool=t2-t1;
+
+   double hit_sorted=1e30,hit_pool=1e30;
+   for(int r=0; r<ROUNDS; r++) {
+      // look the names up in another order than they were added
+      double t0=now_ns();
+      for(int i=0; i<LOOKUPS; i++)
+	 sum+=long(sorted.Get(names[(i*7919L)%n]));
+      double t1=now_ns();
+      for(int i=0; i<LOOKUPS; i++)
+	 sum+=long(StringPool::Get(names[(i*7919L)%n]));
+      double t2=now_ns();
+      if(t1-t0<hit_sorted)
+	 hit_sorted=t1-t0;
+      if(t2-t1<hit_pool)
+	 hit_pool=t2-t1;
+   }
+   printf("%8d %10.1f %10.1f %10.1f %10.1f%s\n",n,
+      insert_sorted/n,insert_pool/n,hit_sorted/LOOKUPS,hit_pool/LOOKUPS,
+      sum==-1?" ":"");
+   delete[] names;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+   printf("ns per operation, lookups are the best of %d rounds\n",ROUNDS);
+   printf("%8s %10s %10s %10s %10s\n","names","ins sorted","ins pool","hit sorted","hit pool");
+   if(argc>1) {
+      for(int i=1; i<argc; i++)
+	 bench(atoi(argv[i]));
+   } else {
+      static const int sizes[]={100,1000,10000,100000};
+      for(unsigned i=0; i<sizeof(sizes)/sizeof(*sizes); i++)
+	 bench(sizes[i]);
+   }
+   return 0;
+}
@@ -0,0 +1,194 @@
+/*
+	Loopback packet rate benchmark of the UDP calls used by the torrent
+	listener: sendto/recvfrom one datagram at a time against
+	sendmmsg/recvmmsg in batches of TorrentListener::UDP_BATCH.
+
+	Build with `make udp-bench' and run as
+	   ./udp-bench [datagram-size [datagrams]]
+	The datagrams are sent in bursts which fit the socket buffer and
+	then received. Times are the best of several rounds, in nanoseconds
+	per datagram.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+char *program_name;
+
+static double now_ns()
+{
+   struct timeval tv;
+   gettimeofday(&tv,0);
+   return tv.tv_sec*1e9+tv.tv_usec*1e3;
+}
+
+enum { ROUNDS=5, BATCH=32, BURST=64, MAX_PACKET=0x10000 };
+
+static int sock_out,sock_in;
+static struct sockaddr_in addr_in;
+static int size;
+static char *send_data,*recv_data;
+
+static int open_socket(struct sockaddr_in *a)
+{
+   int s=socket(AF_INET,SOCK_DGRAM,0);
+   if(s==-1) {
+      perror("socket");
+      exit(1);
+   }
+   memset(a,0,sizeof(*a));
+   a->sin_family=AF_INET;
+   a->sin_addr.s_addr=htonl(INADDR_LOOPBACK);
+   if(bind(s,(struct sockaddr*)a,sizeof(*a))==-1) {
+      perror("bind");
+      exit(1);
+   }
+   socklen_t len=sizeof(*a);
+   getsockname(s,(struct sockaddr*)a,&len);
+   int buf_size=4<<20;
+   setsockopt(s,SOL_SOCKET,SO_RCVBUF,&buf_size,sizeof(buf_size));
+   setsockopt(s,SOL_SOCKET,SO_SNDBUF,&buf_size,sizeof(buf_size));
+   return s;
+}
+
+static int send_single(int n)
+{
+   int sent=0;
+   while(sent<n) {
+      if(sendto(sock_out,send_data,size,0,(struct sockaddr*)&addr_in,sizeof(addr_in))==-1)
+	 break;
+      sent++;
+   }
+   return sent;
+}
+static int recv_single(int n)
+{
+   int got=0;
+   while(got<n) {
+      struct sockaddr_in src;
+      socklen_t src_len=sizeof(src);
+      if(recvfrom(sock_in,recv_data,MAX_PACKET,MSG_DONTWAIT|MSG_TRUNC,(struct sockaddr*)&src,&src_len)==-1)
+	 break;
+      got++;
+   }
+   return got;
+}
+
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG)
+static int send_batch(int n)
+{
+   struct iovec iov[BATCH];
+   struct mmsghdr msg[BATCH];
+   int sent=0;
+   while(sent<n) {
+      int count=n-sent;
+      if(count>BATCH)
+	 count=BATCH;
+      memset(msg,0,count*sizeof(*msg));
+      for(int i=0; i<count; i++) {
+	 iov[i].iov_base=send_data;
+	 iov[i].iov_len=size;
+	 msg[i].msg_hdr.msg_iov=iov+i;
+	 msg[i].msg_hdr.msg_iovlen=1;
+	 msg[i].msg_hdr.msg_name=&addr_in;
+	 msg[i].msg_hdr.msg_namelen=sizeof(addr_in);
+      }
+      int res=sendmmsg(sock_out,msg,count,0);
+      if(res<=0)
+	 break;
+      sent+=res;
+   }
+   return sent;
+}
+static int recv_batch(int n)
+{
+   struct iovec iov[BATCH];
+   struct mmsghdr msg[BATCH];
+   struct sockaddr_in src[BATCH];
+   int got=0;
+   while(got<n) {
+      memset(msg,0,sizeof(msg));
+      for(int i=0; i<BATCH; i++) {
+	 iov[i].iov_base=recv_data+i*MAX_PACKET;
+	 iov[i].iov_len=MAX_PACKET;
+	 msg[i].msg_hdr.msg_iov=iov+i;
+	 msg[i].msg_hdr.msg_iovlen=1;
+	 msg[i].msg_hdr.msg_name=&src[i];
+	 msg[i].msg_hdr.msg_namelen=sizeof(src[i]);
+      }
+      int res=recvmmsg(sock_in,msg,BATCH,MSG_DONTWAIT,0);
+      if(res<=0)
+	 break;
+      got+=res;
+   }
+   return got;
+}
+#endif
+
+static void bench(const char *name,int (*send_f)(int),int (*recv_f)(int),int n)
+{
+   double best_send=1e30,best_recv=1e30;
+   int lost=0;
+   for(int r=0; r<ROUNDS; r++) {
+      double t_send=0,t_recv=0;
+      for(int done=0; done<n; done+=BURST) {
+	 double t0=now_ns();
+	 int sent=send_f(BURST);
+	 double t1=now_ns();
+	 int got=recv_f(sent);
+	 double t2=now_ns();
+	 t_send+=t1-t0;
+	 t_recv+=t2-t1;
+	 lost+=BURST-got;
+      }
+      if(t_send<best_send)
+	 best_send=t_send;
+      if(t_recv<best_recv)
+	 best_recv=t_recv;
+   }
+   printf("%-18s %10.1f %10.1f %10.0f",name,best_send/n,best_recv/n,
+      1e9*n/(best_send+best_recv));
+   if(lost>0)
+      printf("  (%d lost)",lost);
+   printf("\n");
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+   size=(argc>1?atoi(argv[1]):300);
+   int n=(argc>2?atoi(argv[2]):200000);
+   if(size<1 || size>MAX_PACKET || n<BURST) {
+      fprintf(stderr,"Usage: %s [datagram-size [datagrams]]\n",argv[0]);
+      return 1;
+   }
+   n-=n%BURST;
+
+   struct sockaddr_in addr_out;
+   sock_in=open_socket(&addr_in);
+   sock_out=open_socket(&addr_out);
+   send_data=(char*)calloc(1,size);
+   recv_data=(char*)malloc(BATCH*MAX_PACKET);
+
+   printf("%d byte datagrams, ns per datagram, best of %d rounds of %d\n",size,ROUNDS,n);
+   printf("%-18s %10s %10s %10s\n","calls","send","receive","per second");
+   bench("sendto/recvfrom",send_single,recv_single,n);
+#if defined(HAVE_SENDMMSG) && defined(HAVE_RECVMMSG)
+   bench("sendmmsg/recvmmsg",send_batch,recv_batch,n);
+#else
+   printf("sendmmsg/recvmmsg are not available\n");
+#endif
+   close(sock_in);
+   close(sock_out);
+   return 0;
+}
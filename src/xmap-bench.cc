@@ -0,0 +1,90 @@
+/*
+	Microbenchmark of xmap: insert, lookup (hit and miss), iteration
+	and removal with keys like torrent info hashes and node ids.
+
+	Build with `make xmap-bench' and run as
+	   ./xmap-bench [key-length [entries...]]
+	Times are the best of several rounds, in nanoseconds per operation.
+*/
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "xmap.h"
+
+char *program_name;
+
+static double now_ns()
+{
+   struct timeval tv;
+   gettimeofday(&tv,0);
+   return tv.tv_sec*1e9+tv.tv_usec*1e3;
+}
+
+static xstring *make_keys(int n,int len,unsigned seed)
+{
+   xstring *keys=new xstring[n];
+   srandom(seed);
+   for(int i=0; i<n; i++) {
+      for(int j=0; j<len; j++)
+	 keys[i].append(char(random()));
+   }
+   return keys;
+}
+
+enum { ROUNDS=5 };
+
+static void bench(int n,int key_len)
+{
+   xstring *keys=make_keys(n,key_len,1);
+   xstring *missing=make_keys(n,key_len,2);
+
+   double best[5]={1e30,1e30,1e30,1e30,1e30};
+   long sum=0;
+   for(int r=0; r<ROUNDS; r++) {
+      xmap<int> map;
+      double t0=now_ns();
+      for(int i=0; i<n; i++)
+	 map.add(keys[i],i);
+      double t1=now_ns();
+      // look the keys up in another order than they were added
+      for(int i=0; i<n; i++)
+	 sum+=map.lookup(keys[(i*7919L)%n]);
+      double t2=now_ns();
+      for(int i=0; i<n; i++)
+	 sum+=map.lookup(missing[i]);
+      double t3=now_ns();
+      for(int v=map.each_begin(); !map.each_finished(); v=map.each_next())
+	 sum+=v;
+      double t4=now_ns();
+      for(int i=0; i<n; i++)
+	 map.remove(keys[i]);
+      double t5=now_ns();
+      double t[5]={t1-t0,t2-t1,t3-t2,t4-t3,t5-t4};
+      for(int j=0; j<5; j++)
+	 if(t[j]<best[j])
+	    best[j]=t[j];
+   }
+   printf("%8d %8.1f %8.1f %8.1f %8.1f %8.1f%s\n",n,
+      best[0]/n,best[1]/n,best[2]/n,best[3]/n,best[4]/n,sum==-1?" ":"");
+   delete[] keys;
+   delete[] missing;
+}
+
+int main(int argc,char **argv)
+{
+   program_name=argv[0];
+   int key_len=(argc>1?atoi(argv[1]):20);
+   printf("key length %d, ns per operation, best of %d rounds\n",key_len,ROUNDS);
+   printf("%8s %8s %8s %8s %8s %8s\n","entries","insert","hit","miss","iterate","remove");
+   if(argc>2) {
+      for(int i=2; i<argc; i++)
+	 bench(atoi(argv[i]),key_len);
+   } else {
+      static const int sizes[]={100,1000,10000,100000,1000000};
+      for(unsigned i=0; i<sizeof(sizes)/sizeof(*sizes); i++)
+	 bench(sizes[i],key_len);
+   }
+   return 0;
+}
@@ -20,155 +20,207 @@
 #include <config.h>
 #include <assert.h>
 #include "xmap.h"
-#include <stdio.h>
+#include <string.h>
 
-void _xmap::new_map()
-{
-   map.get_space(hash_size,1);
-   map.set_length(hash_size);
-   for(int i=0; i<hash_size; i++)
-      map[i]=0;
-}
 _xmap::_xmap(int vs)
    : value_size(vs)
 {
+   table=0;
+   table_mask=0;
    entry_count=0;
-   hash_size=1;
-   new_map();
+   first_entry=last_added=0;
+   each_entry=last_entry=0;
 }
 void _xmap::_empty()
 {
-   for(int i=0; i<hash_size; i++) {
-      while(map[i])
-	 _remove(&map[i]);
+   while(first_entry) {
+      entry *e=first_entry;
+      first_entry=e->next;
+      e->~entry();
+      xfree(e);
    }
-   assert(entry_count==0);
+   last_added=0;
+   each_entry=last_entry=0;
+   entry_count=0;
+   xfree(table);
+   table=0;
+   table_mask=0;
 }
 _xmap::~_xmap()
 {
    _empty();
 }
 
-int _xmap::make_hash(const xstring& s) const
+unsigned _xmap::make_hash(const char *p,size_t len)
 {
-   if(hash_size==1)
+   // process the key 8 bytes at a time with multiply-xorshift mixing.
+   unsigned long long h=0x9e3779b97f4a7c15ULL^len;
+   unsigned long long w;
+   while(len>=8) {
+      memcpy(&w,p,8);
+      h=(h^w)*0xff51afd7ed558ccdULL;
+      h^=h>>32;
+      p+=8;
+      len-=8;
+   }
+   if(len>0) {
+      w=0;
+      memcpy(&w,p,len);
+      h=(h^w)*0xff51afd7ed558ccdULL;
+   }
+   h^=h>>33;
+   h*=0xc4ceb9fe1a85ec53ULL;
+   h^=h>>33;
+   return (unsigned)h;
+}
+
+_xmap::slot *_xmap::find_slot(const xstring& key,unsigned hash) const
+{
+   if(!table)
       return 0;
-   unsigned hash=0x12345678;
-   for(unsigned i=0; i<s.length(); i++) {
-      hash^=(hash<<5)+s[i];
+   unsigned i=hash&table_mask;
+   for(unsigned dist=0; ; dist++, i=(i+1)&table_mask) {
+      slot *s=&table[i];
+      if(!s->e)
+	 return 0;
+      // Robin Hood invariant: the key would have displaced this entry.
+      if(((i-s->hash)&table_mask)<dist)
+	 return 0;
+      if(s->hash==hash && s->e->key.eq(key))
+	 return s;
    }
-   hash^=(hash<<5)+s.length();
-   hash%=hash_size;
-   return hash;
 }
 
 _xmap::entry **_xmap::_lookup(const xstring& key)
 {
-   int hash=make_hash(key);
-   entry **ep=&map[hash];
-   entry *e=*ep;
-   while(e) {
-      if(e->key.eq(key))
-	 return ep;
-      ep=&e->next;
-      e=*ep;
-   }
-   return ep;
+   slot *s=find_slot(key,make_hash(key));
+   return s?&s->e:0;
 }
 
 _xmap::entry *_xmap::_lookup_c(const xstring& key) const
 {
-   for(entry *e=map[make_hash(key)]; e; e=e->next) {
-      if(e->key.eq(key))
-	 return e;
-   }
-   return 0;
+   slot *s=find_slot(key,make_hash(key));
+   return s?s->e:0;
 }
 
-void _xmap::rebuild_map()
+void _xmap::insert_slot(entry *e)
 {
-   static const int primes[]={
-      17,67,257,1031,4099,16411,65537,262147,1048583,4194319,16777259,
-      67108879,268435459,1073741827
-   };
-   hash_size=entry_count*2;
-   // a prime is better, find it.
-   for(unsigned pi=0; pi<sizeof(primes)/sizeof(primes[0]); pi++) {
-      if(hash_size<primes[pi]) {
-	 hash_size=primes[pi];
-	 break;
+   slot ins={e,e->hash};
+   unsigned i=ins.hash&table_mask;
+   for(unsigned dist=0; ; dist++, i=(i+1)&table_mask) {
+      slot *s=&table[i];
+      if(!s->e) {
+	 *s=ins;
+	 return;
       }
-   }
-   xarray_p<_xmap::entry> old_map;
-   old_map.move_here(map);
-   new_map();
-   for(int i=0; i<old_map.length(); i++) {
-      entry *e=old_map[i];
-      old_map[i]=0;
-      while(e) {
-	 entry *next=e->next;
-	 int hash=make_hash(e->key);
-	 e->next=map[hash];
-	 map[hash]=e;
-	 e=next;
+      unsigned d=(i-s->hash)&table_mask;
+      if(d<dist) {
+	 // take from the rich, continue with the displaced entry.
+	 slot t=*s;
+	 *s=ins;
+	 ins=t;
+	 dist=d;
       }
    }
 }
 
+void _xmap::rebuild_map(unsigned new_size)
+{
+   xfree(table);
+   table=(slot*)xmalloc(new_size*sizeof(slot));
+   memset(table,0,new_size*sizeof(slot));
+   table_mask=new_size-1;
+   for(entry *e=first_entry; e; e=e->next)
+      insert_slot(e);
+}
+
 _xmap::entry *_xmap::_add(const xstring& key)
 {
-   entry **ep=_lookup(key);
-   if(*ep==0) {
-      entry *n=(entry*)xmalloc(sizeof(entry)+value_size);
-      memset(n,0,sizeof(entry)+value_size);
-      n->next=0;
-      n->key.set(key);
-      *ep=n;
-      entry_count++;
-      if(entry_count>hash_size*2)
-	 rebuild_map();
-      return n;
-   }
-   return *ep;
+   unsigned hash=make_hash(key);
+   slot *s=find_slot(key,hash);
+   if(s)
+      return s->e;
+
+   entry *n=(entry*)xmalloc(sizeof(entry)+value_size);
+   memset(n,0,sizeof(entry)+value_size);
+   n->key.set(key);
+   n->hash=hash;
+   n->prev=last_added;
+   if(last_added)
+      last_added->next=n;
+   else
+      first_entry=n;
+   last_added=n;
+   entry_count++;
+
+   // keep the load factor below 7/8.
+   unsigned size=(table?table_mask+1:0);
+   if((unsigned)entry_count*8>size*7)
+      rebuild_map(size?size*2:8);
+   else
+      insert_slot(n);
+   return n;
 }
 void _xmap::_remove(entry **ep)
 {
    if(!ep || !*ep)
       return;
    entry *e=*ep;
-   *ep=e->next;
-   delete e;
+   // backward shift deletion, no tombstones needed.
+   unsigned i=(slot*)ep-table;
+   for(;;) {
+      unsigned j=(i+1)&table_mask;
+      slot *n=&table[j];
+      if(!n->e || ((j-n->hash)&table_mask)==0)
+	 break;
+      table[i]=*n;
+      i=j;
+   }
+   table[i].e=0;
+
+   if(e->prev)
+      e->prev->next=e->next;
+   else
+      first_entry=e->next;
+   if(e->next)
+      e->next->prev=e->prev;
+   else
+      last_added=e->prev;
+   if(each_entry==e)
+      each_entry=e->next;
+   if(last_entry==e)
+      last_entry=0;
+
+   e->~entry();
+   xfree(e);
    entry_count--;
 }
 
 _xmap::entry *_xmap::_each_begin()
 {
-   each_entry=0;
-   each_hash=-1;
+   each_entry=first_entry;
    return _each_next();
 }
 _xmap::entry *_xmap::_each_next()
 {
-   while(each_hash<hash_size) {
-      entry *e=each_entry;
-      if(e) {
-	 last_entry=e;
-	 each_entry=e->next;
-	 return e;
-      }
-      each_entry=map[++each_hash];
-   }
-   last_entry=0;
-   return 0;
+   last_entry=each_entry;
+   if(each_entry)
+      each_entry=each_entry->next;
+   return last_entry;
 }
 
 void _xmap::_move_here(_xmap &o)
 {
+   _empty();
    value_size=o.value_size;
-   hash_size=o.hash_size;
+   table=o.table;
+   table_mask=o.table_mask;
    entry_count=o.entry_count;
-   map.move_here(o.map);
-   o.hash_size=1;
+   first_entry=o.first_entry;
+   last_added=o.last_added;
+   o.table=0;
+   o.table_mask=0;
    o.entry_count=0;
-   o.new_map();
+   o.first_entry=o.last_added=0;
+   o.each_entry=o.last_entry=0;
 }
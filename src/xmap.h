@@ -22,33 +22,49 @@
 
 #include "xarray.h"
 
+// A hash table with string keys. Open addressing with Robin Hood probing
+// is used for the index; the slots keep the full hash, so a lookup rarely
+// touches an entry with another key. Entries are allocated separately and
+// linked in insertion order, so pointers to them stay valid while the
+// table grows, and the entry returned by each_begin/each_next can be
+// removed during the iteration.
 class _xmap
 {
 protected:
    struct entry
    {
-      entry *next;
+      entry *next;	// insertion order
+      entry *prev;
       xstring key;
+      unsigned hash;
+      // value_size bytes of the value follow.
+   };
+   struct slot
+   {
+      entry *e;	// must be first, _lookup returns &slot.e
+      unsigned hash;
    };
    int value_size;
 
-   int hash_size;
-   int make_hash(const xstring& s) const;
-
-   xarray_p<_xmap::entry> map;
-   void new_map();
-   void rebuild_map();
+   slot *table;	// power of 2 sized, allocated on first add
+   unsigned table_mask;
+   static unsigned make_hash(const xstring& s) { return make_hash(s.get(),s.length()); }
+   slot *find_slot(const xstring& key,unsigned hash) const;
+   void insert_slot(entry *e);
+   void rebuild_map(unsigned new_size);
 
    int entry_count;
+   entry *first_entry;
+   entry *last_added;
 
-   int each_hash;
-   entry *each_entry;
+   entry *each_entry; // the entry to be returned by each_next
    entry *last_entry; // the entry returned by last each_begin/next
 
 public:
+   static unsigned make_hash(const char *s,size_t len);
+
    _xmap(int vs);
    ~_xmap();
-   void _add(const xstring& key,void *value);
    _xmap::entry **_lookup(const xstring& key);
    _xmap::entry *_lookup_c(const xstring& key) const;
    entry *_add(const xstring& key);
@@ -145,12 +161,9 @@ public:
    void each_set(T *n) { payload_Lv(last_entry)=n; }
    void move_here(xmap_p<T> &o) { _move_here(o); }
    void empty() {
-      for(int i=0; i<hash_size; i++) {
-	 while(map[i]) {
-	    delete(payload(map[i]));
-	    _remove(&map[i]);
-	 }
-      }
+      for(entry *e=_each_begin(); e; e=_each_next())
+	 delete(payload(e));
+      _empty();
    }
 };
 
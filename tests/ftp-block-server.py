@@ -0,0 +1,185 @@
+#!/usr/bin/env python3
+#
+# A small FTP server for the MODE B tests. It serves one client at a
+# time from a directory, supports stream and block mode for RETR and
+# STOR, and keeps a block mode data connection open between transfers.
+# Like strict servers, it refuses REST with a byte offset in block mode.
+#
+# Usage: ftp-block-server.py root-dir log-file
+#   prints the port it listens on to stdout.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 3 of the License, or
+# (at your option) any later version.
+#
+
+import os, socket, struct, sys
+
+root, log_name = sys.argv[1], sys.argv[2]
+log = open(log_name, 'w', buffering=1)
+
+BLOCK_EOF = 0x40
+
+
+class Session:
+    def __init__(self, ctl):
+        self.ctl = ctl
+        self.rfile = ctl.makefile('rb')
+        self.mode = 'S'
+        self.rest = 0
+        self.listener = None
+        self.data = None
+        self.connections = 0
+
+    def reply(self, s):
+        self.ctl.sendall((s + '\r\n').encode())
+
+    def path(self, name):
+        return os.path.join(root, name.lstrip('/'))
+
+    def open_data(self):
+        if self.data is None:
+            if self.listener is None:
+                return None
+            self.data, _ = self.listener.accept()
+            self.listener.close()
+            self.listener = None
+            self.connections += 1
+            log.write('DATA %d\n' % self.connections)
+        return self.data
+
+    def close_data(self):
+        if self.data is not None:
+            self.data.close()
+            self.data = None
+
+    def recv_exact(self, n):
+        buf = b''
+        while len(buf) < n:
+            got = self.data.recv(n - len(buf))
+            if not got:
+                raise EOFError
+            buf += got
+        return buf
+
+    def retr(self, name):
+        try:
+            f = open(self.path(name), 'rb')
+        except OSError:
+            self.reply('550 No such file')
+            return
+        with f:
+            f.seek(self.rest)
+            self.reply('150 Opening data connection')
+            d = self.open_data()
+            while True:
+                chunk = f.read(0xffff)
+                if not chunk:
+                    break
+                if self.mode == 'B':
+                    d.sendall(struct.pack('>BH', 0, len(chunk)))
+                d.sendall(chunk)
+        if self.mode == 'B':
+            d.sendall(struct.pack('>BH', BLOCK_EOF, 0))
+            self.reply('250 Transfer complete, data connection left open')
+        else:
+            self.close_data()
+            self.reply('226 Transfer complete')
+
+    def stor(self, name):
+        f = open(self.path(name), 'r+b' if self.rest else 'wb')
+        with f:
+            f.seek(self.rest)
+            f.truncate()
+            self.reply('150 Opening data connection')
+            d = self.open_data()
+            if self.mode == 'B':
+                while True:
+                    desc, count = struct.unpack('>BH', self.recv_exact(3))
+                    f.write(self.recv_exact(count))
+                    if desc & BLOCK_EOF:
+                        break
+            else:
+                while True:
+                    chunk = d.recv(0x10000)
+                    if not chunk:
+                        break
+                    f.write(chunk)
+        if self.mode == 'B':
+            self.reply('250 Transfer complete, data connection left open')
+        else:
+            self.close_data()
+            self.reply('226 Transfer complete')
+
+    def run(self):
+        self.reply('220 test server')
+        for line in self.rfile:
+            line = line.decode().rstrip('\r\n')
+            cmd, _, arg = line.partition(' ')
+            cmd = cmd.upper()
+            log.write('%s %s\n' % (self.mode, line))
+            rest, self.rest = self.rest, 0
+            if cmd == 'USER':
+                self.reply('331 Password required')
+            elif cmd == 'PASS':
+                self.reply('230 Logged in')
+            elif cmd == 'SYST':
+                self.reply('215 UNIX Type: L8')
+            elif cmd == 'FEAT':
+                self.reply('211-Features\r\n SIZE\r\n MODE B\r\n REST STREAM\r\n211 End')
+            elif cmd == 'PWD':
+                self.reply('257 "/"')
+            elif cmd == 'CWD':
+                self.reply('250 OK')
+            elif cmd == 'TYPE':
+                self.reply('200 OK')
+            elif cmd == 'MODE':
+                if arg.upper() in ('S', 'B'):
+                    if arg.upper() != self.mode:
+                        self.close_data()
+                    self.mode = arg.upper()
+                    self.reply('200 Mode set to ' + self.mode)
+                else:
+                    self.reply('504 Mode not supported')
+            elif cmd == 'REST':
+                if self.mode == 'B':
+                    self.reply('501 REST takes a restart marker in block mode')
+                else:
+                    self.rest = int(arg)
+                    self.reply('350 Restarting at ' + arg)
+            elif cmd == 'SIZE':
+                try:
+                    self.reply('213 %d' % os.path.getsize(self.path(arg)))
+                except OSError:
+                    self.reply('550 No such file')
+            elif cmd == 'PASV':
+                self.close_data()
+                self.listener = socket.socket()
+                self.listener.bind(('127.0.0.1', 0))
+                self.listener.listen(1)
+                port = self.listener.getsockname()[1]
+                self.reply('227 Entering Passive Mode (127,0,0,1,%d,%d)' % (port >> 8, port & 255))
+            elif cmd == 'RETR':
+                self.rest = rest
+                self.retr(arg)
+            elif cmd == 'STOR':
+                self.rest = rest
+                self.stor(arg)
+            elif cmd == 'QUIT':
+                self.reply('221 Bye')
+                break
+            else:
+                self.reply('502 Not implemented')
+        self.close_data()
+        self.ctl.close()
+
+
+server = socket.socket()
+server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+server.bind(('127.0.0.1', 0))
+server.listen(1)
+print(server.getsockname()[1], flush=True)
+while True:
+    ctl, _ = server.accept()
+    Session(ctl).run()